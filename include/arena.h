@@ -0,0 +1,30 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+//------------------------------------------------------------------
+// Data Structures
+//------------------------------------------------------------------
+struct Arena
+{
+    char const *name;
+    uint8_t *base;
+    u32 capacity;
+    u32 used;                              // Bytes handed out, the next allocation's offset
+    u32 highWater;                         // Most bytes ever in use at once
+    u32 allocationCount;
+};
+
+// Allocations record the call site so an overflow can say who asked
+#define arenaAlloc(arena, size) allocFromArena((arena), (size), __FILE__, __LINE__)
+
+//------------------------------------------------------------------
+// Function Prototypes
+//------------------------------------------------------------------
+extern void* allocFromArena(enum arenaId const arena, u32 const size, char const *file, int const line);
+extern u32 getArenaMark(enum arenaId const arena);
+extern void restoreArenaMark(enum arenaId const arena, u32 const mark);
+extern void releaseArena(enum arenaId const arena, void const *allocation);
+extern void resetArena(enum arenaId const arena);
+extern void printArenaStats();
+
+#endif // ARENA_H
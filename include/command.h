@@ -0,0 +1,40 @@
+#ifndef COMMAND_H
+#define COMMAND_H
+
+//------------------------------------------------------------------
+// Data Structures
+//------------------------------------------------------------------
+struct Command
+{
+    uint8_t type;                          // enum commandType
+    uint8_t entityIndex;
+    uint8_t posX, posY;                    // Target tile
+    uint8_t value;
+};
+
+// Everything the applied commands changed since the last clear, for
+// FOV, rendering and AI to consume instead of rescanning the map.
+struct ChangeSet
+{
+    uint8_t changedTileX[CHANGE_SET_MAX_TILES], changedTileY[CHANGE_SET_MAX_TILES];
+    int changedTileCount;
+    boolean isTileListFull;                // Tiles were dropped; treat everything as changed
+    uint8_t movedEntity[NUM_MAX_ENTITIES];
+    u32 isEntityMoved[NUM_MAX_ENTITIES / 32];
+    int movedEntityCount;
+    uint8_t playerMoveDirection;           // enum direction, DIR_NULL if the player stayed
+    int commandCount;
+};
+
+//------------------------------------------------------------------
+// Function Prototypes
+//------------------------------------------------------------------
+extern void pushCommand(enum commandType const type, int const entityIndex, int const positionX, int const positionY, int const value);
+extern int applyCommands();
+extern void markEntityChanged(int const entityIndex);
+extern struct ChangeSet const* getChangeSet();
+extern void clearChangeSet();
+extern void printCommandStats();
+extern void resetCommandStats();
+
+#endif // COMMAND_H
@@ -14,6 +14,12 @@
 #define SCREEN_HEIGHT_TILES    SCREEN_HEIGHT / TILE_SIZE       // 10
 
 #define SCREEN_BLOCK_SIZE 32
+
+// Map sectors: coarse square regions of the gameMap
+#define MAP_SECTOR_SIZE    8
+#define MAP_SECTORS_WIDE  ((MAP_WIDTH_TILES + MAP_SECTOR_SIZE - 1) / MAP_SECTOR_SIZE)    // 9
+#define MAP_SECTORS_HIGH  ((MAP_HEIGHT_TILES + MAP_SECTOR_SIZE - 1) / MAP_SECTOR_SIZE)   // 5
+#define NUM_MAP_SECTORS   (MAP_SECTORS_WIDE * MAP_SECTORS_HIGH)
 // The top-left screen entry of the player's position on screen(when scrolling offsets are 0)
 #define SCREEN_ENTRY_PLAYER 336
 
@@ -57,6 +63,10 @@
 #define STAIRS_TR         0x6000001F
 #define STAIRS_BL         0x60000020
 #define STAIRS_BR         0x60000021
+#define STAIRS_UP_TL      (STAIRS_TR | SE_HFLIP)     // Stairs mirrored
+#define STAIRS_UP_TR      (STAIRS_TL | SE_HFLIP)
+#define STAIRS_UP_BL      (STAIRS_BR | SE_HFLIP)
+#define STAIRS_UP_BR      (STAIRS_BL | SE_HFLIP)
 
 // Player Sprite Indices
 #define PLAYER_FACING_LEFT_FR1  0
@@ -67,8 +77,139 @@
 #define PLAYER_FACING_DOWN_FR2 20
 
 // Entity defines
-#define NUM_MAX_ENTITIES    2
+#define NUM_MAX_ENTITIES  256          // Slot indices must fit in a byte
+#define NUM_START_ENTITIES  2          // Player included
 #define PLAYER_INDEX 0
+#define ENTITY_HANDLE_NULL  0
+#define MAX_ENTITY_SPRITES 127         // OAM objects left after the player
+#define ENTITY_INDEX_NULL  0xFFFF      // End of a sector's entity list
+
+// Activity region defines
+#define SECTOR_ACTIVE_RANGE        1   // Sectors around the player's that are simulated, covers the screen
+#define SECTOR_CATCH_UP_MAX_STEPS  8   // Missed turns a woken entity makes up for
+
+// Turn scheduler defines
+#define ENTITY_SPEED_SLOW          5
+#define ENTITY_SPEED_NORMAL       10
+#define ENTITY_SPEED_FAST         20
+#define TURN_TIME                100   // Ticks between actions at normal speed
+#define SCHEDULER_CYCLE_BUDGET (CYCLES_PER_FRAME / 4)   // Monster AI time per frame
+#define BUDGET_TIMER_SHIFT         6   // Budget timer ticks every 64 cycles
+
+// Command buffer defines
+#define COMMAND_BUFFER_SIZE        8   // Commands one entity turn can queue
+#define CHANGE_SET_MAX_TILES      32   // Changed tiles listed before the set overflows
+
+// Arena allocator defines
+#define FLOOR_ARENA_SIZE   (16 * 1024)     // Allocations that live until the floor changes, such as the flow fields
+#define SCRATCH_ARENA_SIZE (16 * 1024)     // Allocations that live for one frame at most
+#define ARENA_ALIGNMENT          4
+
+// Deferred log defines
+#define LOG_BUFFER_EVENTS        128   // Events held before new ones are dropped
+#define LOG_EVENT_MAX_ARGS         4
+#define LOG_DRAIN_LAST_LINE      150   // Draining stops at this scanline so VBlank isn't missed
+
+// Performance overlay defines
+#define PERF_OVERLAY_ROW          17   // Screen entry row of the overlay's first line
+#define PERF_OVERLAY_ROWS          3
+#define PERF_OVERLAY_INTERVAL     30   // Frames sampled per overlay update
+#define PERF_OVERLAY_FONT_TILE   256   // First font tile in the HUD's charblock, past the tileset
+#define PERF_OVERLAY_PALBANK      15
+
+// Text page defines
+#define TEXT_PAGE_MAX_FIELDS      24
+#define TEXT_FIELD_MAX_CHARS      16   // Longest value a field shows, including the terminator
+#define TEXT_INT_MAX_CHARS        12   // Sign, ten digits and the terminator
+
+// Map dump defines
+#define mapLayerBit(layer) (1 << (layer))    // Selects a layer for printMapLayersInLog
+
+// Input replay defines
+#define REPLAY_MAX_RUNS         8192   // Runs of unchanged keys recorded before recording stops
+#define REPLAY_RUN_MAX_FRAMES 0xFFFF   // Frames one run can hold before a new run is started
+#define REPLAY_TIMER_SHIFT         6   // Replay frame timer ticks every 64 cycles
+#define REPLAY_KEY_WAITED     0x8000   // Spare key bit: held input waited on AI work that frame
+
+// Map encoding and save defines
+#define MAP_PLANE_BYTES         ((MAP_WIDTH_TILES * MAP_HEIGHT_TILES + 7) / 8)   // One bit per tile
+#define MAP_PLANE_MAX_RUN        255   // Tiles one run byte can count
+#define MAP_FLOOR_MAX_EXCEPTIONS 256   // Tiles other than wall or their floor variant
+#define MAP_FLOOR_MAX_BYTES     (4 + (1 + MAP_PLANE_BYTES) * 2 + 2 + 3 * MAP_FLOOR_MAX_EXCEPTIONS)
+#define SAVE_MAGIC            "RGLK"   // Marks a complete save; its first byte is written last
+#define SAVE_FORMAT_VERSION        3   // 3: floor cache records lead with their type
+#define SAVE_BUFFER_SIZE (12 * 1024)   // Largest encoded save
+#define SAVE_CHUNK_BYTES         512   // SRAM bytes written per frame while saving
+#define SAVE_ENTITY_BYTES          9   // Bytes per entity record
+
+// Floor cache defines
+#define FLOOR_CACHE_SIZE  (4 * 1024)   // Bytes of encoded floors kept before the oldest is evicted
+#define FLOOR_CACHE_MAX_FLOORS    64   // Floors kept however small they are
+#define FLOOR_MAX_DEPTH          255   // Depths must fit in a byte
+#define FLOOR_MAX_EDITS           64   // Changed tiles listed per floor before it is stored whole
+#define FLOOR_RECORD_MAX_BYTES  (1 + MAP_FLOOR_MAX_BYTES + 1 + NUM_MAX_LIGHT_SOURCES * 2)  // Whole floor plus torches
+
+// Entity field-of-vision defines
+#define ENTITY_FOV_WIDTH  (SIGHT_RANGE_MAX * 2 + 1)      // Width of window around entity
+#define ENTITY_FOV_WORDS  ((ENTITY_FOV_WIDTH * ENTITY_FOV_WIDTH + 31) / 32)
+#define ENTITY_FOV_FAR_DISTANCE   16   // Awake entities beyond this update less often
+#define ENTITY_FOV_SLEEP_INTERVAL  4   // Batches between updates of sleeping/far entities
+#define OCCLUDER_WORDS_PER_ROW ((MAP_WIDTH_TILES + 31) / 32)
+#define FOV_CACHE_SIZE     4           // Recent player FOV results kept for revisits
+
+// Light source defines
+#define NUM_MAX_LIGHT_SOURCES   32
+#define NUM_START_TORCHES       12
+#define LIGHT_RADIUS_MAX         4
+#define LIGHT_WINDOW_WIDTH      (LIGHT_RADIUS_MAX * 2 + 1)
+#define LIGHT_UPDATES_PER_TURN   6     // Dirty sources recomputed per turn
+#define LIGHT_LEVEL_BRIGHT       8     // Out-of-sight tiles at or above get the lighter tint
+#define TORCH_RADIUS             3
+#define TORCH_INTENSITY         16
+#define PLAYER_LIGHT_RADIUS      2
+#define PLAYER_LIGHT_INTENSITY  16
+
+// Flow field defines
+#define FLOW_DISTANCE_UNREACHABLE 0xFFFF
+#define FLOW_QUEUE_SIZE    (MAP_WIDTH_TILES * MAP_HEIGHT_TILES)  // A tile is queued at most once at a time
+#define FLOW_BITSET_WORDS  ((MAP_WIDTH_TILES * MAP_HEIGHT_TILES + 31) / 32)
+
+// Pathfinding defines
+#define PATH_NODE_NULL            0xFFFF
+#define PATH_COST_UNKNOWN         0xFFFF
+#define PATH_BUCKET_COUNT         8     // Open f-costs never spread wider with a consistent heuristic
+#define PATH_EXPANSIONS_PER_FRAME 128   // Search work done per frame before resuming next frame
+
+// Noise and scent defines
+#define SENSE_MAX_ACTIVE_TILES  512    // Tiles one field can hold above zero at once
+#define NOISE_RADIUS_MAX          8    // Loudest noise, in tiles travelled
+#define NOISE_WINDOW_WIDTH      (NOISE_RADIUS_MAX * 2 + 1)
+#define NOISE_WINDOW_WORDS      ((NOISE_WINDOW_WIDTH * NOISE_WINDOW_WIDTH + 31) / 32)
+#define NOISE_LOUDNESS_WALK       3
+#define NOISE_LOUDNESS_ATTACK     6
+#define NOISE_LOUDNESS_EARTH_BEND 8
+#define NOISE_DECAY               2    // Strength lost per player turn
+#define SCENT_STRENGTH           24    // Left on each tile the player walks onto
+#define SCENT_DECAY               1
+
+// Hot kernels are marked IWRAM_ARM_CODE to run from IWRAM as 32-bit ARM
+// code instead of from ROM as Thumb, and the tables they read every
+// step are IWRAM_TABLE, which drops const so they land in IWRAM with
+// the rest of .data. Build with IWRAM_KERNELS=0 to keep both in ROM
+// for comparison. `make sections` reports what each memory holds.
+#ifdef IWRAM_KERNELS
+    #define IWRAM_ARM_CODE __attribute__((section(".iwram"), long_call, target("arm")))
+    #define IWRAM_TABLE
+#else
+    #define IWRAM_ARM_CODE
+    #define IWRAM_TABLE const
+#endif
+
+// Cycle count of a single frame (228 scanlines * 1232 cycles)
+#define CYCLES_PER_FRAME 280896
+#define CYCLES_PER_SCANLINE 1232
+#define SCANLINES_PER_FRAME 228
+#define CPU_CYCLES_PER_SECOND 16777216
 
 enum state
 {
@@ -86,7 +227,8 @@ enum
     ID_FLOOR_CHIP,                      // Just for visual variation
     ID_WALL,
     ID_WALL_FRONT,                      // Just for visual variation
-    ID_STAIRS
+    ID_STAIRS,
+    ID_STAIRS_UP                        // Drawn as ID_STAIRS mirrored
 };
 
 enum
@@ -132,13 +274,119 @@ enum
     SIGHT_RANGE_MAX = 4
 };
 
+enum fovAlgorithm
+{
+    FOV_PERIMETER_BRESENHAM = 0,
+    FOV_SHADOWCASTING,
+    FOV_PERMISSIVE,
+    FOV_SYMMETRIC,
+    NUM_FOV_ALGORITHMS
+};
+
+// Algorithm used by doFOV until changed from the pause menu
+#ifndef DEFAULT_FOV_ALGORITHM
+    #define DEFAULT_FOV_ALGORITHM FOV_PERIMETER_BRESENHAM
+#endif
+
+enum pathStatus
+{
+    PATH_IDLE = 0,
+    PATH_SEARCHING,
+    PATH_FOUND,
+    PATH_NOT_FOUND
+};
+
+enum commandType
+{
+    COMMAND_MOVE = 0,                   // value: direction
+    COMMAND_SET_TERRAIN,                // value: terrainId
+    COMMAND_ATTACK,                     // value: direction
+    COMMAND_WAIT
+};
+
+enum flowGoal
+{
+    FLOW_GOAL_PLAYER = 0,
+    FLOW_GOAL_STAIRS,
+    NUM_FLOW_GOALS
+};
+
+enum logCategory
+{
+    LOG_GENERAL = 0,
+    LOG_ENTITY,
+    LOG_PLAYER,
+    LOG_MAP_GEN,
+    LOG_GRAPHICS,
+    LOG_FOV,
+    NUM_LOG_CATEGORIES
+};
+
+enum perfField
+{
+    PERF_FRAME_CYCLES = 0,              // Worst frame of the last sample
+    PERF_CPU_PERCENT,                   // Share of the frames spent before waiting for VBlank
+    PERF_FOV_CYCLES,                    // Last turn's player and entity FOV
+    PERF_REDRAW_CYCLES,                 // Last turn's map redraw
+    PERF_VRAM_BYTES,                    // Worst frame of the last sample
+    PERF_ENTITY_COUNT,
+    NUM_PERF_FIELDS
+};
+
+enum pauseMenuField
+{
+    PAUSE_MENU_SEED = 0,
+    PAUSE_MENU_POSITION,
+    PAUSE_MENU_SIGHT_ID,
+    PAUSE_MENU_SIGHT_RANGE,
+    PAUSE_MENU_BLENDING,
+    PAUSE_MENU_COLLISION,
+    PAUSE_MENU_MAP_VISIBLE,
+    PAUSE_MENU_FOV,
+    PAUSE_MENU_SAVE,
+    NUM_PAUSE_MENU_FIELDS
+};
+
+enum mapLayer
+{
+    MAP_LAYER_TERRAIN = 0,
+    MAP_LAYER_SIGHT,                    // Raw sightIds, ~ above 9
+    MAP_LAYER_ENTITIES,                 // e asleep, E awake, over the terrain
+    MAP_LAYER_PLAYER_DISTANCE,          // Flow field steps in base 36, + beyond
+    MAP_LAYER_STAIRS_DISTANCE,
+    MAP_LAYER_DIRTY,                    // * on tiles in the change set, over the terrain
+    NUM_MAP_LAYERS
+};
+
+enum floorRecordType
+{
+    FLOOR_RECORD_DELTA = 0,                // Changes since generation and the explored plane
+    FLOOR_RECORD_FULL                      // The whole floor and its torches
+};
+
+enum arenaId
+{
+    ARENA_FLOOR = 0,
+    ARENA_SCRATCH,
+    NUM_ARENAS
+};
+
+enum senseType
+{
+    SENSE_NOISE = 0,
+    SENSE_SCENT,
+    NUM_SENSES
+};
+
 enum entityAction
 {   NO_ACTION = 0,
     WALKED_LEFT,
     WALKED_RIGHT,
     WALKED_UP,
     WALKED_DOWN,
-    EARTH_BEND
+    EARTH_BEND,
+    ATTACK,
+    WAITED
 };
 
 #endif // CONSTANTS_H
@@ -1,7 +1,11 @@
 #ifndef DEBUG_H
 #define DEBUG_H
 
-#define DEBUG
+// Release builds (make RELEASE=1) leave every debug switch off
+#ifndef RELEASE
+    #define DEBUG
+#endif
+
 #ifdef DEBUG
     #define DEBUG_ENTITY
         #ifdef DEBUG_ENTITY
@@ -24,12 +28,56 @@
         #ifdef DEBUG_FOV
             //#define DEBUG_LOS
         #endif
+
+    //#define DEBUG_BENCHMARK
+#endif
+
+// The most detailed level each log category is compiled in at. Lines
+// above it compile to nothing, so a category whose switch is off only
+// keeps its warnings and errors, and a release build keeps none.
+#ifdef DEBUG
+    #define LOG_GENERAL_LEVEL   MGBA_LOG_DEBUG
+    #define LOG_QUIET_LEVEL     MGBA_LOG_WARN
+#else
+    #define LOG_GENERAL_LEVEL   -1
+    #define LOG_QUIET_LEVEL     -1
+#endif
+
+#ifdef DEBUG_ENTITY
+    #define LOG_ENTITY_LEVEL    MGBA_LOG_DEBUG
+#else
+    #define LOG_ENTITY_LEVEL    LOG_QUIET_LEVEL
+#endif
+
+#ifdef DEBUG_PLAYER
+    #define LOG_PLAYER_LEVEL    MGBA_LOG_DEBUG
+#else
+    #define LOG_PLAYER_LEVEL    LOG_QUIET_LEVEL
+#endif
+
+#ifdef DEBUG_MAP_GEN
+    #define LOG_MAP_GEN_LEVEL   MGBA_LOG_DEBUG
+#else
+    #define LOG_MAP_GEN_LEVEL   LOG_QUIET_LEVEL
+#endif
+
+#ifdef DEBUG_GRAPHICS
+    #define LOG_GRAPHICS_LEVEL  MGBA_LOG_DEBUG
+#else
+    #define LOG_GRAPHICS_LEVEL  LOG_QUIET_LEVEL
+#endif
+
+#ifdef DEBUG_FOV
+    #define LOG_FOV_LEVEL       MGBA_LOG_DEBUG
+#else
+    #define LOG_FOV_LEVEL       LOG_QUIET_LEVEL
 #endif
 
 //------------------------------------------------------------------
 // Function Prototypes
 //------------------------------------------------------------------
-extern void printMapInLog();
-extern void printTileSightInLog();
+extern char* formatMapRow(enum mapLayer const layer, int const y, char *row);
+extern void printMapLayersInLog(u32 const layerMask);
+extern void runBenchmarks();
 
 #endif
@@ -4,31 +4,78 @@
 //------------------------------------------------------------------
 // Data Structures
 //------------------------------------------------------------------
-struct Entity
+// Handles stay valid only while the entity they were made for is alive:
+// the high byte holds the slot's generation, the low byte its index.
+typedef uint16_t EntityHandle;
+
+// Entities are stored as parallel arrays indexed by slot so sweeps
+// over one field touch only that field's memory.
+struct EntityPool
 {
-    uint8_t posX, posY;
-    uint8_t sightRange;
-    enum direction facing;
-    enum entityAction lastAction;
+    uint8_t posX[NUM_MAX_ENTITIES], posY[NUM_MAX_ENTITIES];
+    uint8_t facing[NUM_MAX_ENTITIES];               // enum direction
+    uint8_t sightRange[NUM_MAX_ENTITIES];
+    uint8_t lastAction[NUM_MAX_ENTITIES];           // enum entityAction
+    uint8_t isAwake[NUM_MAX_ENTITIES];
+    uint8_t speed[NUM_MAX_ENTITIES];                // Actions per TURN_TIME * ENTITY_SPEED_NORMAL ticks
+    u32 nextActTime[NUM_MAX_ENTITIES];              // Scheduler tick of the entity's next turn
+    uint8_t sector[NUM_MAX_ENTITIES];               // getMapSector of the entity's tile
+    uint8_t isDormant[NUM_MAX_ENTITIES];            // Outside the active sectors and off the turn heap
+    uint8_t pendingCatchUp[NUM_MAX_ENTITIES];       // Missed turns to make up for at the next turn
+
+    uint8_t generation[NUM_MAX_ENTITIES];           // 0 while the slot is free
+    uint8_t activeSlot[NUM_MAX_ENTITIES];           // Position in activeList
+    uint8_t activeList[NUM_MAX_ENTITIES];           // Dense list of live slots
+    uint8_t freeList[NUM_MAX_ENTITIES];             // Stack of free slots
+    uint8_t turnHeap[NUM_MAX_ENTITIES];             // Min-heap of slots by nextActTime
+    uint8_t heapSlot[NUM_MAX_ENTITIES];             // Position in turnHeap
+    uint16_t nextInSector[NUM_MAX_ENTITIES];        // Links of the per-sector entity lists
+    uint16_t prevInSector[NUM_MAX_ENTITIES];
+    uint16_t sectorHead[NUM_MAP_SECTORS];           // First entity in each sector
+    uint8_t isSectorActive[NUM_MAP_SECTORS];        // Near enough the player to simulate
+    int activeCount, freeCount, turnHeapCount;
 };
-extern struct Entity entity[NUM_MAX_ENTITIES];
+
+extern struct EntityPool entityPool;
 
 //------------------------------------------------------------------
 // Function Prototypes
 //------------------------------------------------------------------
-extern void initEntities();
-extern struct Entity* getEntity(const int entityIndex);
-extern void setEntityPos(struct Entity *entity, const int positionX, const int positionY);
-extern int getEntitySightRange(const struct Entity *entity);
-extern void setEntitySightRange(struct Entity *entity, const int sightRange);
-extern int getEntityFacing(const struct Entity *entity);
-extern void setEntityFacing(struct Entity *entity, const enum direction direction);
-extern int getEntityLastAction(struct Entity *entity);
-extern void setEntityLastAction(struct Entity *entity, const enum entityAction action);
+extern void initEntities(int const playerX, int const playerY);
+extern void clearEntities();
+extern EntityHandle spawnEntity(int const positionX, int const positionY);
+extern void despawnEntity(EntityHandle const handle);
+extern boolean isEntityHandleValid(EntityHandle const handle);
+extern int getEntityIndex(EntityHandle const handle);
+extern EntityHandle getEntityHandle(int const entityIndex);
+extern int getEntityCount();
+extern EntityHandle getEntityAtTile(int const positionX, int const positionY);
+extern boolean isTileOccupied(int const positionX, int const positionY);
+extern boolean checkOccupancyConsistency();
+extern void updateActiveSectors();
+extern boolean isEntityDormant(int const entityIndex);
+extern void printActivityStats();
+extern void resetActivityStats();
+extern int getEntityPosX(int const entityIndex);
+extern int getEntityPosY(int const entityIndex);
+extern void setEntityPos(int const entityIndex, int const positionX, int const positionY);
+extern int getEntitySightRange(int const entityIndex);
+extern void setEntitySightRange(int const entityIndex, int const sightRange);
+extern int getEntityFacing(int const entityIndex);
+extern int getEntitySpeed(int const entityIndex);
+extern void setEntitySpeed(int const entityIndex, int const speed);
+extern void setEntityFacing(int const entityIndex, enum direction const direction);
+extern int getEntityLastAction(int const entityIndex);
+extern void setEntityLastAction(int const entityIndex, enum entityAction const action);
 extern void doPlayerInput();
+extern boolean isPlayerAutoTravelActive();
+extern void doMonsterTurn(int const entityIndex);
+extern void benchmarkEntityTurns();
 
 // Entity Actions
-extern boolean entityWalk(struct Entity *entity, const enum direction direction);
-extern boolean entityEarthBend(struct Entity *entity);
+extern boolean entityWalk(int const entityIndex, enum direction const direction);
+extern boolean entityEarthBend(int const entityIndex);
+extern boolean entityAttack(int const entityIndex, enum direction const direction);
+extern void entityWait(int const entityIndex);
 
 #endif
@@ -1,11 +1,33 @@
 #ifndef FOV_H
 #define FOV_H
 
+//------------------------------------------------------------------
+// Data Structures
+//------------------------------------------------------------------
+struct EntityFOV
+{
+    uint8_t originX, originY;
+    uint8_t sightRange;
+    u32 visibleTiles[ENTITY_FOV_WORDS];    // Bitset of window centered on origin
+};
+
 //------------------------------------------------------------------
 // Function Prototypes
 //------------------------------------------------------------------
 extern void initFOV();
 extern void doFOV(int const positionX, int const positionY, int const sightRange);
 extern boolean checkLOS(int startX, int startY, int const endX, int const endY);
+extern boolean isLineClear(int const startX, int const startY, int const endX, int const endY);
+extern void updateOccluder(int const positionX, int const positionY);
+extern void doEntityFOVs();
+extern boolean canEntitySee(int const entityIndex, int const positionX, int const positionY);
+extern void benchmarkEntityFOVs();
+extern char const* getFOVAlgorithmName(enum fovAlgorithm const algorithm);
+extern void compareFOVAlgorithms();
+extern void benchmarkFOVKernels();
+extern void saveFOVState();
+extern void restoreFOVState();
+extern void printFOVCacheStats();
+extern void resetFOVCacheStats();
 
 #endif // FOV_H
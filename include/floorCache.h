@@ -0,0 +1,31 @@
+#ifndef FLOOR_CACHE_H
+#define FLOOR_CACHE_H
+
+//------------------------------------------------------------------
+// Data Structures
+//------------------------------------------------------------------
+// A floor the player left, encoded in the cache pool
+struct CachedFloor
+{
+    uint8_t depth;
+    u16 offset, size;                      // Bytes in the cache pool
+    u32 lastVisit;                         // Floor change it was left on; the lowest is evicted first
+};
+
+//------------------------------------------------------------------
+// Function Prototypes
+//------------------------------------------------------------------
+extern void startFloors(u32 const seed);
+extern boolean changeFloor(int const step);
+extern int getCurrentDepth();
+extern void resumeFloors(u32 const seed, int const depth);
+extern void noteFloorEdit(int const positionX, int const positionY);
+extern int saveFloorCache(uint8_t *buffer, int const capacity);
+extern boolean loadFloorCache(uint8_t const *buffer, int const size);
+extern void printFloorCacheStats();
+extern void resetFloorCacheStats();
+#ifdef DEBUG_BENCHMARK
+    extern void benchmarkFloorStore();
+#endif
+
+#endif // FLOOR_CACHE_H
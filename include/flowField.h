@@ -0,0 +1,24 @@
+#ifndef FLOW_FIELD_H
+#define FLOW_FIELD_H
+
+//------------------------------------------------------------------
+// Data Structures
+//------------------------------------------------------------------
+struct FlowField
+{
+    uint8_t goalX, goalY;
+    boolean isValid;
+    uint16_t distance[MAP_HEIGHT_TILES][MAP_WIDTH_TILES];   // Steps to goal over walkable tiles
+};
+
+//------------------------------------------------------------------
+// Function Prototypes
+//------------------------------------------------------------------
+extern void initFlowFields();
+extern void setFlowGoal(enum flowGoal const goal, int const positionX, int const positionY);
+extern void repairFlowFields(int const positionX, int const positionY);
+extern uint16_t getFlowDistance(enum flowGoal const goal, int const positionX, int const positionY);
+extern enum direction getFlowDirection(enum flowGoal const goal, int const positionX, int const positionY);
+extern void benchmarkFlowFields();
+
+#endif // FLOW_FIELD_H
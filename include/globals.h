@@ -4,6 +4,10 @@
 //------------------------------------------------------------------
 // Function Prototypes
 //------------------------------------------------------------------
+void seedRandom(u32 const seed);
+u32 getRandomState();
+void setRandomState(u32 const state);
+u32 nextRandom();
 u32 randomInRange(int minimumValue, int maximumValue);
 int8_t approachValue(int8_t currentValue, int8_t const targetValue, int8_t const increment);
 boolean isNumberEven(int value);
@@ -14,13 +18,14 @@ boolean isNumberEven(int value);
 extern unsigned int frameCount;
 extern unsigned int randomSeed;
 extern enum state gameState;
-extern int turnOfEntityIndex;
+extern boolean playerHasActed;     // Set when the player spends a turn
 extern uint8_t playerSightId;      // Value visible tiles are set to
-extern int8_t const dirX[9];            // Horizontal movement array
-extern int8_t const dirY[9];              // Vertical movement array
+extern int8_t IWRAM_TABLE dirX[9];      // Horizontal movement array
+extern int8_t IWRAM_TABLE dirY[9];        // Vertical movement array
 extern int16_t screenOffsetX, screenOffsetY;     // BG origin offset
 extern int8_t playerMoveOffsetX, playerMoveOffsetY;
 extern boolean debugCollisionIsOff, debugMapIsVisible;
 extern u32 blendingValue;
+extern enum fovAlgorithm fovAlgorithm;
 
 #endif // GLOBALS_H
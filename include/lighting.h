@@ -0,0 +1,52 @@
+#ifndef LIGHTING_H
+#define LIGHTING_H
+
+//------------------------------------------------------------------
+// Data Structures
+//------------------------------------------------------------------
+struct LightSource
+{
+    uint8_t posX, posY;
+    uint8_t radius;
+    uint8_t intensity;
+    boolean isActive, isDirty;
+    boolean isApplied;                     // contribution is in lightMap
+    uint8_t appliedX, appliedY;            // origin the contribution was applied at
+    uint8_t contribution[LIGHT_WINDOW_WIDTH * LIGHT_WINDOW_WIDTH];
+};
+
+extern uint16_t lightMap[MAP_HEIGHT_TILES][MAP_WIDTH_TILES];   // Summed intensity of every light
+
+//------------------------------------------------------------------
+// Function Prototypes
+//------------------------------------------------------------------
+extern void initLighting();
+extern int getTorchPositions(uint8_t *positionX, uint8_t *positionY);
+extern void loadLighting(uint8_t const *positionX, uint8_t const *positionY, int const torchCount);
+extern int addLightSource(int const positionX, int const positionY, int const radius, int const intensity);
+extern void removeLightSource(int const lightIndex);
+extern void moveLightSource(int const lightIndex, int const positionX, int const positionY);
+extern void movePlayerLight(int const positionX, int const positionY);
+extern void markLightTerrainChanged(int const positionX, int const positionY);
+extern void updateLighting();
+extern void benchmarkLighting();
+
+//------------------------------------------------------------------
+// Inline Functions
+//------------------------------------------------------------------
+
+//------------------------------------------------------------------
+// Function: getTileLight
+// 
+// Returns the summed light intensity at the given position. Inlined
+// into drawFOV, which reads it for every tile on screen.
+//------------------------------------------------------------------
+static inline uint16_t getTileLight(int const positionX, int const positionY)
+{
+    if ((unsigned)positionX >= MAP_WIDTH_TILES || (unsigned)positionY >= MAP_HEIGHT_TILES)
+        return 0;
+
+    return lightMap[positionY][positionX];
+}
+
+#endif // LIGHTING_H
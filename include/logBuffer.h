@@ -0,0 +1,49 @@
+#ifndef LOG_BUFFER_H
+#define LOG_BUFFER_H
+
+//------------------------------------------------------------------
+// Data Structures
+//------------------------------------------------------------------
+// A log line waiting to be formatted. The format string is its id, so
+// it must be a literal, and the arguments must be integers or
+// pointers to data that outlives the drain.
+struct LogEvent
+{
+    char const *format;
+    u32 arg[LOG_EVENT_MAX_ARGS];
+    uint8_t level;                         // MGBA_LOG_*
+};
+
+// Records a log line for later, with up to LOG_EVENT_MAX_ARGS
+// arguments, instead of formatting it in the caller's time
+#define logDeferred(level, ...) logDeferredArgs((level), __VA_ARGS__, 0, 0, 0, 0)
+#define logDeferredArgs(level, format, a, b, c, d, ...) \
+    pushLogEvent((level), (format), (u32)(a), (u32)(b), (u32)(c), (u32)(d))
+
+// Logs a line now, or records it for later with logEvent, if its
+// category is compiled in at that level (see debug.h) and enabled in
+// logCategoryMask. A line that isn't compiled in costs nothing, not
+// even its format string.
+#define logMessage(category, level, ...) \
+    do { if ((level) <= category##_LEVEL && isLogCategoryEnabled(category)) \
+        mgba_printf((level), __VA_ARGS__); } while (0)
+#define logEvent(category, level, ...) \
+    do { if ((level) <= category##_LEVEL && isLogCategoryEnabled(category)) \
+        logDeferred((level), __VA_ARGS__); } while (0)
+#define isLogCategoryEnabled(category) ((logCategoryMask >> (category)) & 1)
+
+//------------------------------------------------------------------
+// Global Variables
+//------------------------------------------------------------------
+extern u32 logCategoryMask;                // One bit per enum logCategory
+
+//------------------------------------------------------------------
+// Function Prototypes
+//------------------------------------------------------------------
+extern void pushLogEvent(int const level, char const *format, u32 const arg0, u32 const arg1, u32 const arg2, u32 const arg3);
+extern int drainLog();
+extern void flushLog();
+extern void setLogCategoryEnabled(enum logCategory const category, boolean const isEnabled);
+extern void printLogStats();
+
+#endif // LOG_BUFFER_H
@@ -0,0 +1,12 @@
+#ifndef MAP_CODEC_H
+#define MAP_CODEC_H
+
+//------------------------------------------------------------------
+// Function Prototypes
+//------------------------------------------------------------------
+extern int encodeExplored(uint8_t *buffer, int const capacity);
+extern int decodeExplored(uint8_t const *buffer, int const size);
+extern int encodeFloor(uint8_t *buffer, int const capacity);
+extern int decodeFloor(uint8_t const *buffer, int const size);
+
+#endif // MAP_CODEC_H
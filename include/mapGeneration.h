@@ -15,5 +15,12 @@ struct Node
 // Function Prototypes
 //------------------------------------------------------------------
 extern void generateGameMap();
+extern void getStairsPosition(int *positionX, int *positionY);
+extern void setStairsPosition(int const positionX, int const positionY);
+extern void getUpStairsPosition(int *positionX, int *positionY);
+extern void setUpStairsPosition(int const positionX, int const positionY);
+extern uint8_t getFloorVariant(int const positionX, int const positionY);
+extern u32 getFloorVariantSeed();
+extern void setFloorVariantSeed(u32 const seed);
 
 #endif
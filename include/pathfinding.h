@@ -0,0 +1,38 @@
+#ifndef PATHFINDING_H
+#define PATHFINDING_H
+
+//------------------------------------------------------------------
+// Data Structures
+//------------------------------------------------------------------
+struct PathNode
+{
+    uint16_t generation;                   // Node is stale unless this matches the search
+    uint16_t costSoFar;
+    uint16_t parent;                       // Tile index one step closer to the goal
+    uint16_t prevInBucket, nextInBucket;
+    boolean isClosed;
+};
+
+struct PathSearch
+{
+    uint16_t generation;
+    uint8_t goalX, goalY;
+    uint8_t startX, startY;
+    int lowestCost;                        // f-cost of the bucket being drained
+    int openCount;
+    int expansions;
+    enum pathStatus status;
+};
+
+//------------------------------------------------------------------
+// Function Prototypes
+//------------------------------------------------------------------
+extern void startPathSearch(int const startX, int const startY, int const goalX, int const goalY);
+extern enum pathStatus continuePathSearch(int const maxExpansions);
+extern enum pathStatus getPathStatus();
+extern int getPathExpansions();
+extern int getPathLength();
+extern enum direction getPathDirection(int const positionX, int const positionY);
+extern void benchmarkPathfinding();
+
+#endif // PATHFINDING_H
@@ -6,6 +6,7 @@
 //------------------------------------------------------------------
 extern boolean doPauseMenuInput();
 extern void drawPauseMenu();
+extern void updatePauseMenu();
 extern void doStateTransition(enum state const targetState);
 
 #endif // PAUSEMENU_H
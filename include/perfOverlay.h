@@ -0,0 +1,33 @@
+#ifndef PERF_OVERLAY_H
+#define PERF_OVERLAY_H
+
+//------------------------------------------------------------------
+// Data Structures
+//------------------------------------------------------------------
+// One labelled number on the overlay. The value is drawn right-aligned
+// in a slot of width characters after the label and a space.
+struct PerfField
+{
+    char const *label;
+    uint8_t column, row;                   // Of the label, in characters from the overlay's top left
+    uint8_t width;
+};
+
+//------------------------------------------------------------------
+// Global Variables
+//------------------------------------------------------------------
+extern u32 vramWriteCount;                 // Screen entry and OAM bytes written this frame
+
+//------------------------------------------------------------------
+// Function Prototypes
+//------------------------------------------------------------------
+extern void initPerfOverlay();
+extern u32 getScanlineClock();
+extern u32 getScanlinesSince(u32 const startClock);
+extern void startPerfFrame();
+extern void endPerfFrame();
+extern void setPerfValue(enum perfField const field, u32 const value);
+extern void togglePerfOverlay();
+extern void redrawPerfOverlay();
+
+#endif // PERF_OVERLAY_H
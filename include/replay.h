@@ -0,0 +1,43 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+//------------------------------------------------------------------
+// Data Structures
+//------------------------------------------------------------------
+// A run of consecutive frames polled with the same keys held
+struct KeyRun
+{
+    u16 keys;                              // __key_curr for every frame of the run, plus REPLAY_KEY_WAITED
+    u16 frameCount;
+};
+
+// Everything needed to play a game again: the seed, the settings the
+// game started with, and the key state of every frame as runs
+struct Recording
+{
+    u32 seed;
+    u16 startKeys;                         // Keys held on the title screen frame
+    uint8_t fovAlgorithm;
+    uint8_t playerSightId;
+    boolean debugCollisionIsOff, debugMapIsVisible;
+    u32 blendingValue;
+    int runCount;
+    u32 frameCount;
+    boolean isTruncated;                   // Ran out of runs before the game ended
+    struct KeyRun runs[REPLAY_MAX_RUNS];
+};
+
+//------------------------------------------------------------------
+// Function Prototypes
+//------------------------------------------------------------------
+extern void pollInput();
+extern void startRecording(u32 const seed);
+extern void stopRecording();
+extern boolean startReplay();
+extern void finishReplay();
+extern boolean isReplaying();
+extern u32 getReplaySeed();
+extern void noteReplayTurn();
+extern boolean resolveHeldTurn(boolean const isTurnReady);
+
+#endif // REPLAY_H
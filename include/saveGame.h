@@ -0,0 +1,27 @@
+#ifndef SAVE_GAME_H
+#define SAVE_GAME_H
+
+//------------------------------------------------------------------
+// Data Structures
+//------------------------------------------------------------------
+// Stored at the start of SRAM, ahead of the encoded game. It is
+// written after everything else, so a save cut short fails the magic
+// or checksum test instead of loading half a floor.
+struct SaveHeader
+{
+    char magic[4];                         // SAVE_MAGIC once the save is complete
+    u16 version;                           // SAVE_FORMAT_VERSION
+    u16 payloadSize;                       // Encoded game bytes following the header
+    u32 checksum;                          // Adler-32 of the encoded game
+};
+
+//------------------------------------------------------------------
+// Function Prototypes
+//------------------------------------------------------------------
+extern boolean startSave();
+extern void updateSave();
+extern boolean isSaving();
+extern boolean loadGame();
+extern int getLastSaveSize();
+
+#endif // SAVE_GAME_H
@@ -0,0 +1,20 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+//------------------------------------------------------------------
+// Function Prototypes
+//------------------------------------------------------------------
+extern void resetScheduler();
+extern u32 getSchedulerTime();
+extern void scheduleEntity(int const entityIndex, u32 const delay);
+extern void unscheduleEntity(int const entityIndex);
+extern int resumeEntity(int const entityIndex);
+extern void endEntityTurn(int const entityIndex);
+extern boolean isPlayerTurn();
+extern int processEntityTurns(u32 const cycleBudget);
+extern void flushEntityTurns();
+extern void printSchedulerStats();
+extern void resetSchedulerStats();
+extern void benchmarkScheduler();
+
+#endif // SCHEDULER_H
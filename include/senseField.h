@@ -0,0 +1,28 @@
+#ifndef SENSE_FIELD_H
+#define SENSE_FIELD_H
+
+//------------------------------------------------------------------
+// Data Structures
+//------------------------------------------------------------------
+// A decaying strength per tile. Every tile above zero is listed in
+// activeTile exactly once, so decay only visits those.
+struct SenseField
+{
+    uint8_t strength[MAP_HEIGHT_TILES][MAP_WIDTH_TILES];
+    uint16_t activeTile[SENSE_MAX_ACTIVE_TILES];       // Tile indices
+    int activeCount;
+    uint8_t decay;                                     // Strength lost per player turn
+};
+
+//------------------------------------------------------------------
+// Function Prototypes
+//------------------------------------------------------------------
+extern void initSenseFields();
+extern void emitNoise(int const positionX, int const positionY, int const loudness);
+extern void leaveScent(int const positionX, int const positionY);
+extern void decaySenseFields();
+extern uint8_t getSenseStrength(enum senseType const sense, int const positionX, int const positionY);
+extern enum direction getSenseDirection(enum senseType const sense, int const positionX, int const positionY);
+extern void benchmarkSenseFields();
+
+#endif // SENSE_FIELD_H
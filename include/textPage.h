@@ -0,0 +1,35 @@
+#ifndef TEXT_PAGE_H
+#define TEXT_PAGE_H
+
+//------------------------------------------------------------------
+// Data Structures
+//------------------------------------------------------------------
+// A label drawn once when its page is laid out, and the slot after it
+// that its value is drawn into. A field with a slotWidth of 0 is just
+// a label.
+struct TextField
+{
+    char const *label;
+    uint8_t row;                           // Line of the page, in the font's height
+    uint8_t labelX, slotX, slotWidth;      // In pixels
+};
+
+// A screen of text fields sharing the text engine, such as the pause
+// menu. Remembers what each slot shows so unchanged values aren't
+// drawn again.
+struct TextPage
+{
+    struct TextField const *fields;
+    int fieldCount;
+    char shownText[TEXT_PAGE_MAX_FIELDS][TEXT_FIELD_MAX_CHARS];
+};
+
+//------------------------------------------------------------------
+// Function Prototypes
+//------------------------------------------------------------------
+extern char* formatInt(char *buffer, int const value);
+extern void drawTextPage(struct TextPage *page);
+extern void setTextField(struct TextPage *page, int const field, char const *text);
+extern void setTextFieldInt(struct TextPage *page, int const field, int const value);
+
+#endif // TEXT_PAGE_H
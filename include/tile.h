@@ -10,6 +10,15 @@ struct Tile
     uint8_t terrainId;
     uint8_t sightId;
 };
+struct LineIterator
+{
+    int currentX, currentY;
+    int endX, endY;
+    int changeInX, changeInY;              // |dx| and -|dy|
+    int stepOfX, stepOfY;
+    int err;                               // Carried error term
+};
+
 extern struct Tile gameMap[MAP_HEIGHT_TILES][MAP_WIDTH_TILES];
 
 //------------------------------------------------------------------
@@ -17,19 +26,91 @@ extern struct Tile gameMap[MAP_HEIGHT_TILES][MAP_WIDTH_TILES];
 //------------------------------------------------------------------
 extern void initTilePosition(int const positionX, int const positionY);
 extern struct Tile* getTile(int const positionX, int const positionY);
-extern uint8_t getTileTerrain(int const positionX, int const positionY);
 extern void setTileTerrain(int const positionX, int const positionY, uint8_t const terrainId);
-extern uint8_t getTileSight(int const positionX, int const positionY);
-extern void setTileSight(int const positionX, int const positionY, uint8_t const sightId);
 extern enum direction getTileDirection(int const startX, int const startY, int const endX, int const endY);
-extern enum direction getTileDirInLine(int const startX, int const startY, int const endX, int const endY);
+extern void initLineIterator(struct LineIterator *line, int const startX, int const startY, int const endX, int const endY);
+IWRAM_ARM_CODE extern enum direction nextLineStep(struct LineIterator *line);
 
 extern void drawGameMap(int originTileX, int originTileY);
 extern void redrawGameMapEdge(enum entityAction playerWalkedDir);
 extern void updateGameMapSight();
 
-extern boolean isOutOfBounds(uint8_t const positionX, uint8_t const positionY);
-extern boolean isSolid(uint8_t const positionX, uint8_t const positionY);
 extern uint8_t getMapSector(int const positionX, int const positionY);
+extern u32 getTerrainVersion(int const positionX, int const positionY, int const range);
+extern boolean testLineIterator();
+extern void benchmarkLineIterator();
+extern void benchmarkTileKernels();
+
+//------------------------------------------------------------------
+// Inline Functions
+//------------------------------------------------------------------
+// One-line map accessors, defined here so they inline into callers in
+// ROM and in the IWRAM kernels alike instead of costing a long call.
+
+//------------------------------------------------------------------
+// Function: isOutOfBounds
+// 
+// Returns whether the tile at the given position is out of bounds
+// for the player or not.
+//------------------------------------------------------------------
+static inline boolean isOutOfBounds(uint8_t const positionX, uint8_t const positionY)
+{
+    if (positionX < 0 || positionX > MAP_WIDTH_TILES - 1
+    || positionY < 0 || positionY > MAP_HEIGHT_TILES - 1)
+        return TRUE;
+    else
+        return FALSE;
+}
+
+//------------------------------------------------------------------
+// Function: getTileTerrain
+// 
+// Returns the tile terrain at the given position.
+//------------------------------------------------------------------
+static inline uint8_t getTileTerrain(int const positionX, int const positionY)
+{
+    if (!isOutOfBounds(positionX, positionY))
+        return gameMap[positionY][positionX].terrainId;
+    else
+        return ID_TRANSPARENT;
+}
+
+//------------------------------------------------------------------
+// Function: getTileSight
+// 
+// Returns the sightId of the tile at the given position.
+//------------------------------------------------------------------
+static inline uint8_t getTileSight(int const positionX, int const positionY)
+{
+    if (!isOutOfBounds(positionX, positionY))
+        return gameMap[positionY][positionX].sightId;
+    else
+        return TILE_NEVER_SEEN;
+}
+
+//------------------------------------------------------------------
+// Function: setTileSight
+// 
+// Sets the sightId of the tile at the given position.
+//------------------------------------------------------------------
+static inline void setTileSight(int const positionX, int const positionY, uint8_t const sightId)
+{
+    if (!isOutOfBounds(positionX, positionY))
+        gameMap[positionY][positionX].sightId = sightId;
+}
+
+//------------------------------------------------------------------
+// Function: isSolid
+// 
+// Returns whether the tile at the given position is solid or not.
+// NOTE: Solid tiles should block player movement.
+//------------------------------------------------------------------
+static inline boolean isSolid(uint8_t const positionX, uint8_t const positionY)
+{
+    if(getTileTerrain(positionX, positionY) != ID_WALL)
+        return FALSE;
+    else
+        return TRUE;
+}
 
 #endif // TILE_H
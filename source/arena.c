@@ -0,0 +1,115 @@
+#include "../libtonc/include/tonc.h"
+#include "constants.h"
+#include "arena.h"
+#include "debug.h"
+#include "logBuffer.h"
+#include "mgba.h"
+
+//------------------------------------------------------------------
+// Data Structures
+//------------------------------------------------------------------
+static uint8_t floorArenaMemory[FLOOR_ARENA_SIZE] EWRAM_BSS ALIGN4;
+static uint8_t scratchArenaMemory[SCRATCH_ARENA_SIZE] EWRAM_BSS ALIGN4;
+
+// Indexed by enum arenaId
+static struct Arena arenas[NUM_ARENAS] =
+{
+    {"floor", floorArenaMemory, FLOOR_ARENA_SIZE, 0, 0, 0},
+    {"scratch", scratchArenaMemory, SCRATCH_ARENA_SIZE, 0, 0, 0}
+};
+
+//------------------------------------------------------------------
+// Function: allocFromArena
+//
+// Bumps the given arena by the given size, rounded up to
+// ARENA_ALIGNMENT, and returns the memory, which is not cleared.
+// There is no per-allocation free: memory comes back all at once when
+// the arena is reset or rolled back. Use arenaAlloc, which fills in
+// the call site. Running out is a bug, so in debug builds it logs the
+// call site and stops; otherwise NULL is returned.
+//------------------------------------------------------------------
+extern void* allocFromArena(enum arenaId const arena, u32 const size, char const *file, int const line)
+{
+    struct Arena *current = &arenas[arena];
+    u32 alignedSize = (size + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1);
+    void *allocation = NULL;
+
+    if (alignedSize > current->capacity - current->used)
+    {
+        #ifdef DEBUG
+            mgba_printf(MGBA_LOG_FATAL, "%s arena overflow: %d bytes requested at %s:%d, %d of %d used",
+                current->name, size, file, line, current->used, current->capacity);
+            while (1)
+                VBlankIntrWait();
+        #endif
+
+        return NULL;
+    }
+
+    allocation = current->base + current->used;
+    current->used += alignedSize;
+    current->highWater = MAX(current->highWater, current->used);
+    current->allocationCount++;
+
+    return allocation;
+}
+
+//------------------------------------------------------------------
+// Function: getArenaMark
+//
+// Returns the given arena's current fill, to be handed back to
+// restoreArenaMark.
+//------------------------------------------------------------------
+extern u32 getArenaMark(enum arenaId const arena)
+{
+    return arenas[arena].used;
+}
+
+//------------------------------------------------------------------
+// Function: restoreArenaMark
+//
+// Frees everything allocated from the given arena since the mark was
+// taken.
+//------------------------------------------------------------------
+extern void restoreArenaMark(enum arenaId const arena, u32 const mark)
+{
+    if (mark <= arenas[arena].used)
+        arenas[arena].used = mark;
+}
+
+//------------------------------------------------------------------
+// Function: releaseArena
+//
+// Frees the given allocation and everything allocated after it, for
+// callers that use an arena as a stack.
+//------------------------------------------------------------------
+extern void releaseArena(enum arenaId const arena, void const *allocation)
+{
+    restoreArenaMark(arena, (uint8_t const*)allocation - arenas[arena].base);
+}
+
+//------------------------------------------------------------------
+// Function: resetArena
+//
+// Frees everything in the given arena. The floor arena is reset when
+// a floor is left, the scratch arena every frame.
+//------------------------------------------------------------------
+extern void resetArena(enum arenaId const arena)
+{
+    arenas[arena].used = 0;
+}
+
+//------------------------------------------------------------------
+// Function: printArenaStats
+//
+// Logs each arena's current and peak use since start-up.
+//------------------------------------------------------------------
+extern void printArenaStats()
+{
+    for (int arena = 0; arena < NUM_ARENAS; arena++)
+    {
+        logMessage(LOG_GENERAL, MGBA_LOG_INFO, "arena %s: %d of %d bytes used, high water %d, %d allocations",
+            arenas[arena].name, arenas[arena].used, arenas[arena].capacity,
+            arenas[arena].highWater, arenas[arena].allocationCount);
+    }
+}
@@ -0,0 +1,222 @@
+#include <string.h>
+#include "../libtonc/include/tonc.h"
+#include "constants.h"
+#include "command.h"
+#include "debug.h"
+#include "entity.h"
+#include "floorCache.h"
+#include "flowField.h"
+#include "globals.h"
+#include "logBuffer.h"
+#include "mgba.h"
+#include "senseField.h"
+#include "tile.h"
+
+//------------------------------------------------------------------
+// Data Structures
+//------------------------------------------------------------------
+static struct Command commandBuffer[COMMAND_BUFFER_SIZE];
+static struct ChangeSet changeSet;
+
+//------------------------------------------------------------------
+// Global Variables
+//------------------------------------------------------------------
+static int commandCount = 0;
+
+// Statistics on commands and changed tiles per applied turn
+static int turnsApplied = 0, totalCommands = 0, mostCommandsInTurn = 0;
+static int totalChangedTiles = 0, mostChangedTilesInTurn = 0;
+
+//------------------------------------------------------------------
+// Function Prototypes
+//------------------------------------------------------------------
+static void applyCommand(struct Command const *command);
+static void markTileChanged(int const positionX, int const positionY);
+
+//------------------------------------------------------------------
+// Function: markTileChanged
+//
+// Adds the given tile to the change set, or flags the set as full.
+//------------------------------------------------------------------
+static void markTileChanged(int const positionX, int const positionY)
+{
+    if (changeSet.changedTileCount >= CHANGE_SET_MAX_TILES)
+    {
+        changeSet.isTileListFull = TRUE;
+        return;
+    }
+
+    changeSet.changedTileX[changeSet.changedTileCount] = positionX;
+    changeSet.changedTileY[changeSet.changedTileCount] = positionY;
+    changeSet.changedTileCount++;
+}
+
+//------------------------------------------------------------------
+// Function: applyCommand
+//
+// Carries out a single command on the map and entity pool and records
+// what it changed.
+//------------------------------------------------------------------
+static void applyCommand(struct Command const *command)
+{
+    int entityIndex = command->entityIndex;
+    int targetIndex = -1;
+
+    switch (command->type)
+    {
+    case COMMAND_MOVE:
+        setEntityFacing(entityIndex, command->value);
+        setEntityPos(entityIndex, command->posX, command->posY);
+        setEntityLastAction(entityIndex, WALKED_LEFT + command->value - DIR_LEFT);
+        markEntityChanged(entityIndex);
+
+        if (entityIndex == PLAYER_INDEX)
+        {
+            changeSet.playerMoveDirection = command->value;
+            leaveScent(command->posX, command->posY);
+            emitNoise(command->posX, command->posY, NOISE_LOUDNESS_WALK);
+        }
+        break;
+    case COMMAND_SET_TERRAIN:
+        setTileTerrain(command->posX, command->posY, command->value);
+        noteFloorEdit(command->posX, command->posY);
+        repairFlowFields(command->posX, command->posY);
+        setEntityLastAction(entityIndex, EARTH_BEND);
+        markTileChanged(command->posX, command->posY);
+
+        if (entityIndex == PLAYER_INDEX)
+            emitNoise(getEntityPosX(entityIndex), getEntityPosY(entityIndex), NOISE_LOUDNESS_EARTH_BEND);
+        break;
+    case COMMAND_ATTACK:
+        targetIndex = getEntityIndex(getEntityAtTile(command->posX, command->posY));
+        setEntityFacing(entityIndex, command->value);
+        setEntityLastAction(entityIndex, ATTACK);
+
+        if (entityIndex == PLAYER_INDEX)
+            emitNoise(getEntityPosX(entityIndex), getEntityPosY(entityIndex), NOISE_LOUDNESS_ATTACK);
+
+        // There is no damage model yet, so a hit only wakes the target
+        if (targetIndex >= 0)
+            entityPool.isAwake[targetIndex] = TRUE;
+        break;
+    case COMMAND_WAIT:
+        setEntityLastAction(entityIndex, WAITED);
+        break;
+    default:
+        break;
+    }
+}
+
+//------------------------------------------------------------------
+// Function: pushCommand
+//
+// Queues a command for the current turn. A full buffer is applied
+// first to make room.
+//------------------------------------------------------------------
+extern void pushCommand(enum commandType const type, int const entityIndex, int const positionX, int const positionY, int const value)
+{
+    struct Command *command = NULL;
+
+    if (commandCount >= COMMAND_BUFFER_SIZE)
+        applyCommands();
+
+    command = &commandBuffer[commandCount++];
+    command->type = type;
+    command->entityIndex = entityIndex;
+    command->posX = positionX;
+    command->posY = positionY;
+    command->value = value;
+}
+
+//------------------------------------------------------------------
+// Function: applyCommands
+//
+// Applies every queued command in one pass, in the order pushed, and
+// empties the buffer. Called once at the end of each entity's turn.
+// Returns the number of commands applied.
+//------------------------------------------------------------------
+extern int applyCommands()
+{
+    int appliedCount = commandCount;
+    int tilesBefore = changeSet.changedTileCount;
+
+    for (int i = 0; i < commandCount; i++)
+        applyCommand(&commandBuffer[i]);
+
+    commandCount = 0;
+    changeSet.commandCount += appliedCount;
+
+    turnsApplied++;
+    totalCommands += appliedCount;
+    mostCommandsInTurn = MAX(mostCommandsInTurn, appliedCount);
+    totalChangedTiles += changeSet.changedTileCount - tilesBefore;
+    mostChangedTilesInTurn = MAX(mostChangedTilesInTurn, changeSet.changedTileCount - tilesBefore);
+
+    return appliedCount;
+}
+
+//------------------------------------------------------------------
+// Function: markEntityChanged
+//
+// Adds the given entity to the change set's moved entities, once.
+// Also used when an entity is spawned or removed.
+//------------------------------------------------------------------
+extern void markEntityChanged(int const entityIndex)
+{
+    if (changeSet.isEntityMoved[entityIndex / 32] & (1u << (entityIndex % 32)))
+        return;
+
+    changeSet.isEntityMoved[entityIndex / 32] |= 1u << (entityIndex % 32);
+    changeSet.movedEntity[changeSet.movedEntityCount++] = entityIndex;
+}
+
+//------------------------------------------------------------------
+// Function: getChangeSet
+//
+// Returns what has changed since the last call to clearChangeSet.
+//------------------------------------------------------------------
+extern struct ChangeSet const* getChangeSet()
+{
+    return &changeSet;
+}
+
+//------------------------------------------------------------------
+// Function: clearChangeSet
+//
+// Empties the change set. Called once every consumer has seen it.
+//------------------------------------------------------------------
+extern void clearChangeSet()
+{
+    if (changeSet.commandCount > 0)
+        logEvent(LOG_ENTITY, MGBA_LOG_DEBUG, "change set: %d commands, %d tiles, %d entities",
+            changeSet.commandCount, changeSet.changedTileCount, changeSet.movedEntityCount);
+
+    memset(&changeSet, 0, sizeof(changeSet));
+    changeSet.playerMoveDirection = DIR_NULL;
+}
+
+//------------------------------------------------------------------
+// Function: printCommandStats
+//
+// Logs the commands and changed tiles per applied turn since start-up
+// or the last resetCommandStats.
+//------------------------------------------------------------------
+extern void printCommandStats()
+{
+    logMessage(LOG_GENERAL, MGBA_LOG_INFO, "commands: %d turns, %d commands (max %d per turn), %d tiles changed (max %d per turn)",
+        turnsApplied, totalCommands, mostCommandsInTurn, totalChangedTiles, mostChangedTilesInTurn);
+}
+
+//------------------------------------------------------------------
+// Function: resetCommandStats
+//
+// Zeroes the totals printCommandStats reports.
+//------------------------------------------------------------------
+extern void resetCommandStats()
+{
+    turnsApplied = 0;
+    totalCommands = 0;
+    mostCommandsInTurn = 0;
+    totalChangedTiles = 0;
+    mostChangedTilesInTurn = 0;
+}
@@ -2,124 +2,203 @@
 #include <string.h>
 #include "../libtonc/include/tonc.h"
 #include "constants.h"
+#include "arena.h"
+#include "command.h"
 #include "debug.h"
 #include "entity.h"
+#include "fieldOfVision.h"
+#include "floorCache.h"
+#include "flowField.h"
+#include "lighting.h"
+#include "logBuffer.h"
 #include "globals.h"
 #include "mgba.h"
+#include "pathfinding.h"
+#include "scheduler.h"
+#include "senseField.h"
 #include "tile.h"
 
 //------------------------------------------------------------------
-// Function: printMapInLog
+// Data Structures
+//------------------------------------------------------------------
+static char const terrainChars[ID_STAIRS_UP + 1] =
+{
+    '?',                                   // ID_TRANSPARENT
+    '.', '.', '.', '.',                    // ID_FLOOR and its variants
+    '#', '#',                              // ID_WALL, ID_WALL_FRONT
+    'S',                                   // ID_STAIRS
+    'U'                                    // ID_STAIRS_UP
+};
+
+static char const mapDigits[] = "0123456789abcdefghijklmnopqrstuvwxyz";
+
+static char const *const mapLayerNames[NUM_MAP_LAYERS] =
+{
+    "terrain", "sight", "entities", "player distance", "stairs distance", "dirty"
+};
+
+//------------------------------------------------------------------
+// Function Prototypes
+//------------------------------------------------------------------
+static void formatTerrainRow(int const y, char *row);
+static void formatDistanceRow(enum flowGoal const goal, int const y, char *row);
+
+//------------------------------------------------------------------
+// Function: formatTerrainRow
 //
-// Prints an ascii representation of the gameMap, including the player's
-// current position, in the mgba console.
+// Writes one character per tile of a gameMap row for its terrain.
 //------------------------------------------------------------------
-extern void printMapInLog()
+static void formatTerrainRow(int const y, char *row)
 {
-    struct Entity *player = getEntity(PLAYER_INDEX);
-    int playerX = player->posX, playerY = player->posY;
+    for (int x = 0; x < MAP_WIDTH_TILES; x++)
+    {
+        int terrainId = gameMap[y][x].terrainId;
 
-    for (int y = 0; y < MAP_HEIGHT_TILES; y++)
+        row[x] = (terrainId <= ID_STAIRS_UP) ? terrainChars[terrainId] : '?';
+    }
+}
+
+//------------------------------------------------------------------
+// Function: formatDistanceRow
+//
+// Writes one character per tile of a gameMap row for its distance to
+// a flow field's goal, blank where the goal can't be reached.
+//------------------------------------------------------------------
+static void formatDistanceRow(enum flowGoal const goal, int const y, char *row)
+{
+    for (int x = 0; x < MAP_WIDTH_TILES; x++)
     {
-        char mapRow[MAP_WIDTH_TILES + 1];
-        for (int c = 0; c < MAP_WIDTH_TILES + 1; c++)
-            mapRow[c] = '\0';
+        int distance = getFlowDistance(goal, x, y);
 
+        if (distance == FLOW_DISTANCE_UNREACHABLE)
+            row[x] = ' ';
+        else
+            row[x] = (distance < (int)sizeof(mapDigits) - 1) ? mapDigits[distance] : '+';
+    }
+}
+
+//------------------------------------------------------------------
+// Function: formatMapRow
+//
+// Writes an ascii row of one layer of the gameMap into row, which
+// needs MAP_WIDTH_TILES + 1 bytes, with the player shown as @. Each
+// character is written in place, so a row costs one pass. Returns
+// row. Used by printMapLayersInLog. It reads the live gameMap, entity
+// pool, flow fields and change set, so it only describes the game as
+// it is when called.
+//------------------------------------------------------------------
+extern char* formatMapRow(enum mapLayer const layer, int const y, char *row)
+{
+    struct ChangeSet const *changes = getChangeSet();
+    int playerX = getEntityPosX(PLAYER_INDEX), playerY = getEntityPosY(PLAYER_INDEX);
+
+    switch (layer)
+    {
+    case MAP_LAYER_SIGHT:
+        for (int x = 0; x < MAP_WIDTH_TILES; x++)
+            row[x] = (gameMap[y][x].sightId < 10) ? mapDigits[gameMap[y][x].sightId] : '~';
+        break;
+    case MAP_LAYER_ENTITIES:
+        formatTerrainRow(y, row);
         for (int x = 0; x < MAP_WIDTH_TILES; x++)
         {
-            if (playerX == x && playerY == y)
-                strcat(mapRow, "@");
-            else
-            {
-                switch (getTile(x, y)->terrainId)
-                {
-                case ID_FLOOR:
-                case ID_FLOOR_MOSSY:
-                case ID_FLOOR_BIG:
-                case ID_FLOOR_CHIP:
-                    strcat(mapRow, ".");
-                    break;
-                case ID_WALL:
-                case ID_WALL_FRONT:
-                    strcat(mapRow, "#");
-                    break;
-                case ID_STAIRS:
-                    strcat(mapRow, "S");
-                    break;
-                default:
-                    strcat(mapRow, "?");
-                    break;
-                }
-            }
+            int index = getEntityIndex(getEntityAtTile(x, y));
 
+            if (index > PLAYER_INDEX)
+                row[x] = entityPool.isAwake[index] ? 'E' : 'e';
         }
-        mgba_printf(MGBA_LOG_INFO, mapRow);
+        break;
+    case MAP_LAYER_PLAYER_DISTANCE:
+        formatDistanceRow(FLOW_GOAL_PLAYER, y, row);
+        break;
+    case MAP_LAYER_STAIRS_DISTANCE:
+        formatDistanceRow(FLOW_GOAL_STAIRS, y, row);
+        break;
+    case MAP_LAYER_DIRTY:
+        formatTerrainRow(y, row);
+
+        // A full change set stands for every tile
+        if (changes->isTileListFull)
+            memset(row, '*', MAP_WIDTH_TILES);
+        for (int i = 0; i < changes->changedTileCount; i++)
+        {
+            if (changes->changedTileY[i] == y)
+                row[changes->changedTileX[i]] = '*';
+        }
+        break;
+    default:
+        formatTerrainRow(y, row);
+        break;
     }
+
+    if (playerY == y)
+        row[playerX] = '@';
+    row[MAP_WIDTH_TILES] = '\0';
+
+    return row;
 }
 
 //------------------------------------------------------------------
-// Function: printTileSightInLog
+// Function: printMapLayersInLog
 //
-// Prints an ascii representation of the gameMap, including the player's
-// current position, in the mgba console but replaces the terrainIds
-// with the tile's sight status.
+// Prints each layer selected in layerMask (see mapLayerBit) as an
+// ascii map in the mgba console, one line per gameMap row.
 //------------------------------------------------------------------
-extern void printTileSightInLog()
+extern void printMapLayersInLog(u32 const layerMask)
 {
-    struct Entity *player = getEntity(PLAYER_INDEX);
-    int playerX = player->posX, playerY = player->posY;
+    char row[MAP_WIDTH_TILES + 1];
 
-    for (int y = 0; y < MAP_HEIGHT_TILES; y++)
-    {
-        char mapRow[MAP_WIDTH_TILES + 1];
-        for (int c = 0; c < MAP_WIDTH_TILES + 1; c++)
-            mapRow[c] = '\0';
+    flushLog();
 
-        for (int x = 0; x < MAP_WIDTH_TILES; x++)
-        {
-            if (playerX == x && playerY == y)
-                strcat(mapRow, "@");
-            else
-            {
-                switch (getTile(x, y)->sightId)
-                {
-                case 0:
-                    strcat(mapRow, "0");
-                    break;
-                case 1:
-                    strcat(mapRow, "1");
-                    break;
-                case 2:
-                    strcat(mapRow, "2");
-                    break;
-                case 3:
-                    strcat(mapRow, "3");
-                    break;
-                case 4:
-                    strcat(mapRow, "4");
-                    break;
-                case 5:
-                    strcat(mapRow, "5");
-                    break;
-                case 6:
-                    strcat(mapRow, "6");
-                    break;
-                case 7:
-                    strcat(mapRow, "7");
-                    break;
-                case 8:
-                    strcat(mapRow, "8");
-                    break;
-                case 9:
-                    strcat(mapRow, "9");
-                    break;
-                default:
-                    strcat(mapRow, "~");
-                    break;
-                }
-            }
+    for (int layer = 0; layer < NUM_MAP_LAYERS; layer++)
+    {
+        if ((layerMask & mapLayerBit(layer)) == 0)
+            continue;
 
-        }
-        mgba_printf(MGBA_LOG_INFO, mapRow);
+        logMessage(LOG_GENERAL, MGBA_LOG_INFO, "map layer: %s", mapLayerNames[layer]);
+        for (int y = 0; y < MAP_HEIGHT_TILES; y++)
+            logMessage(LOG_GENERAL, MGBA_LOG_INFO, "%s", formatMapRow(layer, y, row));
     }
 }
+
+//------------------------------------------------------------------
+// Function: runBenchmarks
+//
+// Runs every module's benchmark on the current gameMap and prints the
+// results in the mgba console. Triggered from the pause menu.
+//------------------------------------------------------------------
+extern void runBenchmarks()
+{
+    #ifdef DEBUG_BENCHMARK
+        u32 savedCategoryMask = logCategoryMask;
+
+        // Benchmarked turns would otherwise log every entity action
+        flushLog();
+        setLogCategoryEnabled(LOG_ENTITY, FALSE);
+        setLogCategoryEnabled(LOG_PLAYER, FALSE);
+        mgba_printf(MGBA_LOG_INFO, "runBenchmarks START");
+        testLineIterator();
+        benchmarkLineIterator();
+        benchmarkTileKernels();
+        benchmarkEntityTurns();
+        benchmarkScheduler();
+        benchmarkEntityFOVs();
+        compareFOVAlgorithms();
+        benchmarkFOVKernels();
+        benchmarkLighting();
+        benchmarkFlowFields();
+        benchmarkPathfinding();
+        benchmarkSenseFields();
+        printFOVCacheStats();
+        printSchedulerStats();
+        printCommandStats();
+        printActivityStats();
+        printArenaStats();
+        benchmarkFloorStore();
+        printFloorCacheStats();
+        printLogStats();
+        mgba_printf(MGBA_LOG_INFO, "runBenchmarks END");
+        flushLog();
+        logCategoryMask = savedCategoryMask;
+    #endif
+}
@@ -1,74 +1,599 @@
+#include <string.h>
 #include "../libtonc/include/tonc.h"
 #include "constants.h"
+#include "command.h"
 #include "debug.h"
 #include "entity.h"
+#include "fieldOfVision.h"
+#include "flowField.h"
 #include "globals.h"
+#include "logBuffer.h"
+#include "mapGeneration.h"
 #include "mgba.h"
 #include "pauseMenu.h"
+#include "pathfinding.h"
+#include "perfOverlay.h"
+#include "senseField.h"
+#include "scheduler.h"
 #include "tile.h"
 
+//------------------------------------------------------------------
+// Data Structures
+//------------------------------------------------------------------
+// Handle of the entity standing on each tile, parallel to gameMap
+static EntityHandle occupancyMap[MAP_HEIGHT_TILES][MAP_WIDTH_TILES] EWRAM_BSS;
+
+//------------------------------------------------------------------
+// Global Variables
+//------------------------------------------------------------------
+static boolean isPlayerAutoTraveling = FALSE;
+
+// Statistics on entities leaving and entering the active sectors
+static int dormantCount = 0, wakeCount = 0, catchUpSteps = 0;
+
 //------------------------------------------------------------------
 // Function Prototypes
 //------------------------------------------------------------------
+static void resetEntityPool();
+static void linkEntitySector(int const entityIndex);
+static void unlinkEntitySector(int const entityIndex);
+static void makeEntityDormant(int const entityIndex);
+static void wakeDormantEntity(int const entityIndex);
+static boolean catchUpEntity(int const entityIndex);
+static void doPlayerAutoTravel();
+
+//------------------------------------------------------------------
+// Function: resetEntityPool
+// 
+// Frees every slot and stops any player auto-travel, so nothing
+// carries over from the last floor or game. Slots are pushed in
+// reverse so the first spawn takes slot 0, which is always the
+// player's.
+//------------------------------------------------------------------
+static void resetEntityPool()
+{
+    memset(&entityPool, 0, sizeof(entityPool));
+    memset(entityPool.sectorHead, 0xFF, sizeof(entityPool.sectorHead));
+    memset(occupancyMap, 0, sizeof(occupancyMap));
+    resetScheduler();
+    isPlayerAutoTraveling = FALSE;
+
+    for (int index = 0; index < NUM_MAX_ENTITIES; index++)
+        entityPool.freeList[index] = NUM_MAX_ENTITIES - 1 - index;
+
+    entityPool.freeCount = NUM_MAX_ENTITIES;
+}
+
+//------------------------------------------------------------------
+// Function: linkEntitySector
+// 
+// Pushes the given entity onto the list of the sector it stands in.
+//------------------------------------------------------------------
+static void linkEntitySector(int const entityIndex)
+{
+    int sector = getMapSector(entityPool.posX[entityIndex], entityPool.posY[entityIndex]);
+    uint16_t head = entityPool.sectorHead[sector];
+
+    entityPool.sector[entityIndex] = sector;
+    entityPool.prevInSector[entityIndex] = ENTITY_INDEX_NULL;
+    entityPool.nextInSector[entityIndex] = head;
+    if (head != ENTITY_INDEX_NULL)
+        entityPool.prevInSector[head] = entityIndex;
+    entityPool.sectorHead[sector] = entityIndex;
+}
+
+//------------------------------------------------------------------
+// Function: unlinkEntitySector
+// 
+// Removes the given entity from its sector's list.
+//------------------------------------------------------------------
+static void unlinkEntitySector(int const entityIndex)
+{
+    uint16_t prev = entityPool.prevInSector[entityIndex], next = entityPool.nextInSector[entityIndex];
+
+    if (prev != ENTITY_INDEX_NULL)
+        entityPool.nextInSector[prev] = next;
+    else
+        entityPool.sectorHead[entityPool.sector[entityIndex]] = next;
+
+    if (next != ENTITY_INDEX_NULL)
+        entityPool.prevInSector[next] = prev;
+}
+
+//------------------------------------------------------------------
+// Function: makeEntityDormant
+// 
+// Takes the given entity off the turn heap. It keeps its next turn
+// time so resumeEntity knows how many turns it missed.
+//------------------------------------------------------------------
+static void makeEntityDormant(int const entityIndex)
+{
+    if (entityPool.isDormant[entityIndex] || entityIndex == PLAYER_INDEX)
+        return;
+
+    entityPool.isDormant[entityIndex] = TRUE;
+    entityPool.pendingCatchUp[entityIndex] = 0;
+    unscheduleEntity(entityIndex);
+    dormantCount++;
+}
+
+//------------------------------------------------------------------
+// Function: wakeDormantEntity
+// 
+// Puts the given entity back on the turn heap. An awake monster makes
+// up for the turns it missed at the start of its next turn, in
+// catchUpEntity, and a sleeping one stays where it was.
+//------------------------------------------------------------------
+static void wakeDormantEntity(int const entityIndex)
+{
+    int missedTurns = 0;
+
+    if (!entityPool.isDormant[entityIndex])
+        return;
+
+    entityPool.isDormant[entityIndex] = FALSE;
+    missedTurns = resumeEntity(entityIndex);
+    wakeCount++;
+
+    if (entityPool.isAwake[entityIndex])
+        entityPool.pendingCatchUp[entityIndex] = MIN(missedTurns, SECTOR_CATCH_UP_MAX_STEPS);
+
+    markEntityChanged(entityIndex);
+}
+
+//------------------------------------------------------------------
+// Function: catchUpEntity
+// 
+// Makes up for the turns the given entity missed while dormant in one
+// go instead of replaying them: it takes a step down the player's flow
+// field for each, pushed as moves and applied together. Run at the
+// start of the entity's turn, so the flow field has already followed
+// the player's move that woke it. Returns FALSE if a step led back out
+// of the active sectors, which ends the catch-up and the turn.
+//------------------------------------------------------------------
+static boolean catchUpEntity(int const entityIndex)
+{
+    int positionX = entityPool.posX[entityIndex], positionY = entityPool.posY[entityIndex];
+    int stepCount = entityPool.pendingCatchUp[entityIndex];
+
+    if (stepCount == 0)
+        return TRUE;
+
+    entityPool.pendingCatchUp[entityIndex] = 0;
+
+    for (int step = 0; step < stepCount; step++)
+    {
+        enum direction direction = getFlowDirection(FLOW_GOAL_PLAYER, positionX, positionY);
+
+        if (direction == DIR_NULL || isTileOccupied(positionX + dirX[direction], positionY + dirY[direction]))
+            break;
+
+        positionX += dirX[direction];
+        positionY += dirY[direction];
+        pushCommand(COMMAND_MOVE, entityIndex, positionX, positionY, direction);
+        catchUpSteps++;
+
+        if (!entityPool.isSectorActive[getMapSector(positionX, positionY)])
+            break;
+    }
+
+    applyCommands();
+
+    return !entityPool.isDormant[entityIndex];
+}
+
+//------------------------------------------------------------------
+// Function: updateActiveSectors
+// 
+// Marks the sectors within SECTOR_ACTIVE_RANGE of the player's as
+// active. Entities in sectors that just went inactive are taken off
+// the turn heap, and those in sectors that just became active are
+// woken, so the cost of far away entities is paid once per sector
+// change instead of every turn. Called when the player changes
+// sector.
+//------------------------------------------------------------------
+extern void updateActiveSectors()
+{
+    uint8_t changedEntity[NUM_MAX_ENTITIES];
+    int changedCount = 0;
+    int playerSectorX = entityPool.posX[PLAYER_INDEX] / MAP_SECTOR_SIZE;
+    int playerSectorY = entityPool.posY[PLAYER_INDEX] / MAP_SECTOR_SIZE;
+
+    for (int sector = 0; sector < NUM_MAP_SECTORS; sector++)
+    {
+        boolean isActive = ABS(sector % MAP_SECTORS_WIDE - playerSectorX) <= SECTOR_ACTIVE_RANGE
+                        && ABS(sector / MAP_SECTORS_WIDE - playerSectorY) <= SECTOR_ACTIVE_RANGE;
+
+        if (isActive == entityPool.isSectorActive[sector])
+            continue;
+
+        entityPool.isSectorActive[sector] = isActive;
+
+        // Catching up moves entities between lists, so gather them first
+        for (uint16_t index = entityPool.sectorHead[sector]; index != ENTITY_INDEX_NULL; index = entityPool.nextInSector[index])
+            changedEntity[changedCount++] = index;
+    }
+
+    for (int i = 0; i < changedCount; i++)
+    {
+        int index = changedEntity[i];
+
+        if (entityPool.isSectorActive[entityPool.sector[index]])
+            wakeDormantEntity(index);
+        else
+            makeEntityDormant(index);
+    }
+
+    logEvent(LOG_ENTITY, MGBA_LOG_DEBUG, "updateActiveSectors: player in sector (%d, %d), %d entities changed",
+        playerSectorX, playerSectorY, changedCount);
+}
+
+//------------------------------------------------------------------
+// Function: isEntityDormant
+// 
+// Returns whether the given entity is outside the active sectors and
+// so isn't taking turns.
+//------------------------------------------------------------------
+extern boolean isEntityDormant(int const entityIndex)
+{
+    return entityPool.isDormant[entityIndex];
+}
+
+//------------------------------------------------------------------
+// Function: printActivityStats
+// 
+// Logs how many entities are dormant now and how often entities were
+// put to sleep and woken since start-up or the last
+// resetActivityStats.
+//------------------------------------------------------------------
+extern void printActivityStats()
+{
+    int dormantNow = 0;
 
+    for (int i = 0; i < entityPool.activeCount; i++)
+        dormantNow += entityPool.isDormant[entityPool.activeList[i]];
+
+    logMessage(LOG_GENERAL, MGBA_LOG_INFO, "activity: %d of %d entities dormant, %d put to sleep, %d woken with %d catch-up steps",
+        dormantNow, entityPool.activeCount, dormantCount, wakeCount, catchUpSteps);
+}
+
+//------------------------------------------------------------------
+// Function: resetActivityStats
+// 
+// Zeroes the sleep, wake and catch-up counts. Which entities are
+// dormant is left as it is.
+//------------------------------------------------------------------
+extern void resetActivityStats()
+{
+    dormantCount = 0;
+    wakeCount = 0;
+    catchUpSteps = 0;
+}
 
 //------------------------------------------------------------------
 // Function: initEntities
 // 
-// Initializes all entity variables. Should be called upon entrance
-// to a new map.
+// Initializes all entity variables, with the player at the given
+// position and the rest at random. Should be called upon entrance
+// to a new map. Auto-travel is stopped by resetEntityPool.
 //------------------------------------------------------------------
-extern void initEntities()
+extern void initEntities(int const playerX, int const playerY)
 {
-    #ifdef DEBUG_ENTITY
-        mgba_printf(MGBA_LOG_DEBUG, "initEntities");
-    #endif
+    logEvent(LOG_ENTITY, MGBA_LOG_DEBUG, "initEntities");
 
-    for (int index = 0; index < NUM_MAX_ENTITIES; index++)
+    resetEntityPool();
+
+    for (int count = 0; count < NUM_START_ENTITIES; count++)
     {
-        entity[index].facing = DIR_DOWN;
-        entity[index].sightRange = SIGHT_RANGE_STANDARD;
-        entity[index].lastAction = NO_ACTION;
+        int positionX = 0, positionY = 0;
+        EntityHandle handle = ENTITY_HANDLE_NULL;
 
-        // Randomize entity positions
-        do
+        // Randomize monster positions
+        if (count == PLAYER_INDEX)
         {
-            entity[index].posX = randomInRange(1, MAP_WIDTH_TILES - 1);
-            entity[index].posY = randomInRange(1, MAP_HEIGHT_TILES - 1);
-        } while (isSolid(entity[index].posX, entity[index].posY));
-
-        #ifdef DEBUG_ENTITY
-            mgba_printf(MGBA_LOG_DEBUG, "  index %d", index);
-            mgba_printf(MGBA_LOG_DEBUG, "    position: (%d, %d)", entity[index].posX, entity[index].posY);
-        #endif
+            positionX = playerX;
+            positionY = playerY;
+        }
+        else
+        {
+            do
+            {
+                positionX = randomInRange(1, MAP_WIDTH_TILES - 1);
+                positionY = randomInRange(1, MAP_HEIGHT_TILES - 1);
+            } while (isSolid(positionX, positionY) || isTileOccupied(positionX, positionY));
+        }
+
+        handle = spawnEntity(positionX, positionY);
+
+        // Monsters get a random speed so some outpace the player
+        if (count != PLAYER_INDEX)
+            setEntitySpeed(getEntityIndex(handle), randomInRange(ENTITY_SPEED_SLOW, ENTITY_SPEED_FAST));
+
+        logEvent(LOG_ENTITY, MGBA_LOG_DEBUG, "  index %d at (%d, %d)", count, positionX, positionY);
     }
+
+    entityPool.isAwake[PLAYER_INDEX] = TRUE;
+}
+
+//------------------------------------------------------------------
+// Function: clearEntities
+// 
+// Removes every entity without spawning new ones, so entities can be
+// restored from a save. The player must be spawned first.
+//------------------------------------------------------------------
+extern void clearEntities()
+{
+    resetEntityPool();
+}
+
+//------------------------------------------------------------------
+// Function: spawnEntity
+// 
+// Takes a slot off the free list, places a new entity at the given
+// position and returns its handle. Returns ENTITY_HANDLE_NULL if the
+// pool is full or the tile is already occupied.
+//------------------------------------------------------------------
+extern EntityHandle spawnEntity(int const positionX, int const positionY)
+{
+    int index = 0;
+
+    if (entityPool.freeCount == 0 || isOutOfBounds(positionX, positionY) || isTileOccupied(positionX, positionY))
+    {
+        logEvent(LOG_ENTITY, MGBA_LOG_WARN, "spawnEntity failed: (%d, %d)", positionX, positionY);
+
+        return ENTITY_HANDLE_NULL;
+    }
+
+    index = entityPool.freeList[--entityPool.freeCount];
+
+    entityPool.posX[index] = positionX;
+    entityPool.posY[index] = positionY;
+    entityPool.facing[index] = DIR_DOWN;
+    entityPool.sightRange[index] = SIGHT_RANGE_STANDARD;
+    entityPool.lastAction[index] = NO_ACTION;
+    entityPool.isAwake[index] = FALSE;
+    entityPool.speed[index] = ENTITY_SPEED_NORMAL;
+
+    // Generation 0 marks a free slot, so skip it when wrapping around
+    if (++entityPool.generation[index] == 0)
+        entityPool.generation[index] = 1;
+
+    entityPool.activeSlot[index] = entityPool.activeCount;
+    entityPool.activeList[entityPool.activeCount++] = index;
+
+    occupancyMap[positionY][positionX] = getEntityHandle(index);
+    entityPool.isDormant[index] = FALSE;
+    entityPool.pendingCatchUp[index] = 0;
+    scheduleEntity(index, 0);
+    linkEntitySector(index);
+    markEntityChanged(index);
+
+    // The player's spawn decides which sectors are active
+    if (index == PLAYER_INDEX)
+        updateActiveSectors();
+    else if (!entityPool.isSectorActive[entityPool.sector[index]])
+        makeEntityDormant(index);
+
+    return getEntityHandle(index);
+}
+
+//------------------------------------------------------------------
+// Function: despawnEntity
+// 
+// Removes the entity with the given handle and returns its slot to the
+// free list. The last active slot is swapped into its place so the
+// active list stays dense.
+//------------------------------------------------------------------
+extern void despawnEntity(EntityHandle const handle)
+{
+    int index = getEntityIndex(handle), lastIndex = 0;
+
+    if (index < 0)
+        return;
+
+    occupancyMap[entityPool.posY[index]][entityPool.posX[index]] = ENTITY_HANDLE_NULL;
+    unscheduleEntity(index);
+    unlinkEntitySector(index);
+    markEntityChanged(index);
+
+    lastIndex = entityPool.activeList[--entityPool.activeCount];
+    entityPool.activeList[entityPool.activeSlot[index]] = lastIndex;
+    entityPool.activeSlot[lastIndex] = entityPool.activeSlot[index];
+
+    entityPool.generation[index] = 0;
+    entityPool.freeList[entityPool.freeCount++] = index;
 }
 
 //------------------------------------------------------------------
-// Function: getEntity
+// Function: isEntityHandleValid
 // 
-// Returns a pointer to the given entity using its entity[index].
+// Returns whether the given handle still refers to a live entity.
 //------------------------------------------------------------------
-extern struct Entity* getEntity(const int entityIndex)
+extern boolean isEntityHandleValid(EntityHandle const handle)
 {
-    return &entity[entityIndex];
+    int generation = handle >> 8;
+
+    return generation != 0 && entityPool.generation[handle & 0xFF] == generation;
+}
+
+//------------------------------------------------------------------
+// Function: getEntityIndex
+// 
+// Returns the slot index of the entity with the given handle, or -1 if
+// the handle is stale.
+//------------------------------------------------------------------
+extern int getEntityIndex(EntityHandle const handle)
+{
+    if (!isEntityHandleValid(handle))
+        return -1;
+
+    return handle & 0xFF;
+}
+
+//------------------------------------------------------------------
+// Function: getEntityHandle
+// 
+// Returns a handle to the entity in the given slot.
+//------------------------------------------------------------------
+extern EntityHandle getEntityHandle(int const entityIndex)
+{
+    return (entityPool.generation[entityIndex] << 8) | entityIndex;
+}
+
+//------------------------------------------------------------------
+// Function: getEntityCount
+// 
+// Returns the number of live entities.
+//------------------------------------------------------------------
+extern int getEntityCount()
+{
+    return entityPool.activeCount;
+}
+
+//------------------------------------------------------------------
+// Function: getEntityAtTile
+// 
+// Returns the handle of the entity standing on the given tile, or
+// ENTITY_HANDLE_NULL if there is none.
+//------------------------------------------------------------------
+extern EntityHandle getEntityAtTile(int const positionX, int const positionY)
+{
+    if (isOutOfBounds(positionX, positionY))
+        return ENTITY_HANDLE_NULL;
+
+    return occupancyMap[positionY][positionX];
+}
+
+//------------------------------------------------------------------
+// Function: isTileOccupied
+// 
+// Returns whether an entity is standing on the given tile.
+//------------------------------------------------------------------
+extern boolean isTileOccupied(int const positionX, int const positionY)
+{
+    return getEntityAtTile(positionX, positionY) != ENTITY_HANDLE_NULL;
+}
+
+//------------------------------------------------------------------
+// Function: checkOccupancyConsistency
+// 
+// Debug check that the occupancy map and the entity pool agree: every
+// live entity's tile holds its handle, and every handle on the map
+// belongs to a live entity standing on that tile. The sector lists
+// must hold every live entity once, in the sector it stands in, and
+// only entities in inactive sectors may be dormant. Logs each
+// mismatch.
+//------------------------------------------------------------------
+extern boolean checkOccupancyConsistency()
+{
+    int errorCount = 0, listedCount = 0;
+
+    for (int i = 0; i < entityPool.activeCount; i++)
+    {
+        int index = entityPool.activeList[i];
+
+        if (occupancyMap[entityPool.posY[index]][entityPool.posX[index]] != getEntityHandle(index))
+        {
+            errorCount++;
+            logEvent(LOG_ENTITY, MGBA_LOG_ERROR, "occupancy: entity %d missing at (%d, %d)",
+                index, entityPool.posX[index], entityPool.posY[index]);
+        }
+    }
+
+    for (int y = 0; y < MAP_HEIGHT_TILES; y++)
+    {
+        for (int x = 0; x < MAP_WIDTH_TILES; x++)
+        {
+            EntityHandle handle = occupancyMap[y][x];
+            int index = getEntityIndex(handle);
+
+            if (handle == ENTITY_HANDLE_NULL)
+                continue;
+
+            if (index < 0 || entityPool.posX[index] != x || entityPool.posY[index] != y)
+            {
+                errorCount++;
+                logEvent(LOG_ENTITY, MGBA_LOG_ERROR, "occupancy: stale handle %d at (%d, %d)", handle, x, y);
+            }
+        }
+    }
+
+    for (int sector = 0; sector < NUM_MAP_SECTORS; sector++)
+    {
+        for (uint16_t index = entityPool.sectorHead[sector]; index != ENTITY_INDEX_NULL; index = entityPool.nextInSector[index])
+        {
+            listedCount++;
+
+            if (getMapSector(entityPool.posX[index], entityPool.posY[index]) != sector
+            || entityPool.isDormant[index] == entityPool.isSectorActive[sector])
+            {
+                errorCount++;
+                logEvent(LOG_ENTITY, MGBA_LOG_ERROR, "sectors: entity %d listed in sector %d, dormant %d",
+                    index, sector, entityPool.isDormant[index]);
+            }
+        }
+    }
+
+    if (listedCount != entityPool.activeCount)
+    {
+        errorCount++;
+        logEvent(LOG_ENTITY, MGBA_LOG_ERROR, "sectors: %d entities listed, %d live", listedCount, entityPool.activeCount);
+    }
+
+    return errorCount == 0;
+}
+
+//------------------------------------------------------------------
+// Function: getEntityPosX
+// 
+// Returns the horizontal position of the given entity.
+//------------------------------------------------------------------
+extern int getEntityPosX(int const entityIndex)
+{
+    return entityPool.posX[entityIndex];
+}
+
+//------------------------------------------------------------------
+// Function: getEntityPosY
+// 
+// Returns the vertical position of the given entity.
+//------------------------------------------------------------------
+extern int getEntityPosY(int const entityIndex)
+{
+    return entityPool.posY[entityIndex];
 }
 
 //------------------------------------------------------------------
 // Function: setEntityPos
 // 
-// Sets the given entity's position to the given coordinates.
+// Sets the given entity's position to the given coordinates. Crossing
+// into another sector moves the entity to that sector's list; for the
+// player it also moves the active sectors, and any other entity is
+// put to sleep or woken to match its new sector.
 //------------------------------------------------------------------
-extern void setEntityPos(struct Entity *entity, const int positionX, const int positionY)
+extern void setEntityPos(int const entityIndex, int const positionX, int const positionY)
 {
-    #ifdef DEBUG_ENTITY
-        mgba_printf(MGBA_LOG_DEBUG, "  setEntityPos");
-        mgba_printf(MGBA_LOG_DEBUG, "    currentPos: (%d, %d)", entity->posX, entity->posY);
-        mgba_printf(MGBA_LOG_DEBUG, "    newPos (%d, %d)", positionX, positionY);
-    #endif
+    logEvent(LOG_ENTITY, MGBA_LOG_DEBUG, "  setEntityPos: (%d, %d) to (%d, %d)",
+        entityPool.posX[entityIndex], entityPool.posY[entityIndex], positionX, positionY);
+
+    occupancyMap[entityPool.posY[entityIndex]][entityPool.posX[entityIndex]] = ENTITY_HANDLE_NULL;
+    occupancyMap[positionY][positionX] = getEntityHandle(entityIndex);
+
+    entityPool.posX[entityIndex] = positionX;
+    entityPool.posY[entityIndex] = positionY;
 
-    entity->posX = positionX;
-    entity->posY = positionY;
+    if (getMapSector(positionX, positionY) == entityPool.sector[entityIndex])
+        return;
+
+    unlinkEntitySector(entityIndex);
+    linkEntitySector(entityIndex);
+
+    if (entityIndex == PLAYER_INDEX)
+        updateActiveSectors();
+    else if (entityPool.isSectorActive[entityPool.sector[entityIndex]])
+        wakeDormantEntity(entityIndex);
+    else
+        makeEntityDormant(entityIndex);
 }
 
 //------------------------------------------------------------------
@@ -76,13 +601,11 @@ extern void setEntityPos(struct Entity *entity, const int positionX, const int p
 // 
 // Gets the given entity's sight range. Used in checking LOS.
 //------------------------------------------------------------------
-extern int getEntitySightRange(const struct Entity *entity)
+extern int getEntitySightRange(int const entityIndex)
 {
-    #ifdef DEBUG_ENTITY
-        mgba_printf(MGBA_LOG_DEBUG, "  getEntitySightRange: %d", entity->sightRange);
-    #endif
+    logEvent(LOG_ENTITY, MGBA_LOG_DEBUG, "  getEntitySightRange: %d", entityPool.sightRange[entityIndex]);
 
-    return entity->sightRange;
+    return entityPool.sightRange[entityIndex];
 }
 
 //------------------------------------------------------------------
@@ -90,15 +613,11 @@ extern int getEntitySightRange(const struct Entity *entity)
 // 
 // Sets the given entity's sight range.
 //------------------------------------------------------------------
-extern void setEntitySightRange(struct Entity *entity, const int sightRange)
+extern void setEntitySightRange(int const entityIndex, int const sightRange)
 {
-    #ifdef DEBUG_ENTITY
-        mgba_printf(MGBA_LOG_DEBUG, "  setEntitySightRange");
-        mgba_printf(MGBA_LOG_DEBUG, "    current range: %d", entity->sightRange);
-        mgba_printf(MGBA_LOG_DEBUG, "    new range: %d", sightRange);
-    #endif
+    logEvent(LOG_ENTITY, MGBA_LOG_DEBUG, "  setEntitySightRange: %d to %d", entityPool.sightRange[entityIndex], sightRange);
 
-    entity->sightRange = sightRange;
+    entityPool.sightRange[entityIndex] = sightRange;
 }
 
 //------------------------------------------------------------------
@@ -106,13 +625,11 @@ extern void setEntitySightRange(struct Entity *entity, const int sightRange)
 // 
 // Gets the given entity's facing direction.
 //------------------------------------------------------------------
-extern int getEntityFacing(const struct Entity *entity)
+extern int getEntityFacing(int const entityIndex)
 {
-    #ifdef DEBUG_ENTITY
-        mgba_printf(MGBA_LOG_DEBUG, "  getEntityFacing: %d", entity->facing);
-    #endif
+    logEvent(LOG_ENTITY, MGBA_LOG_DEBUG, "  getEntityFacing: %d", entityPool.facing[entityIndex]);
 
-    return entity->facing;
+    return entityPool.facing[entityIndex];
 }
 
 //------------------------------------------------------------------
@@ -120,15 +637,33 @@ extern int getEntityFacing(const struct Entity *entity)
 // 
 // Sets the given entity's facing direction.
 //------------------------------------------------------------------
-extern void setEntityFacing(struct Entity *entity, const enum direction direction)
+extern void setEntityFacing(int const entityIndex, enum direction const direction)
+{
+    logEvent(LOG_ENTITY, MGBA_LOG_DEBUG, "  setEntityFacing: %d to %d", entityPool.facing[entityIndex], direction);
+
+    entityPool.facing[entityIndex] = direction;
+}
+
+//------------------------------------------------------------------
+// Function: getEntitySpeed
+// 
+// Gets the given entity's speed.
+//------------------------------------------------------------------
+extern int getEntitySpeed(int const entityIndex)
 {
-    #ifdef DEBUG_ENTITY
-        mgba_printf(MGBA_LOG_DEBUG, "  setEntityFacing");
-        mgba_printf(MGBA_LOG_DEBUG, "    currentFacing: %d", entity->facing);
-        mgba_printf(MGBA_LOG_DEBUG, "    newFacing: %d", direction);
-    #endif
+    return entityPool.speed[entityIndex];
+}
 
-    entity->facing = direction;
+//------------------------------------------------------------------
+// Function: setEntitySpeed
+// 
+// Sets the given entity's speed. Takes effect from its next turn.
+//------------------------------------------------------------------
+extern void setEntitySpeed(int const entityIndex, int const speed)
+{
+    logEvent(LOG_ENTITY, MGBA_LOG_DEBUG, "  setEntitySpeed: %d", speed);
+
+    entityPool.speed[entityIndex] = clamp(speed, 1, 256);
 }
 
 //------------------------------------------------------------------
@@ -136,13 +671,11 @@ extern void setEntityFacing(struct Entity *entity, const enum direction directio
 // 
 // Gets the given entity's last performed action.
 //------------------------------------------------------------------
-extern int getEntityLastAction(struct Entity *entity)
+extern int getEntityLastAction(int const entityIndex)
 {
-    #ifdef DEBUG_ENTITY
-        mgba_printf(MGBA_LOG_DEBUG, "  getEntityLastAction: %d", entity->lastAction);
-    #endif
+    logEvent(LOG_ENTITY, MGBA_LOG_DEBUG, "  getEntityLastAction: %d", entityPool.lastAction[entityIndex]);
 
-    return entity->lastAction;
+    return entityPool.lastAction[entityIndex];
 }
 
 //------------------------------------------------------------------
@@ -150,16 +683,11 @@ extern int getEntityLastAction(struct Entity *entity)
 // 
 // Sets the given entity's last performed action.
 //------------------------------------------------------------------
-extern void setEntityLastAction(struct Entity *entity, const enum entityAction action)
+extern void setEntityLastAction(int const entityIndex, enum entityAction const action)
 {
-    #ifdef DEBUG_ENTITY
-        mgba_printf(MGBA_LOG_DEBUG, "  setEntityLastAction");
-        mgba_printf(MGBA_LOG_DEBUG, "    previous action: %d", entity->lastAction);
-        mgba_printf(MGBA_LOG_DEBUG, "    new action: %d", action);
-    #endif
+    logEvent(LOG_ENTITY, MGBA_LOG_DEBUG, "  setEntityLastAction: %d to %d", entityPool.lastAction[entityIndex], action);
 
-    entity->lastAction = action;
-    
+    entityPool.lastAction[entityIndex] = action;
 }
 
 //------------------------------------------------------------------
@@ -168,40 +696,26 @@ extern void setEntityLastAction(struct Entity *entity, const enum entityAction a
 // Makes the given entity perform the "walk" action in the given
 // direction.
 //------------------------------------------------------------------
-extern boolean entityWalk(struct Entity *entity, const enum direction direction)
+extern boolean entityWalk(int const entityIndex, enum direction const direction)
 {
-    int targetPosX = entity->posX + dirX[direction];
-    int targetPosY = entity->posY + dirY[direction];
-
-    #ifdef DEBUG_ENTITY
-        mgba_printf(MGBA_LOG_DEBUG, "entityWalk");
-    #endif
+    int targetPosX = entityPool.posX[entityIndex] + dirX[direction];
+    int targetPosY = entityPool.posY[entityIndex] + dirY[direction];
 
-    setEntityFacing(entity, direction);
+    logEvent(LOG_ENTITY, MGBA_LOG_DEBUG, "entityWalk");
 
-    // Fail conditions
-    if ((isSolid(targetPosX, targetPosY) && debugCollisionIsOff == FALSE) || isOutOfBounds(targetPosX, targetPosY))
-        return FALSE;
-
-    setEntityPos(entity, targetPosX, targetPosY);
-    switch (direction)
+    // Fail conditions. A blocked walk still turns the entity, which takes
+    // no turn, as when the player turns with A held
+    if ((isSolid(targetPosX, targetPosY) && debugCollisionIsOff == FALSE) || isOutOfBounds(targetPosX, targetPosY)
+    || isTileOccupied(targetPosX, targetPosY))
     {
-    case DIR_LEFT:
-        setEntityLastAction(entity, WALKED_LEFT);
-        break;
-    case DIR_RIGHT:
-        setEntityLastAction(entity, WALKED_RIGHT);
-        break;
-    case DIR_UP:
-        setEntityLastAction(entity, WALKED_UP);
-        break;
-    case DIR_DOWN:
-        setEntityLastAction(entity, WALKED_DOWN);
-        break;
-    default:
+        setEntityFacing(entityIndex, direction);
+        return FALSE;
     }
 
-    turnOfEntityIndex++;
+    // The move's direction also sets the facing when it is applied
+    pushCommand(COMMAND_MOVE, entityIndex, targetPosX, targetPosY, direction);
+
+    endEntityTurn(entityIndex);
     return TRUE;
 }
 
@@ -211,36 +725,166 @@ extern boolean entityWalk(struct Entity *entity, const enum direction direction)
 // Makes the given entity perform the "earthbend" action in the direction
 // they are facing.
 //------------------------------------------------------------------
-extern boolean entityEarthBend(struct Entity *entity)
+extern boolean entityEarthBend(int const entityIndex)
 {
-    int targetPosX = entity->posX + dirX[entity->facing];
-    int targetPosY = entity->posY + dirY[entity->facing];
+    int targetPosX = entityPool.posX[entityIndex] + dirX[entityPool.facing[entityIndex]];
+    int targetPosY = entityPool.posY[entityIndex] + dirY[entityPool.facing[entityIndex]];
     int terrainOfTarget = getTileTerrain(targetPosX, targetPosY);
 
-    if (isOutOfBounds(targetPosX, targetPosY))
+    // Don't bury anyone standing on the target
+    if (isOutOfBounds(targetPosX, targetPosY) || isTileOccupied(targetPosX, targetPosY))
         return FALSE;
 
-    #ifdef DEBUG_ENTITY
-        mgba_printf(MGBA_LOG_DEBUG, "entityEarthBend");
-    #endif
+    logEvent(LOG_ENTITY, MGBA_LOG_DEBUG, "entityEarthBend");
 
     switch (terrainOfTarget)
     {
     case ID_STAIRS:
+    case ID_STAIRS_UP:
         return FALSE;
     case ID_WALL:
-        setTileTerrain(targetPosX, targetPosY, ID_FLOOR_BIG);
+        pushCommand(COMMAND_SET_TERRAIN, entityIndex, targetPosX, targetPosY, ID_FLOOR_BIG);
         break;
     default:
-        setTileTerrain(targetPosX, targetPosY, ID_WALL);
+        pushCommand(COMMAND_SET_TERRAIN, entityIndex, targetPosX, targetPosY, ID_WALL);
     }
 
-    setEntityLastAction(entity, EARTH_BEND);
+    endEntityTurn(entityIndex);
+    return TRUE;
+}
 
-    turnOfEntityIndex++;
+//------------------------------------------------------------------
+// Function: entityAttack
+// 
+// Makes the given entity attack whoever stands next to it in the given
+// direction. Fails if the tile is empty.
+//------------------------------------------------------------------
+extern boolean entityAttack(int const entityIndex, enum direction const direction)
+{
+    int targetPosX = entityPool.posX[entityIndex] + dirX[direction];
+    int targetPosY = entityPool.posY[entityIndex] + dirY[direction];
+    int targetIndex = getEntityIndex(getEntityAtTile(targetPosX, targetPosY));
+
+    if (targetIndex < 0)
+        return FALSE;
+
+    logEvent(LOG_ENTITY, MGBA_LOG_DEBUG, "entityAttack: %d hits %d", entityIndex, targetIndex);
+
+    pushCommand(COMMAND_ATTACK, entityIndex, targetPosX, targetPosY, direction);
+
+    endEntityTurn(entityIndex);
     return TRUE;
 }
 
+//------------------------------------------------------------------
+// Function: entityWait
+// 
+// Makes the given entity spend its turn doing nothing.
+//------------------------------------------------------------------
+extern void entityWait(int const entityIndex)
+{
+    pushCommand(COMMAND_WAIT, entityIndex, entityPool.posX[entityIndex], entityPool.posY[entityIndex], 0);
+
+    endEntityTurn(entityIndex);
+}
+
+//------------------------------------------------------------------
+// Function: doMonsterTurn
+// 
+// Decides and performs the given monster's action, after making up for
+// any turns it missed while dormant. A sleeping monster waits until it
+// sees the player or hears a noise. An awake one attacks the player
+// when next to them; otherwise it chases the player down the flow
+// field while it can see them, follows their scent trail once it
+// can't, and heads for the loudest noise once the trail runs out.
+// With nothing to go on it waits.
+//------------------------------------------------------------------
+extern void doMonsterTurn(int const entityIndex)
+{
+    int playerX = entityPool.posX[PLAYER_INDEX], playerY = entityPool.posY[PLAYER_INDEX];
+    int positionX = 0, positionY = 0;
+    boolean canSeePlayer = FALSE;
+    enum direction direction = DIR_NULL;
+
+    if (!catchUpEntity(entityIndex))
+        return;
+
+    positionX = entityPool.posX[entityIndex];
+    positionY = entityPool.posY[entityIndex];
+    canSeePlayer = canEntitySee(entityIndex, playerX, playerY);
+
+    if (entityPool.isAwake[entityIndex] == FALSE)
+    {
+        if (!canSeePlayer && getSenseStrength(SENSE_NOISE, positionX, positionY) == 0)
+        {
+            entityWait(entityIndex);
+            return;
+        }
+
+        entityPool.isAwake[entityIndex] = TRUE;
+    }
+
+    for (direction = DIR_LEFT; direction <= DIR_DOWN; direction++)
+    {
+        if (positionX + dirX[direction] == playerX && positionY + dirY[direction] == playerY)
+        {
+            entityAttack(entityIndex, direction);
+            return;
+        }
+    }
+
+    if (canSeePlayer)
+        direction = getFlowDirection(FLOW_GOAL_PLAYER, positionX, positionY);
+    else
+    {
+        direction = getSenseDirection(SENSE_SCENT, positionX, positionY);
+
+        if (direction == DIR_NULL)
+            direction = getSenseDirection(SENSE_NOISE, positionX, positionY);
+    }
+
+    if (direction == DIR_NULL || !entityWalk(entityIndex, direction))
+        entityWait(entityIndex);
+}
+
+//------------------------------------------------------------------
+// Function: doPlayerAutoTravel
+// 
+// Walks the player one step along the path to the stairs. While the
+// path is still being searched, the search is continued for one
+// frame's worth of work instead. Stops once the path is blocked, runs
+// out, or can't be found.
+//------------------------------------------------------------------
+static void doPlayerAutoTravel()
+{
+    enum direction direction = DIR_NULL;
+
+    if (getPathStatus() == PATH_SEARCHING)
+    {
+        continuePathSearch(PATH_EXPANSIONS_PER_FRAME);
+        return;
+    }
+
+    direction = getPathDirection(entityPool.posX[PLAYER_INDEX], entityPool.posY[PLAYER_INDEX]);
+
+    if (getPathStatus() != PATH_FOUND || direction == DIR_NULL || !entityWalk(PLAYER_INDEX, direction))
+    {
+        logEvent(LOG_PLAYER, MGBA_LOG_INFO, "auto-travel stopped");
+
+        isPlayerAutoTraveling = FALSE;
+    }
+}
+
+//------------------------------------------------------------------
+// Function: isPlayerAutoTravelActive
+// 
+// Returns whether auto-travel is driving the player.
+//------------------------------------------------------------------
+extern boolean isPlayerAutoTravelActive()
+{
+    return isPlayerAutoTraveling;
+}
+
 //------------------------------------------------------------------
 // Function: doPlayerInput
 // 
@@ -248,109 +892,157 @@ extern boolean entityEarthBend(struct Entity *entity)
 //------------------------------------------------------------------
 extern void doPlayerInput()
 {
-    struct Entity *player = getEntity(PLAYER_INDEX);
+    // Any key cancels auto-travel, otherwise it drives the player
+    if (isPlayerAutoTraveling)
+    {
+        if (key_hit(KEY_ANY))
+            isPlayerAutoTraveling = FALSE;
+        else
+        {
+            doPlayerAutoTravel();
+            return;
+        }
+    }
 
     if ((KEY_EQ(key_hit, KI_LEFT) || KEY_EQ(key_held, KI_LEFT)) && !KEY_EQ(key_held, KI_A)) // Left Key
     {
-        #ifdef DEBUG_PLAYER
-            mgba_printf(MGBA_LOG_INFO, "pressed LEFT");
-        #endif
+        logEvent(LOG_PLAYER, MGBA_LOG_INFO, "pressed LEFT");
 
-        // If player walking left doesn't fail
-        if (entityWalk(player, DIR_LEFT))
-        {
-            playerSightId++;
-
-            playerMoveOffsetX = dirX[DIR_RIGHT] * TILE_SIZE;
-            screenOffsetX += dirX[DIR_LEFT] * TILE_SIZE;
-        }
+        // Walking into another entity attacks it, but only on a fresh press
+        if (!KEY_EQ(key_hit, KI_LEFT) || !entityAttack(PLAYER_INDEX, DIR_LEFT))
+            entityWalk(PLAYER_INDEX, DIR_LEFT);
     }
     else if ((KEY_EQ(key_hit, KI_RIGHT) || KEY_EQ(key_held, KI_RIGHT)) && !KEY_EQ(key_held, KI_A)) // Right Key
     {
-        #ifdef DEBUG_PLAYER
-            mgba_printf(MGBA_LOG_INFO, "pressed RIGHT");
-        #endif
+        logEvent(LOG_PLAYER, MGBA_LOG_INFO, "pressed RIGHT");
 
-        // If player walking right doesn't fail
-        if (entityWalk(player, DIR_RIGHT))
-        {
-            playerSightId++;
-
-            playerMoveOffsetX = dirX[DIR_LEFT] * TILE_SIZE;
-            screenOffsetX += dirX[DIR_RIGHT] * TILE_SIZE;
-        }
+        // Walking into another entity attacks it, but only on a fresh press
+        if (!KEY_EQ(key_hit, KI_RIGHT) || !entityAttack(PLAYER_INDEX, DIR_RIGHT))
+            entityWalk(PLAYER_INDEX, DIR_RIGHT);
     }
     else if ((KEY_EQ(key_hit, KI_UP) || KEY_EQ(key_held, KI_UP)) && !KEY_EQ(key_held, KI_A)) // Up Key
     {
-        #ifdef DEBUG_PLAYER
-            mgba_printf(MGBA_LOG_INFO, "pressed UP");
-        #endif
-
-        // If player walking up doesn't fail
-        if (entityWalk(player, DIR_UP))
-        {
-            playerSightId++;
+        logEvent(LOG_PLAYER, MGBA_LOG_INFO, "pressed UP");
 
-            playerMoveOffsetY = dirY[DIR_DOWN] * TILE_SIZE;
-            screenOffsetY += dirY[DIR_UP] * TILE_SIZE;
-        }
+        // Walking into another entity attacks it, but only on a fresh press
+        if (!KEY_EQ(key_hit, KI_UP) || !entityAttack(PLAYER_INDEX, DIR_UP))
+            entityWalk(PLAYER_INDEX, DIR_UP);
     }
     else if ((KEY_EQ(key_hit, KI_DOWN) || KEY_EQ(key_held, KI_DOWN)) && !KEY_EQ(key_held, KI_A)) // Down Key
     {
-        #ifdef DEBUG_PLAYER
-            mgba_printf(MGBA_LOG_INFO, "pressed DOWN");
-        #endif
-
-        // If player walking down doesn't fail
-        if (entityWalk(player, DIR_DOWN))
-        {
-            playerSightId++;
+        logEvent(LOG_PLAYER, MGBA_LOG_INFO, "pressed DOWN");
 
-            playerMoveOffsetY = dirY[DIR_UP] * TILE_SIZE;
-            screenOffsetY += dirY[DIR_DOWN] * TILE_SIZE;
-        }
+        // Walking into another entity attacks it, but only on a fresh press
+        if (!KEY_EQ(key_hit, KI_DOWN) || !entityAttack(PLAYER_INDEX, DIR_DOWN))
+            entityWalk(PLAYER_INDEX, DIR_DOWN);
     }
     if (KEY_EQ(key_held, KI_A))
     {
         // Player may change facing direction without using turn
         if (KEY_EQ(key_hit, KI_LEFT))
-            setEntityFacing(player, DIR_LEFT);
+            setEntityFacing(PLAYER_INDEX, DIR_LEFT);
         else if (KEY_EQ(key_hit, KI_RIGHT))
-            setEntityFacing(player, DIR_RIGHT);
+            setEntityFacing(PLAYER_INDEX, DIR_RIGHT);
         else if (KEY_EQ(key_hit, KI_UP))
-            setEntityFacing(player, DIR_UP);
+            setEntityFacing(PLAYER_INDEX, DIR_UP);
         else if (KEY_EQ(key_hit, KI_DOWN))
-            setEntityFacing(player, DIR_DOWN);
+            setEntityFacing(PLAYER_INDEX, DIR_DOWN);
     }
     if (KEY_EQ(key_hit, KI_B))
     {
-        #ifdef DEBUG_PLAYER
-            mgba_printf(MGBA_LOG_INFO, "pressed B");
-        #endif
+        logEvent(LOG_PLAYER, MGBA_LOG_INFO, "pressed B");
 
-        entityEarthBend(player);
-        playerSightId++;
+        entityEarthBend(PLAYER_INDEX);
     }
     if (KEY_EQ(key_hit, KI_SELECT))
     {
-        #ifdef DEBUG_PLAYER
-            mgba_printf(MGBA_LOG_INFO, "pressed SELECT");
-        #endif
+        logEvent(LOG_PLAYER, MGBA_LOG_INFO, "pressed SELECT");
         doStateTransition(STATE_TITLE_SCREEN);
     }
     if (KEY_EQ(key_hit, KI_START))
     {
-        #ifdef DEBUG_PLAYER
-            mgba_printf(MGBA_LOG_INFO, "pressed START");
-        #endif
+        logEvent(LOG_PLAYER, MGBA_LOG_INFO, "pressed START");
         doStateTransition(STATE_MENU);
     }
     if (KEY_EQ(key_hit, KI_R))
     {
-        
+        logEvent(LOG_PLAYER, MGBA_LOG_INFO, "pressed R");
+        togglePerfOverlay();
     }
     if (KEY_EQ(key_hit, KI_L))
     {
-        
+        int stairsX = 0, stairsY = 0;
+
+        logEvent(LOG_PLAYER, MGBA_LOG_INFO, "pressed L");
+
+        getStairsPosition(&stairsX, &stairsY);
+        startPathSearch(entityPool.posX[PLAYER_INDEX], entityPool.posY[PLAYER_INDEX], stairsX, stairsY);
+        isPlayerAutoTraveling = TRUE;
+    }
+}
+
+//------------------------------------------------------------------
+// Function: benchmarkEntityTurns
+// 
+// Fills the pool to increasing entity counts and times a turn sweep
+// over the active list, in which every entity steps in its facing
+// direction or turns if blocked by a wall or another entity. The
+// extra entities are despawned and the originals put back afterwards.
+//------------------------------------------------------------------
+#ifdef DEBUG_BENCHMARK
+extern void benchmarkEntityTurns()
+{
+    static struct EntityPool savedPool EWRAM_BSS;
+    static EntityHandle savedOccupancyMap[MAP_HEIGHT_TILES][MAP_WIDTH_TILES] EWRAM_BSS;
+    int const turnsPerCount = 8;
+
+    memcpy(&savedPool, &entityPool, sizeof(entityPool));
+    memcpy(savedOccupancyMap, occupancyMap, sizeof(occupancyMap));
+
+    for (int targetCount = 16; targetCount <= NUM_MAX_ENTITIES; targetCount *= 2)
+    {
+        uint cycles = 0;
+
+        while (getEntityCount() < targetCount)
+        {
+            int positionX = randomInRange(1, MAP_WIDTH_TILES - 2);
+            int positionY = randomInRange(1, MAP_HEIGHT_TILES - 2);
+
+            if (!isSolid(positionX, positionY))
+                spawnEntity(positionX, positionY); // Fails on occupied tiles
+        }
+
+        profile_start();
+        for (int turn = 0; turn < turnsPerCount; turn++)
+        {
+            for (int i = 0; i < entityPool.activeCount; i++)
+            {
+                int index = entityPool.activeList[i];
+                int targetX = entityPool.posX[index] + dirX[entityPool.facing[index]];
+                int targetY = entityPool.posY[index] + dirY[entityPool.facing[index]];
+
+                if (isSolid(targetX, targetY) || isTileOccupied(targetX, targetY))
+                {
+                    entityPool.facing[index] = entityPool.facing[index] % DIR_DOWN + 1;
+                    entityPool.lastAction[index] = NO_ACTION;
+                }
+                else
+                {
+                    occupancyMap[entityPool.posY[index]][entityPool.posX[index]] = ENTITY_HANDLE_NULL;
+                    occupancyMap[targetY][targetX] = getEntityHandle(index);
+                    entityPool.posX[index] = targetX;
+                    entityPool.posY[index] = targetY;
+                    entityPool.lastAction[index] = WALKED_LEFT + entityPool.facing[index] - DIR_LEFT;
+                }
+            }
+        }
+        cycles = profile_stop() / turnsPerCount;
+
+        mgba_printf(MGBA_LOG_INFO, "benchmarkEntityTurns: %d entities, %d cycles per turn, %d per entity",
+            targetCount, cycles, cycles / targetCount);
     }
+
+    memcpy(&entityPool, &savedPool, sizeof(entityPool));
+    memcpy(occupancyMap, savedOccupancyMap, sizeof(occupancyMap));
 }
+#endif
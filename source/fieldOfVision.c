@@ -6,29 +6,111 @@
 #include "entity.h"
 #include "fieldOfVision.h"
 #include "globals.h"
+#include "lighting.h"
+#include "logBuffer.h"
+#include "mapGeneration.h"
 #include "mgba.h"
+#include "perfOverlay.h"
 #include "tile.h"
 
+//------------------------------------------------------------------
+// Data Structures
+//------------------------------------------------------------------
+struct Slope
+{
+    int numerator, denominator;             // denominator is kept > 0
+};
+
+struct FOVCacheEntry
+{
+    boolean isValid;
+    uint8_t positionX, positionY;
+    uint8_t sightRange;
+    uint8_t algorithm;
+    u32 terrainVersion;                     // getTerrainVersion() when stored
+    u32 lastUsed;
+    u32 visibleTiles[ENTITY_FOV_WORDS];    // Same window layout as EntityFOV
+};
+
+// One bit per tile, set if the tile blocks sight. Shared by every
+// entity's field-of-vision so the batch never touches gameMap.
+static u32 occluderMap[MAP_HEIGHT_TILES][OCCLUDER_WORDS_PER_ROW];
+static struct EntityFOV entityFOV[NUM_MAX_ENTITIES] EWRAM_BSS;
+static struct FOVCacheEntry fovCache[FOV_CACHE_SIZE];
+
+// Octant transforms for shadowcasting: xx, xy, yx, yy per octant
+static int8_t const octantTransform[4][8] =
+{
+    {1,  0,  0, -1, -1,  0,  0,  1},
+    {0,  1, -1,  0,  0, -1,  1,  0},
+    {0,  1,  1,  0,  0, -1, -1,  0},
+    {1,  0,  0,  1, -1,  0,  0, -1}
+};
+
+static char const *const fovAlgorithmNames[NUM_FOV_ALGORITHMS] =
+{
+    "Perimeter",
+    "Shadowcast",
+    "Permissive",
+    "Symmetric"
+};
+
+//------------------------------------------------------------------
+// Global Variables
+//------------------------------------------------------------------
+static unsigned int entityFOVBatchCount = 0;
+static u32 fovCacheClock = 0;               // Stamps lastUsed for LRU eviction
+static uint8_t lastComputedSightId = 0;
+static u32 fovCacheHits = 0, fovCacheMisses = 0;
+static u32 fovCacheHitCycles = 0, fovCacheMissCycles = 0;
+
 //------------------------------------------------------------------
 // Function Prototypes
 //------------------------------------------------------------------
-static void markLOS(int startX, int startY, int const endX, int const endY);
-static void drawFOV(int positionX, int positionY);
+IWRAM_ARM_CODE static void markLOS(int startX, int startY, int const endX, int const endY);
+IWRAM_ARM_CODE static void drawFOV(int positionX, int positionY);
 static void resetFOV();
+static void buildOccluderMap();
+static boolean isOccluder(int const positionX, int const positionY);
+static boolean isDiagonalOccluded(enum direction const direction, int const positionX, int const positionY);
+static void markEntityLOS(struct EntityFOV *fov, int const endX, int const endY);
+static void computeEntityFOV(struct EntityFOV *fov, int const positionX, int const positionY, int const sightRange);
+static void doPerimeterFOV(int const originX, int const originY, int const sightRange);
+static void doShadowcastFOV(int const originX, int const originY, int const sightRange);
+static void castShadowRow(int const originX, int const originY, int const row, struct Slope startSlope,
+    struct Slope const endSlope, int const sightRange, int const octant);
+static void doPermissiveFOV(int const originX, int const originY, int const sightRange);
+static void doSymmetricFOV(int const originX, int const originY, int const sightRange);
+static boolean isSlopeLess(struct Slope const slopeA, struct Slope const slopeB);
+static struct Slope makeSlope(int const numerator, int const denominator);
+static boolean applyCachedFOV(int const positionX, int const positionY, int const sightRange, u32 const terrainVersion);
+static void storeCachedFOV(int const positionX, int const positionY, int const sightRange, u32 const terrainVersion);
+
+// Indexed by enum fovAlgorithm
+static void (*const fovAlgorithms[NUM_FOV_ALGORITHMS])(int const, int const, int const) =
+{
+    doPerimeterFOV,
+    doShadowcastFOV,
+    doPermissiveFOV,
+    doSymmetricFOV
+};
 
 //------------------------------------------------------------------
 // Function: markLOS
 // 
-// Walks through a line using function getTileDirInline (which uses
-// Bresenham's algorithm) and marks all applicable tiles as in LOS.
+// Walks through a line using a LineIterator (Bresenham's algorithm)
+// and marks all applicable tiles as in LOS.
 //
 // Used only for showing the tiles visible to the player, as non-marked
 // tiles are shadow-blended.
 //------------------------------------------------------------------
-static void markLOS(int startX, int startY, int const endX, int const endY)
+IWRAM_ARM_CODE static void markLOS(int startX, int startY, int const endX, int const endY)
 {
     int currentX = startX, currentY = startY;
     enum direction direction = DIR_NULL;
+    struct LineIterator line;
+
+    initLineIterator(&line, startX, startY, endX, endY);
 
     while(1)
     {
@@ -58,7 +140,7 @@ static void markLOS(int startX, int startY, int const endX, int const endY)
             break;
 
         // Make the next tile on the line the current one
-        direction = getTileDirInLine(currentX, currentY, endX, endY);
+        direction = nextLineStep(&line);
         currentX += dirX[direction];
         currentY += dirY[direction];
     }
@@ -68,9 +150,11 @@ static void markLOS(int startX, int startY, int const endX, int const endY)
 // Function: drawFOV
 // 
 // Updates field-of-vision background layer by copying the correct
-// 8x8 graphic based on tile.sightId.
+// 8x8 graphic based on tile.sightId. Tiles out of sight but under a
+// bright light get the lighter tint; everything else keeps the usual
+// look.
 //------------------------------------------------------------------
-static void drawFOV(int playerX, int playerY)
+IWRAM_ARM_CODE static void drawFOV(int playerX, int playerY)
 {
     int screenEntryTL = 0;                     // screenEntryTopLeft
     int *tileToDraw = NULL;
@@ -87,6 +171,8 @@ static void drawFOV(int playerX, int playerY)
             // Get tileset index of tile to draw
             if (getTileSight(currentTileX, currentTileY) == playerSightId)
                 tileToDraw = (int*)TRANSPARENT;
+            else if (getTileLight(currentTileX, currentTileY) >= LIGHT_LEVEL_BRIGHT)
+                tileToDraw = (int*)FOV_TINT_LIGHT;
             else
                 tileToDraw = (int*)FOV_TINT_DARK;
 
@@ -103,9 +189,8 @@ static void drawFOV(int playerX, int playerY)
         currentTileX = originTileX;
         currentTileY++;
     }
-    #ifdef DEBUG_FOV
-        mgba_printf(MGBA_LOG_INFO, "FOV drawn");
-    #endif
+    vramWriteCount += SCREEN_WIDTH_TILES * SCREEN_HEIGHT_TILES * 4 * 2;
+    logMessage(LOG_FOV, MGBA_LOG_INFO, "FOV drawn");
 }
 
 //------------------------------------------------------------------
@@ -130,16 +215,128 @@ static void resetFOV()
     // Set playerSightId to new lowest value: TILE_IN_SIGHT(2)
     playerSightId = TILE_IN_SIGHT;
 
-    #ifdef DEBUG_FOV
-        mgba_printf(MGBA_LOG_INFO, "FOV reset");
-    #endif
+    logMessage(LOG_FOV, MGBA_LOG_INFO, "FOV reset");
+}
+
+//------------------------------------------------------------------
+// Function: buildOccluderMap
+// 
+// Rebuilds the whole occluder bitset from gameMap. Map generation
+// writes terrain directly, so this is done once per new map.
+//------------------------------------------------------------------
+static void buildOccluderMap()
+{
+    memset(occluderMap, 0, sizeof(occluderMap));
+
+    for (int y = 0; y < MAP_HEIGHT_TILES; y++)
+    {
+        for (int x = 0; x < MAP_WIDTH_TILES; x++)
+        {
+            if (isSolid(x, y))
+                occluderMap[y][x / 32] |= 1u << (x % 32);
+        }
+    }
+}
+
+//------------------------------------------------------------------
+// Function: isOccluder
+// 
+// Returns whether the tile at the given position blocks sight.
+// Positions outside the map always block sight.
+//------------------------------------------------------------------
+static boolean isOccluder(int const positionX, int const positionY)
+{
+    if (isOutOfBounds(positionX, positionY))
+        return TRUE;
+
+    return (occluderMap[positionY][positionX / 32] >> (positionX % 32)) & 1;
+}
+
+//------------------------------------------------------------------
+// Function: isDiagonalOccluded
+// 
+// Returns whether a line that moved diagonally onto the given open
+// tile squeezed between two occluders, the same case markLOS stops at.
+//------------------------------------------------------------------
+static boolean isDiagonalOccluded(enum direction const direction, int const positionX, int const positionY)
+{
+    if (dirX[direction] == 0 || dirY[direction] == 0)
+        return FALSE;
+
+    return !isOccluder(positionX, positionY)
+        && isOccluder(positionX - dirX[direction], positionY)
+        && isOccluder(positionX, positionY - dirY[direction]);
+}
+
+//------------------------------------------------------------------
+// Function: markEntityLOS
+// 
+// Walks a line from the origin of the given entity FOV to the end
+// position, setting the bit of every tile seen in the FOV's bitset.
+//------------------------------------------------------------------
+static void markEntityLOS(struct EntityFOV *fov, int const endX, int const endY)
+{
+    int currentX = fov->originX, currentY = fov->originY;
+    enum direction direction = DIR_NULL;
+    struct LineIterator line;
+
+    initLineIterator(&line, currentX, currentY, endX, endY);
+
+    while(1)
+    {
+        int bitIndex = (currentY - fov->originY + SIGHT_RANGE_MAX) * ENTITY_FOV_WIDTH
+                     + (currentX - fov->originX + SIGHT_RANGE_MAX);
+
+        if (isDiagonalOccluded(direction, currentX, currentY))
+            break;
+
+        fov->visibleTiles[bitIndex / 32] |= 1u << (bitIndex % 32);
+
+        if ((currentX == endX && currentY == endY) || isOccluder(currentX, currentY))
+            break;
+
+        // Make the next tile on the line the current one
+        direction = nextLineStep(&line);
+        currentX += dirX[direction];
+        currentY += dirY[direction];
+    }
+}
+
+//------------------------------------------------------------------
+// Function: computeEntityFOV
+// 
+// Fills the given entity FOV by casting lines to every tile on the
+// boundary of the sight range, the same way doFOV does for the player.
+//------------------------------------------------------------------
+static void computeEntityFOV(struct EntityFOV *fov, int const positionX, int const positionY, int const sightRange)
+{
+    int range = clamp(sightRange, SIGHT_RANGE_SELF, SIGHT_RANGE_MAX + 1);
+
+    fov->originX = positionX;
+    fov->originY = positionY;
+    fov->sightRange = range;
+    memset(fov->visibleTiles, 0, sizeof(fov->visibleTiles));
+
+    // Top and bottom boundaries
+    for (int x = positionX - range; x <= positionX + range; x++)
+    {
+        markEntityLOS(fov, x, positionY - range);
+        markEntityLOS(fov, x, positionY + range);
+    }
+
+    // Left and right boundaries
+    for (int y = positionY - range; y <= positionY + range; y++)
+    {
+        markEntityLOS(fov, positionX - range, y);
+        markEntityLOS(fov, positionX + range, y);
+    }
 }
 
 //------------------------------------------------------------------
 // Function: initFOV
 // 
 // Initialize field-of-vision background layer by filling with black
-// 8x8 graphic tiles.
+// 8x8 graphic tiles, and clears the entity FOV state of the last floor.
 //------------------------------------------------------------------
 extern void initFOV()
 {
@@ -152,20 +349,25 @@ extern void initFOV()
             memcpy(&se_mem[FOV_SB][y * SCREEN_BLOCK_SIZE + x], &tileToDraw, 2);
         }
     }
+    vramWriteCount += SCREEN_BLOCK_SIZE * SCREEN_BLOCK_SIZE * 2;
+
+    buildOccluderMap();
+    memset(entityFOV, 0, sizeof(entityFOV));
+    memset(fovCache, 0, sizeof(fovCache));
+
+    // Sleeping entities update on batches counted from here, so a replay
+    // wakes them on the same turns as the recorded game
+    entityFOVBatchCount = 0;
 }
 
 //------------------------------------------------------------------
-// Function: doFOV
+// Function: doPerimeterFOV
 // 
 // Performs a line-of-sight check on every bounding tile at the edge
 // of the player's sight range.
 //------------------------------------------------------------------
-extern void doFOV(int const playerX, int const playerY, int const playerSightRange)
+static void doPerimeterFOV(int const playerX, int const playerY, int const playerSightRange)
 {
-    // Check that playerSightId is about to overflow
-    if (playerSightId == 255)
-        resetFOV();
-
     // Top Boundary
     for (int x = playerX - playerSightRange; x <= playerX + playerSightRange; x++)
         markLOS(playerX, playerY, x, playerY - playerSightRange);
@@ -181,20 +383,357 @@ extern void doFOV(int const playerX, int const playerY, int const playerSightRan
     // Right Boundary
     for (int y = playerY - playerSightRange; y <= playerY + playerSightRange; y++)
         markLOS(playerX, playerY, playerX + playerSightRange, y);
+}
+
+//------------------------------------------------------------------
+// Function: makeSlope
+// 
+// Returns the slope numerator / denominator with a positive
+// denominator so slopes can be compared by cross-multiplying.
+//------------------------------------------------------------------
+static struct Slope makeSlope(int const numerator, int const denominator)
+{
+    struct Slope slope = {numerator, denominator};
+
+    if (denominator < 0)
+    {
+        slope.numerator = -numerator;
+        slope.denominator = -denominator;
+    }
+
+    return slope;
+}
+
+//------------------------------------------------------------------
+// Function: isSlopeLess
+// 
+// Returns whether slopeA is less than slopeB.
+//------------------------------------------------------------------
+static boolean isSlopeLess(struct Slope const slopeA, struct Slope const slopeB)
+{
+    return slopeA.numerator * slopeB.denominator < slopeB.numerator * slopeA.denominator;
+}
+
+//------------------------------------------------------------------
+// Function: castShadowRow
+// 
+// Recursive shadowcasting of a single octant, starting at the given
+// row. Slopes are kept as integer fractions of half-tile offsets so no
+// division is needed.
+//------------------------------------------------------------------
+static void castShadowRow(int const originX, int const originY, int const row, struct Slope startSlope,
+    struct Slope const endSlope, int const sightRange, int const octant)
+{
+    int xx = octantTransform[0][octant], xy = octantTransform[1][octant];
+    int yx = octantTransform[2][octant], yy = octantTransform[3][octant];
+    struct Slope newStart = startSlope;
+
+    if (isSlopeLess(startSlope, endSlope))
+        return;
+
+    for (int j = row; j <= sightRange; j++)
+    {
+        int deltaY = -j;
+        boolean blocked = FALSE;
+
+        for (int deltaX = -j; deltaX <= 0; deltaX++)
+        {
+            int currentX = originX + deltaX * xx + deltaY * xy;
+            int currentY = originY + deltaX * yx + deltaY * yy;
+            struct Slope leftSlope = makeSlope(2 * deltaX - 1, 2 * deltaY + 1);
+            struct Slope rightSlope = makeSlope(2 * deltaX + 1, 2 * deltaY - 1);
+
+            if (isSlopeLess(startSlope, rightSlope))
+                continue;
+            else if (isSlopeLess(leftSlope, endSlope))
+                break;
+
+            setTileSight(currentX, currentY, playerSightId);
+
+            if (blocked)
+            {
+                if (isOccluder(currentX, currentY))
+                {
+                    newStart = rightSlope;
+                    continue;
+                }
+                blocked = FALSE;
+                startSlope = newStart;
+            }
+            else if (isOccluder(currentX, currentY) && j < sightRange)
+            {
+                blocked = TRUE;
+                castShadowRow(originX, originY, j + 1, startSlope, leftSlope, sightRange, octant);
+                newStart = rightSlope;
+            }
+        }
+
+        if (blocked)
+            break;
+    }
+}
+
+//------------------------------------------------------------------
+// Function: doShadowcastFOV
+// 
+// Recursive shadowcasting over all eight octants of a square sight
+// range. Each tile is visited at most once per octant.
+//------------------------------------------------------------------
+static void doShadowcastFOV(int const originX, int const originY, int const sightRange)
+{
+    setTileSight(originX, originY, playerSightId);
+
+    for (int octant = 0; octant < 8; octant++)
+        castShadowRow(originX, originY, 1, makeSlope(1, 1), makeSlope(0, 1), sightRange, octant);
+}
+
+//------------------------------------------------------------------
+// Function: isLineClear
+// 
+// Walks the Bresenham line between two positions and returns whether
+// sight passes through it. Only the tiles between the endpoints may
+// block, so walls at either end are still seen.
+//------------------------------------------------------------------
+extern boolean isLineClear(int const startX, int const startY, int const endX, int const endY)
+{
+    int currentX = startX, currentY = startY;
+    enum direction direction = DIR_NULL;
+    struct LineIterator line;
+
+    initLineIterator(&line, startX, startY, endX, endY);
+
+    while (currentX != endX || currentY != endY)
+    {
+        direction = nextLineStep(&line);
+        currentX += dirX[direction];
+        currentY += dirY[direction];
+
+        if (isDiagonalOccluded(direction, currentX, currentY))
+            return FALSE;
+        if ((currentX != endX || currentY != endY) && isOccluder(currentX, currentY))
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+//------------------------------------------------------------------
+// Function: doPermissiveFOV
+// 
+// Marks every tile in the sight range that has a clear line to the
+// origin in either direction.
+//------------------------------------------------------------------
+static void doPermissiveFOV(int const originX, int const originY, int const sightRange)
+{
+    for (int y = originY - sightRange; y <= originY + sightRange; y++)
+    {
+        for (int x = originX - sightRange; x <= originX + sightRange; x++)
+        {
+            if (isLineClear(originX, originY, x, y) || isLineClear(x, y, originX, originY))
+                setTileSight(x, y, playerSightId);
+        }
+    }
+}
+
+//------------------------------------------------------------------
+// Function: doSymmetricFOV
+// 
+// Marks every tile in the sight range whose line is clear in both
+// directions, so a tile is seen exactly when it could see the origin.
+//------------------------------------------------------------------
+static void doSymmetricFOV(int const originX, int const originY, int const sightRange)
+{
+    for (int y = originY - sightRange; y <= originY + sightRange; y++)
+    {
+        for (int x = originX - sightRange; x <= originX + sightRange; x++)
+        {
+            if (isLineClear(originX, originY, x, y) && isLineClear(x, y, originX, originY))
+                setTileSight(x, y, playerSightId);
+        }
+    }
+}
+
+//------------------------------------------------------------------
+// Function: applyCachedFOV
+// 
+// Looks for a cached FOV matching the given position, sight range,
+// algorithm and terrain version. On a hit, marks the cached tiles as
+// in sight and returns TRUE.
+//------------------------------------------------------------------
+static boolean applyCachedFOV(int const positionX, int const positionY, int const sightRange, u32 const terrainVersion)
+{
+    for (int index = 0; index < FOV_CACHE_SIZE; index++)
+    {
+        struct FOVCacheEntry *entry = &fovCache[index];
+
+        if (entry->isValid == FALSE || entry->positionX != positionX || entry->positionY != positionY
+        || entry->sightRange != sightRange || entry->algorithm != fovAlgorithm
+        || entry->terrainVersion != terrainVersion)
+            continue;
+
+        for (int bitIndex = 0; bitIndex < ENTITY_FOV_WIDTH * ENTITY_FOV_WIDTH; bitIndex++)
+        {
+            if ((entry->visibleTiles[bitIndex / 32] >> (bitIndex % 32)) & 1)
+                setTileSight(positionX + bitIndex % ENTITY_FOV_WIDTH - SIGHT_RANGE_MAX,
+                             positionY + bitIndex / ENTITY_FOV_WIDTH - SIGHT_RANGE_MAX, playerSightId);
+        }
+
+        entry->lastUsed = ++fovCacheClock;
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+//------------------------------------------------------------------
+// Function: storeCachedFOV
+// 
+// Packs the tiles just marked in sight around the given position into
+// the least recently used cache entry.
+//------------------------------------------------------------------
+static void storeCachedFOV(int const positionX, int const positionY, int const sightRange, u32 const terrainVersion)
+{
+    struct FOVCacheEntry *entry = &fovCache[0];
+
+    for (int index = 1; index < FOV_CACHE_SIZE; index++)
+    {
+        if (fovCache[index].isValid == FALSE || fovCache[index].lastUsed < entry->lastUsed)
+            entry = &fovCache[index];
+        if (entry->isValid == FALSE)
+            break;
+    }
+
+    entry->isValid = TRUE;
+    entry->positionX = positionX;
+    entry->positionY = positionY;
+    entry->sightRange = sightRange;
+    entry->algorithm = fovAlgorithm;
+    entry->terrainVersion = terrainVersion;
+    entry->lastUsed = ++fovCacheClock;
+    memset(entry->visibleTiles, 0, sizeof(entry->visibleTiles));
+
+    for (int y = -sightRange; y <= sightRange; y++)
+    {
+        for (int x = -sightRange; x <= sightRange; x++)
+        {
+            int bitIndex = (y + SIGHT_RANGE_MAX) * ENTITY_FOV_WIDTH + x + SIGHT_RANGE_MAX;
+
+            if (getTileSight(positionX + x, positionY + y) == playerSightId)
+                entry->visibleTiles[bitIndex / 32] |= 1u << (bitIndex % 32);
+        }
+    }
+}
+
+//------------------------------------------------------------------
+// Function: doFOV
+// 
+// Marks the tiles visible from the player's position, then redraws
+// the FOV layer. Recently computed results are reused when the player
+// returns to a position whose surroundings haven't changed; otherwise
+// the currently selected FOV algorithm is run.
+//------------------------------------------------------------------
+extern void doFOV(int const playerX, int const playerY, int const playerSightRange)
+{
+    int sightRange = clamp(playerSightRange, SIGHT_RANGE_SELF, SIGHT_RANGE_MAX + 1);
+    u32 terrainVersion = getTerrainVersion(playerX, playerY, sightRange + 1);
+    boolean isCacheHit = FALSE;
+
+    // Check that playerSightId is about to overflow
+    if (playerSightId == 255)
+        resetFOV();
+
+    #ifdef DEBUG_BENCHMARK
+        profile_start();
+    #endif
+
+    isCacheHit = applyCachedFOV(playerX, playerY, sightRange, terrainVersion);
+    if (isCacheHit == FALSE)
+    {
+        fovAlgorithms[fovAlgorithm](playerX, playerY, sightRange);
+
+        // A repeated doFOV without a new playerSightId leaves the old marks
+        // in place, so only a fresh sightId gives a clean result to store
+        if (playerSightId != lastComputedSightId)
+            storeCachedFOV(playerX, playerY, sightRange, terrainVersion);
+    }
+    lastComputedSightId = playerSightId;
+
+    #ifdef DEBUG_BENCHMARK
+        if (isCacheHit)
+            fovCacheHitCycles += profile_stop();
+        else
+            fovCacheMissCycles += profile_stop();
+    #endif
+
+    if (isCacheHit)
+        fovCacheHits++;
+    else
+        fovCacheMisses++;
 
     drawFOV(playerX, playerY);
 }
 
+//------------------------------------------------------------------
+// Function: printFOVCacheStats
+// 
+// Logs the FOV cache hit rate and, in benchmark builds, the cycles it
+// saved compared to recomputing every hit.
+//------------------------------------------------------------------
+extern void printFOVCacheStats()
+{
+    u32 lookups = fovCacheHits + fovCacheMisses;
+
+    logMessage(LOG_GENERAL, MGBA_LOG_INFO, "FOV cache: %d hits, %d misses, %d%% hit rate",
+        fovCacheHits, fovCacheMisses, (lookups == 0) ? 0 : fovCacheHits * 100 / lookups);
+
+    #ifdef DEBUG_BENCHMARK
+        if (fovCacheHits > 0 && fovCacheMisses > 0)
+        {
+            u32 hitCost = fovCacheHitCycles / fovCacheHits, missCost = fovCacheMissCycles / fovCacheMisses;
+
+            mgba_printf(MGBA_LOG_INFO, "  %d cycles per hit, %d per miss, %d cycles saved",
+                hitCost, missCost, (missCost > hitCost) ? (missCost - hitCost) * fovCacheHits : 0);
+        }
+    #endif
+}
+
+//------------------------------------------------------------------
+// Function: resetFOVCacheStats
+// 
+// Zeroes the hit and miss counts and cycles behind
+// printFOVCacheStats. The cached results are kept.
+//------------------------------------------------------------------
+extern void resetFOVCacheStats()
+{
+    fovCacheHits = 0;
+    fovCacheMisses = 0;
+    fovCacheHitCycles = 0;
+    fovCacheMissCycles = 0;
+}
+
+//------------------------------------------------------------------
+// Function: getFOVAlgorithmName
+// 
+// Returns the display name of the given FOV algorithm.
+//------------------------------------------------------------------
+extern char const* getFOVAlgorithmName(enum fovAlgorithm const algorithm)
+{
+    return fovAlgorithmNames[algorithm];
+}
+
 //------------------------------------------------------------------
 // Function: checkLOS
 // 
-// Walks through a line using function getTileDirInline (which uses
-// Bresenham's algorithm) and returns FALSE if any tiles block sight.
+// Walks through a line using a LineIterator (Bresenham's algorithm)
+// and returns FALSE if any tiles block sight.
 //------------------------------------------------------------------
 extern boolean checkLOS(int startX, int startY, int const endX, int const endY)
 {
     int currentX = startX, currentY = startY;
     enum direction direction = DIR_NULL;
+    struct LineIterator line;
+
+    initLineIterator(&line, startX, startY, endX, endY);
 
     while(1)
     {
@@ -223,10 +762,310 @@ extern boolean checkLOS(int startX, int startY, int const endX, int const endY)
             break;
 
         // Make the next tile on the line the current one
-        direction = getTileDirInLine(currentX, currentY, endX, endY);
+        direction = nextLineStep(&line);
         currentX += dirX[direction];
         currentY += dirY[direction];
     }
     // Should only return TRUE if loop reached end position without being solid
     return TRUE;
 }
+
+//------------------------------------------------------------------
+// Function: updateOccluder
+// 
+// Refreshes the occluder bit of the tile at the given position. Called
+// whenever a tile's terrain changes.
+//------------------------------------------------------------------
+extern void updateOccluder(int const positionX, int const positionY)
+{
+    if (isOutOfBounds(positionX, positionY))
+        return;
+
+    if (isSolid(positionX, positionY))
+        occluderMap[positionY][positionX / 32] |= 1u << (positionX % 32);
+    else
+        occluderMap[positionY][positionX / 32] &= ~(1u << (positionX % 32));
+}
+
+//------------------------------------------------------------------
+// Function: doEntityFOVs
+// 
+// Computes the field-of-vision of every non-player entity in the
+// active sectors in a single pass over the shared occluder map.
+// Dormant entities in other sectors are never visited. Awake entities
+// near the player update every batch, while sleeping or far-off
+// entities are staggered to update once every ENTITY_FOV_SLEEP_INTERVAL
+// batches.
+//------------------------------------------------------------------
+extern void doEntityFOVs()
+{
+    int playerX = entityPool.posX[PLAYER_INDEX], playerY = entityPool.posY[PLAYER_INDEX];
+
+    entityFOVBatchCount++;
+
+    for (int sector = 0; sector < NUM_MAP_SECTORS; sector++)
+    {
+        if (!entityPool.isSectorActive[sector])
+            continue;
+
+        for (uint16_t index = entityPool.sectorHead[sector]; index != ENTITY_INDEX_NULL; index = entityPool.nextInSector[index])
+        {
+            int distance = MAX(ABS(entityPool.posX[index] - playerX), ABS(entityPool.posY[index] - playerY));
+
+            // The player's sight is marked on gameMap by doFOV instead
+            if (index == PLAYER_INDEX)
+                continue;
+
+            if ((entityPool.isAwake[index] == FALSE || distance > ENTITY_FOV_FAR_DISTANCE)
+            && (entityFOVBatchCount + index) % ENTITY_FOV_SLEEP_INTERVAL != 0)
+                continue;
+
+            computeEntityFOV(&entityFOV[index], entityPool.posX[index], entityPool.posY[index], entityPool.sightRange[index]);
+        }
+    }
+
+    logMessage(LOG_FOV, MGBA_LOG_INFO, "entity FOVs done, batch %d", entityFOVBatchCount);
+}
+
+//------------------------------------------------------------------
+// Function: canEntitySee
+// 
+// Returns whether the given entity saw the given position during its
+// last field-of-vision update.
+//------------------------------------------------------------------
+extern boolean canEntitySee(int const entityIndex, int const positionX, int const positionY)
+{
+    struct EntityFOV *fov = &entityFOV[entityIndex];
+    int localX = positionX - fov->originX, localY = positionY - fov->originY;
+    int bitIndex = 0;
+
+    if (ABS(localX) > fov->sightRange || ABS(localY) > fov->sightRange)
+        return FALSE;
+
+    bitIndex = (localY + SIGHT_RANGE_MAX) * ENTITY_FOV_WIDTH + (localX + SIGHT_RANGE_MAX);
+
+    return (fov->visibleTiles[bitIndex / 32] >> (bitIndex % 32)) & 1;
+}
+
+//------------------------------------------------------------------
+// Function: benchmarkEntityFOVs
+// 
+// Times repeated entity field-of-vision batches with every entity
+// forced to update and logs the throughput in entity-FOVs per frame.
+//------------------------------------------------------------------
+#ifdef DEBUG_BENCHMARK
+extern void benchmarkEntityFOVs()
+{
+    int const iterations = 16;
+    int fovCount = 0;
+    uint cycles = 0;
+
+    profile_start();
+    for (int iteration = 0; iteration < iterations; iteration++)
+    {
+        for (int i = 0; i < entityPool.activeCount; i++)
+        {
+            int index = entityPool.activeList[i];
+
+            computeEntityFOV(&entityFOV[index], entityPool.posX[index], entityPool.posY[index], entityPool.sightRange[index]);
+            fovCount++;
+        }
+    }
+    cycles = profile_stop();
+
+    mgba_printf(MGBA_LOG_INFO, "benchmarkEntityFOVs: %d FOVs in %d cycles", fovCount, cycles);
+    mgba_printf(MGBA_LOG_INFO, "  %d cycles per FOV, %d entity-FOVs per frame",
+        cycles / fovCount, CYCLES_PER_FRAME / (cycles / fovCount));
+
+    profile_start();
+    buildOccluderMap();
+    mgba_printf(MGBA_LOG_INFO, "  buildOccluderMap: %d cycles", profile_stop());
+}
+#endif
+
+//------------------------------------------------------------------
+// Function: compareFOVAlgorithms
+// 
+// Runs every FOV algorithm from random open positions on a series of
+// freshly generated maps, logging cycles per FOV and the number of
+// tiles where each algorithm disagrees with the perimeter algorithm.
+// The current gameMap, its stairs and its floor variants are restored
+// afterwards.
+//------------------------------------------------------------------
+#ifdef DEBUG_BENCHMARK
+extern void compareFOVAlgorithms()
+{
+    static struct Tile savedMap[MAP_HEIGHT_TILES][MAP_WIDTH_TILES] EWRAM_BSS;
+    int const mapCount = 8, positionsPerMap = 16, range = SIGHT_RANGE_MAX;
+    uint totalCycles[NUM_FOV_ALGORITHMS] = {0};
+    int disagreements[NUM_FOV_ALGORITHMS] = {0};
+    int fovCount = 0;
+    uint8_t savedSightId = playerSightId;
+    u32 savedRandomState = getRandomState();
+    u32 savedVariantSeed = getFloorVariantSeed();
+    int stairsX = 0, stairsY = 0, upStairsX = 0, upStairsY = 0;
+
+    memcpy(savedMap, gameMap, sizeof(gameMap));
+    getStairsPosition(&stairsX, &stairsY);
+    getUpStairsPosition(&upStairsX, &upStairsY);
+
+    for (int map = 0; map < mapCount; map++)
+    {
+        seedRandom(randomSeed + map + 1);
+        generateGameMap();
+        buildOccluderMap();
+        playerSightId = TILE_IN_SIGHT;
+
+        for (int i = 0; i < positionsPerMap; i++)
+        {
+            u32 visible[NUM_FOV_ALGORITHMS][ENTITY_FOV_WORDS];
+            int positionX = 0, positionY = 0;
+
+            do
+            {
+                positionX = randomInRange(1, MAP_WIDTH_TILES - 2);
+                positionY = randomInRange(1, MAP_HEIGHT_TILES - 2);
+            } while (isSolid(positionX, positionY));
+
+            for (int algorithm = 0; algorithm < NUM_FOV_ALGORITHMS; algorithm++)
+            {
+                if (playerSightId == 255)
+                    resetFOV();
+                playerSightId++;
+
+                profile_start();
+                fovAlgorithms[algorithm](positionX, positionY, range);
+                totalCycles[algorithm] += profile_stop();
+
+                // Collect the marked tiles into a bitset around the position
+                memset(visible[algorithm], 0, sizeof(visible[algorithm]));
+                for (int bitIndex = 0; bitIndex < ENTITY_FOV_WIDTH * ENTITY_FOV_WIDTH; bitIndex++)
+                {
+                    int x = positionX + bitIndex % ENTITY_FOV_WIDTH - SIGHT_RANGE_MAX;
+                    int y = positionY + bitIndex / ENTITY_FOV_WIDTH - SIGHT_RANGE_MAX;
+
+                    if (getTileSight(x, y) == playerSightId)
+                        visible[algorithm][bitIndex / 32] |= 1u << (bitIndex % 32);
+                }
+
+                for (int wordIndex = 0; wordIndex < ENTITY_FOV_WORDS; wordIndex++)
+                {
+                    u32 difference = visible[algorithm][wordIndex] ^ visible[FOV_PERIMETER_BRESENHAM][wordIndex];
+
+                    while (difference != 0)
+                    {
+                        disagreements[algorithm]++;
+                        difference &= difference - 1;
+                    }
+                }
+            }
+            fovCount++;
+        }
+    }
+
+    mgba_printf(MGBA_LOG_INFO, "compareFOVAlgorithms: %d maps, %d FOVs each, range %d", mapCount, fovCount, range);
+    for (int algorithm = 0; algorithm < NUM_FOV_ALGORITHMS; algorithm++)
+    {
+        mgba_printf(MGBA_LOG_INFO, "  %s: %d cycles per FOV, %d tiles differ from %s",
+            fovAlgorithmNames[algorithm], totalCycles[algorithm] / fovCount,
+            disagreements[algorithm], fovAlgorithmNames[FOV_PERIMETER_BRESENHAM]);
+    }
+
+    // Put the game back the way it was
+    memcpy(gameMap, savedMap, sizeof(gameMap));
+    buildOccluderMap();
+    setStairsPosition(stairsX, stairsY);
+    setUpStairsPosition(upStairsX, upStairsY);
+    setFloorVariantSeed(savedVariantSeed);
+    playerSightId = savedSightId;
+    setRandomState(savedRandomState);
+}
+#endif
+
+//------------------------------------------------------------------
+// Function: saveFOVState
+// 
+// Sets aside the entity FOVs, the FOV cache and the batch count, so a
+// benchmark that goes through initFOV can put them back afterwards
+// with restoreFOVState.
+//------------------------------------------------------------------
+#ifdef DEBUG_BENCHMARK
+static struct EntityFOV savedEntityFOV[NUM_MAX_ENTITIES] EWRAM_BSS;
+static struct FOVCacheEntry savedFOVCache[FOV_CACHE_SIZE] EWRAM_BSS;
+static unsigned int savedEntityFOVBatchCount = 0;
+static u32 savedFOVCacheClock = 0;
+
+extern void saveFOVState()
+{
+    memcpy(savedEntityFOV, entityFOV, sizeof(entityFOV));
+    memcpy(savedFOVCache, fovCache, sizeof(fovCache));
+    savedEntityFOVBatchCount = entityFOVBatchCount;
+    savedFOVCacheClock = fovCacheClock;
+}
+
+//------------------------------------------------------------------
+// Function: restoreFOVState
+// 
+// Puts back what saveFOVState set aside and rebuilds the occluders,
+// so gameMap must already be as it was when the state was saved.
+//------------------------------------------------------------------
+extern void restoreFOVState()
+{
+    memcpy(entityFOV, savedEntityFOV, sizeof(entityFOV));
+    memcpy(fovCache, savedFOVCache, sizeof(fovCache));
+    entityFOVBatchCount = savedEntityFOVBatchCount;
+    fovCacheClock = savedFOVCacheClock;
+    buildOccluderMap();
+}
+#endif
+
+//------------------------------------------------------------------
+// Function: benchmarkFOVKernels
+// 
+// Times the IWRAM_ARM_CODE kernels of this file: markLOS over every
+// perimeter line of a full sight range, and a full drawFOV of the
+// screen. Logs which memory they ran from, so builds with and without
+// IWRAM_KERNELS can be compared. The map's sight is put back and the
+// FOV layer redrawn afterwards.
+//------------------------------------------------------------------
+#ifdef DEBUG_BENCHMARK
+extern void benchmarkFOVKernels()
+{
+    static struct Tile savedMap[MAP_HEIGHT_TILES][MAP_WIDTH_TILES] EWRAM_BSS;
+    int const iterations = 16, range = SIGHT_RANGE_MAX;
+    int playerX = entityPool.posX[PLAYER_INDEX], playerY = entityPool.posY[PLAYER_INDEX];
+    int lineCount = 0;
+    uint losCycles = 0, drawCycles = 0;
+
+    memcpy(savedMap, gameMap, sizeof(gameMap));
+
+    profile_start();
+    for (int i = 0; i < iterations; i++)
+    {
+        for (int offset = -range; offset <= range; offset++)
+        {
+            markLOS(playerX, playerY, playerX + offset, playerY - range);
+            markLOS(playerX, playerY, playerX + offset, playerY + range);
+            markLOS(playerX, playerY, playerX - range, playerY + offset);
+            markLOS(playerX, playerY, playerX + range, playerY + offset);
+            lineCount += 4;
+        }
+    }
+    losCycles = profile_stop();
+
+    memcpy(gameMap, savedMap, sizeof(gameMap));
+
+    profile_start();
+    for (int i = 0; i < iterations; i++)
+        drawFOV(playerX, playerY);
+    drawCycles = profile_stop();
+
+    #ifdef IWRAM_KERNELS
+        mgba_printf(MGBA_LOG_INFO, "benchmarkFOVKernels: IWRAM ARM");
+    #else
+        mgba_printf(MGBA_LOG_INFO, "benchmarkFOVKernels: ROM Thumb");
+    #endif
+    mgba_printf(MGBA_LOG_INFO, "  markLOS: %d cycles per line, range %d", losCycles / lineCount, range);
+    mgba_printf(MGBA_LOG_INFO, "  drawFOV: %d cycles per screen", drawCycles / iterations);
+}
+#endif
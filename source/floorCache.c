@@ -0,0 +1,656 @@
+#include <string.h>
+#include "../libtonc/include/tonc.h"
+#include "constants.h"
+#include "arena.h"
+#include "debug.h"
+#include "entity.h"
+#include "fieldOfVision.h"
+#include "floorCache.h"
+#include "flowField.h"
+#include "globals.h"
+#include "lighting.h"
+#include "logBuffer.h"
+#include "mapCodec.h"
+#include "mapGeneration.h"
+#include "mgba.h"
+#include "senseField.h"
+#include "tile.h"
+
+//------------------------------------------------------------------
+// Data Structures
+//------------------------------------------------------------------
+// Encoded floors, packed from the start in the order they were stored
+static uint8_t cachePool[FLOOR_CACHE_SIZE] EWRAM_BSS ALIGN4;
+static struct CachedFloor cachedFloor[FLOOR_CACHE_MAX_FLOORS] EWRAM_BSS;
+
+//------------------------------------------------------------------
+// Global Variables
+//------------------------------------------------------------------
+static int cachedFloorCount = 0, cachePoolUsed = 0;
+static u32 runSeed = 0;                    // Every floor's seed derives from it
+static int currentDepth = 0, deepestDepth = 0;
+static u32 floorChanges = 0;
+
+// Tiles the player has changed on the current floor since it was
+// generated, as map indices, unless there were too many to list
+static u16 floorEdit[FLOOR_MAX_EDITS];
+static int floorEditCount = 0;
+static boolean isFloorEditListFull = FALSE;
+
+// Statistics on floor changes since start-up or resetFloorCacheStats
+static int deltaRestoreCount = 0, fullRestoreCount = 0, generateCount = 0, regenerateCount = 0, evictionCount = 0;
+static int deltaStoreCount = 0, fullStoreCount = 0;
+static u32 deltaRestoreCycles = 0, fullRestoreCycles = 0, generateCycles = 0;
+static u32 deltaStoredBytes = 0, fullStoredBytes = 0;
+
+//------------------------------------------------------------------
+// Function Prototypes
+//------------------------------------------------------------------
+static u32 getFloorSeed(int const depth);
+static int findCachedFloor(int const depth);
+static void removeCachedFloor(int const slot);
+static int encodeFloorRecord(uint8_t *buffer, int const capacity);
+static void generateFloor(int const depth);
+static boolean applyFloorDelta(uint8_t const *record, int const size);
+static boolean restoreFloor(int const depth, uint8_t const *record, int const size);
+static void storeCurrentFloor();
+static void enterFloor(int const depth, boolean const isArrivingFromAbove);
+
+//------------------------------------------------------------------
+// Function: getFloorSeed
+//
+// Returns the seed the given depth's map is generated from, so an
+// evicted floor comes back with the same layout.
+//------------------------------------------------------------------
+static u32 getFloorSeed(int const depth)
+{
+    return runSeed ^ ((depth + 1) * 0x9E3779B9u);
+}
+
+//------------------------------------------------------------------
+// Function: findCachedFloor
+//
+// Returns the cache slot holding the given depth, or -1.
+//------------------------------------------------------------------
+static int findCachedFloor(int const depth)
+{
+    for (int slot = 0; slot < cachedFloorCount; slot++)
+    {
+        if (cachedFloor[slot].depth == depth)
+            return slot;
+    }
+
+    return -1;
+}
+
+//------------------------------------------------------------------
+// Function: removeCachedFloor
+//
+// Drops the given slot and closes the gap it leaves in the pool, so
+// free space is always one block at the end.
+//------------------------------------------------------------------
+static void removeCachedFloor(int const slot)
+{
+    struct CachedFloor removed = cachedFloor[slot];
+
+    memmove(&cachePool[removed.offset], &cachePool[removed.offset + removed.size],
+        cachePoolUsed - removed.offset - removed.size);
+    cachePoolUsed -= removed.size;
+
+    for (int i = slot; i < cachedFloorCount - 1; i++)
+        cachedFloor[i] = cachedFloor[i + 1];
+    cachedFloorCount--;
+
+    for (int i = 0; i < cachedFloorCount; i++)
+    {
+        if (cachedFloor[i].offset > removed.offset)
+            cachedFloor[i].offset -= removed.size;
+    }
+}
+
+//------------------------------------------------------------------
+// Function: encodeFloorRecord
+//
+// Writes the current floor as a record for the cache. Its seed comes
+// from its depth, so normally only the tiles the player changed since
+// generation are kept, a count then (index low, index high, terrainId)
+// each, followed by the explored plane. If the changes weren't all
+// listed, the whole floor is written with encodeFloor instead,
+// followed by the torches: a count, then every x, then every y. The
+// first byte says which. Returns the number of bytes written, or -1 if
+// they don't fit.
+//------------------------------------------------------------------
+static int encodeFloorRecord(uint8_t *buffer, int const capacity)
+{
+    uint8_t torchX[NUM_MAX_LIGHT_SOURCES], torchY[NUM_MAX_LIGHT_SOURCES];
+    int size = 2, planeSize = 0, torchCount = 0;
+
+    if (!isFloorEditListFull)
+    {
+        if (capacity < 2 + floorEditCount * 3)
+            return -1;
+
+        buffer[0] = FLOOR_RECORD_DELTA;
+        buffer[1] = floorEditCount;
+        for (int i = 0; i < floorEditCount; i++)
+        {
+            buffer[size++] = floorEdit[i] & 0xFF;
+            buffer[size++] = floorEdit[i] >> 8;
+            buffer[size++] = gameMap[floorEdit[i] / MAP_WIDTH_TILES][floorEdit[i] % MAP_WIDTH_TILES].terrainId;
+        }
+
+        planeSize = encodeExplored(&buffer[size], capacity - size);
+        return (planeSize < 0) ? -1 : size + planeSize;
+    }
+
+    buffer[0] = FLOOR_RECORD_FULL;
+    size = encodeFloor(&buffer[1], capacity - 1);
+    torchCount = getTorchPositions(torchX, torchY);
+    if (size < 0 || 1 + size + 1 + torchCount * 2 > capacity)
+        return -1;
+    size++;
+
+    buffer[size++] = torchCount;
+    memcpy(&buffer[size], torchX, torchCount);
+    memcpy(&buffer[size + torchCount], torchY, torchCount);
+
+    return size + torchCount * 2;
+}
+
+//------------------------------------------------------------------
+// Function: generateFloor
+//
+// Builds the given depth's map, occluders and torches from its seed,
+// as on the first visit, with no changes listed yet.
+//------------------------------------------------------------------
+static void generateFloor(int const depth)
+{
+    seedRandom(getFloorSeed(depth));
+    generateGameMap();
+    initFOV();
+    initLighting();
+
+    floorEditCount = 0;
+    isFloorEditListFull = FALSE;
+}
+
+//------------------------------------------------------------------
+// Function: applyFloorDelta
+//
+// Replays the changes and explored plane of a delta record on a floor
+// just built by generateFloor, listing the changes again so they are
+// kept the next time the floor is stored. The torches were placed
+// before the changes, as on the first visit, so they are relit after.
+// Returns FALSE if the record is malformed.
+//------------------------------------------------------------------
+static boolean applyFloorDelta(uint8_t const *record, int const size)
+{
+    uint8_t torchX[NUM_MAX_LIGHT_SOURCES], torchY[NUM_MAX_LIGHT_SOURCES];
+    int editCount = (size >= 2) ? record[1] : 0, offset = 2;
+
+    if (size < 2 || editCount > FLOOR_MAX_EDITS || offset + editCount * 3 > size)
+        return FALSE;
+
+    for (int i = 0; i < editCount; i++, offset += 3)
+    {
+        int index = record[offset] | (record[offset + 1] << 8);
+
+        if (index >= MAP_WIDTH_TILES * MAP_HEIGHT_TILES || record[offset + 2] > ID_STAIRS_UP)
+            return FALSE;
+
+        setTileTerrain(index % MAP_WIDTH_TILES, index / MAP_WIDTH_TILES, record[offset + 2]);
+        floorEdit[floorEditCount++] = index;
+    }
+
+    if (decodeExplored(&record[offset], size - offset) != size - offset)
+        return FALSE;
+
+    if (editCount > 0)
+    {
+        int torchCount = getTorchPositions(torchX, torchY);
+
+        loadLighting(torchX, torchY, torchCount);
+    }
+
+    return TRUE;
+}
+
+//------------------------------------------------------------------
+// Function: restoreFloor
+//
+// Builds the given depth's map, occluders and torches from its cache
+// record, or from its seed alone if record is NULL. Returns FALSE if
+// the record was malformed, in which case the floor is generated as
+// on the first visit.
+//------------------------------------------------------------------
+static boolean restoreFloor(int const depth, uint8_t const *record, int const size)
+{
+    int floorSize = 0, torchCount = 0;
+
+    if (record != NULL && size > 0 && record[0] == FLOOR_RECORD_FULL)
+    {
+        floorSize = decodeFloor(&record[1], size - 1);
+        torchCount = (floorSize >= 0 && 1 + floorSize < size) ? record[1 + floorSize] : 0;
+
+        if (floorSize >= 0 && 1 + floorSize + 1 + torchCount * 2 == size)
+        {
+            initFOV();
+            loadLighting(&record[2 + floorSize], &record[2 + floorSize + torchCount], torchCount);
+
+            // What changed before this floor was stored is unknown
+            floorEditCount = 0;
+            isFloorEditListFull = TRUE;
+            return TRUE;
+        }
+    }
+
+    generateFloor(depth);
+    if (record == NULL || size < 1 || record[0] != FLOOR_RECORD_DELTA)
+        return (record == NULL);
+
+    if (applyFloorDelta(record, size))
+        return TRUE;
+
+    generateFloor(depth);
+    return FALSE;
+}
+
+//------------------------------------------------------------------
+// Function: storeCurrentFloor
+//
+// Encodes the floor being left into the cache, evicting the floors
+// left longest ago until it fits. A floor that can't be encoded isn't
+// cached and is regenerated from its seed if visited again.
+//------------------------------------------------------------------
+static void storeCurrentFloor()
+{
+    uint8_t *record = arenaAlloc(ARENA_SCRATCH, FLOOR_RECORD_MAX_BYTES);
+    int size = (record != NULL) ? encodeFloorRecord(record, FLOOR_RECORD_MAX_BYTES) : -1;
+
+    if (size < 0 || size > FLOOR_CACHE_SIZE)
+    {
+        if (record != NULL)
+            releaseArena(ARENA_SCRATCH, record);
+        return;
+    }
+
+    while (cachedFloorCount == FLOOR_CACHE_MAX_FLOORS || cachePoolUsed + size > FLOOR_CACHE_SIZE)
+    {
+        int oldestSlot = 0;
+
+        for (int slot = 1; slot < cachedFloorCount; slot++)
+        {
+            if (cachedFloor[slot].lastVisit < cachedFloor[oldestSlot].lastVisit)
+                oldestSlot = slot;
+        }
+
+        logMessage(LOG_MAP_GEN, MGBA_LOG_DEBUG, "floor cache: evicting depth %d", cachedFloor[oldestSlot].depth);
+
+        removeCachedFloor(oldestSlot);
+        evictionCount++;
+    }
+
+    if (record[0] == FLOOR_RECORD_DELTA)
+    {
+        deltaStoredBytes += size;
+        deltaStoreCount++;
+    }
+    else
+    {
+        fullStoredBytes += size;
+        fullStoreCount++;
+    }
+
+    memcpy(&cachePool[cachePoolUsed], record, size);
+    cachedFloor[cachedFloorCount].depth = currentDepth;
+    cachedFloor[cachedFloorCount].offset = cachePoolUsed;
+    cachedFloor[cachedFloorCount].size = size;
+    cachedFloor[cachedFloorCount].lastVisit = floorChanges;
+    cachedFloorCount++;
+    cachePoolUsed += size;
+
+    releaseArena(ARENA_SCRATCH, record);
+}
+
+//------------------------------------------------------------------
+// Function: enterFloor
+//
+// Makes the given depth the current map, restored from the cache if
+// it is there and generated from its seed otherwise, and sets up the
+// entities and fields on it. The player arrives on the up stairs when
+// coming from above and on the down stairs otherwise. Restoring from
+// a delta costs a generation plus a few changes, and the floor leaves
+// the cache until it is left again.
+//------------------------------------------------------------------
+static void enterFloor(int const depth, boolean const isArrivingFromAbove)
+{
+    int slot = findCachedFloor(depth);
+    uint8_t const *record = (slot >= 0) ? &cachePool[cachedFloor[slot].offset] : NULL;
+    int recordSize = (slot >= 0) ? cachedFloor[slot].size : 0;
+    int arrivalX = 0, arrivalY = 0;
+    boolean isRestored = FALSE;
+    u32 cycles = 0;
+
+    currentDepth = depth;
+    resetArena(ARENA_FLOOR);
+
+    profile_start();
+    isRestored = restoreFloor(depth, record, recordSize) && record != NULL;
+    cycles = profile_stop();
+
+    if (isRestored && record[0] == FLOOR_RECORD_FULL)
+    {
+        fullRestoreCycles += cycles;
+        fullRestoreCount++;
+    }
+    else if (isRestored)
+    {
+        deltaRestoreCycles += cycles;
+        deltaRestoreCount++;
+    }
+    else
+    {
+        generateCycles += cycles;
+        generateCount++;
+        if (depth <= deepestDepth && floorChanges > 0)
+            regenerateCount++;
+    }
+    deepestDepth = MAX(deepestDepth, depth);
+
+    if (slot >= 0)
+        removeCachedFloor(slot);
+
+    if (isArrivingFromAbove)
+        getUpStairsPosition(&arrivalX, &arrivalY);
+    else
+        getStairsPosition(&arrivalX, &arrivalY);
+
+    // The lighting was built before the player arrived
+    initEntities(arrivalX, arrivalY);
+    movePlayerLight(arrivalX, arrivalY);
+    updateLighting();
+
+    initFlowFields();
+    initSenseFields();
+    playerSightId = TILE_IN_SIGHT;
+
+    logMessage(LOG_MAP_GEN, MGBA_LOG_DEBUG, "enterFloor: depth %d, %s", depth, isRestored ? "restored" : "generated");
+}
+
+//------------------------------------------------------------------
+// Function: startFloors
+//
+// Empties the cache and enters the first floor of a new run with the
+// given seed. The first floor's up stairs lead out of the dungeon.
+//------------------------------------------------------------------
+extern void startFloors(u32 const seed)
+{
+    runSeed = seed;
+    cachedFloorCount = 0;
+    cachePoolUsed = 0;
+    deepestDepth = 0;
+    floorChanges = 0;
+
+    enterFloor(0, TRUE);
+}
+
+//------------------------------------------------------------------
+// Function: changeFloor
+//
+// Leaves the current floor by the stairs, one floor down for a
+// positive step and up for a negative one, caching the floor left.
+// Returns FALSE, without changing anything, when the step leads up
+// out of the first floor.
+//------------------------------------------------------------------
+extern boolean changeFloor(int const step)
+{
+    int targetDepth = currentDepth + step;
+
+    if (targetDepth < 0)
+        return FALSE;
+    if (targetDepth > FLOOR_MAX_DEPTH)
+        return TRUE;
+
+    floorChanges++;
+    storeCurrentFloor();
+    enterFloor(targetDepth, step > 0);
+
+    return TRUE;
+}
+
+//------------------------------------------------------------------
+// Function: getCurrentDepth
+//
+// Returns how many floors below the first the player is.
+//------------------------------------------------------------------
+extern int getCurrentDepth()
+{
+    return currentDepth;
+}
+
+//------------------------------------------------------------------
+// Function: resumeFloors
+//
+// Sets the run seed and depth of a floor that was loaded instead of
+// entered, so the floors around it regenerate as they were. The
+// cache is filled separately by loadFloorCache.
+//------------------------------------------------------------------
+extern void resumeFloors(u32 const seed, int const depth)
+{
+    runSeed = seed;
+    currentDepth = depth;
+    deepestDepth = depth;
+    floorChanges = 0;
+
+    // What changed before the save is unknown, so this floor is stored whole
+    floorEditCount = 0;
+    isFloorEditListFull = TRUE;
+}
+
+//------------------------------------------------------------------
+// Function: noteFloorEdit
+//
+// Lists a tile the player changed on the current floor, once, so the
+// change can be replayed when the floor is regenerated.
+//------------------------------------------------------------------
+extern void noteFloorEdit(int const positionX, int const positionY)
+{
+    u16 index = positionY * MAP_WIDTH_TILES + positionX;
+
+    for (int i = 0; i < floorEditCount; i++)
+    {
+        if (floorEdit[i] == index)
+            return;
+    }
+
+    if (floorEditCount == FLOOR_MAX_EDITS)
+        isFloorEditListFull = TRUE;
+    else
+        floorEdit[floorEditCount++] = index;
+}
+
+//------------------------------------------------------------------
+// Function: saveFloorCache
+//
+// Writes the cached floors to the given buffer: a count, then the
+// depth, size and bytes of each. Returns the number of bytes written,
+// or -1 if the buffer is too small.
+//------------------------------------------------------------------
+extern int saveFloorCache(uint8_t *buffer, int const capacity)
+{
+    int size = 0;
+
+    if (capacity < 1 + cachedFloorCount * 3 + cachePoolUsed)
+        return -1;
+
+    buffer[size++] = cachedFloorCount;
+    for (int slot = 0; slot < cachedFloorCount; slot++)
+    {
+        buffer[size++] = cachedFloor[slot].depth;
+        buffer[size++] = cachedFloor[slot].size & 0xFF;
+        buffer[size++] = cachedFloor[slot].size >> 8;
+        memcpy(&buffer[size], &cachePool[cachedFloor[slot].offset], cachedFloor[slot].size);
+        size += cachedFloor[slot].size;
+    }
+
+    return size;
+}
+
+//------------------------------------------------------------------
+// Function: loadFloorCache
+//
+// Refills the cache from bytes written by saveFloorCache. Returns
+// FALSE, leaving the cache empty, if they don't match.
+//------------------------------------------------------------------
+extern boolean loadFloorCache(uint8_t const *buffer, int const size)
+{
+    int offset = 1, floorCount = (size > 0) ? buffer[0] : 0;
+
+    cachedFloorCount = 0;
+    cachePoolUsed = 0;
+    floorChanges = 0;
+
+    if (size < 1 || floorCount > FLOOR_CACHE_MAX_FLOORS)
+        return FALSE;
+
+    for (int slot = 0; slot < floorCount; slot++)
+    {
+        int floorSize = 0;
+
+        if (offset + 3 > size)
+            break;
+
+        floorSize = buffer[offset + 1] | (buffer[offset + 2] << 8);
+        if (offset + 3 + floorSize > size || cachePoolUsed + floorSize > FLOOR_CACHE_SIZE)
+            break;
+
+        cachedFloor[slot].depth = buffer[offset];
+        cachedFloor[slot].offset = cachePoolUsed;
+        cachedFloor[slot].size = floorSize;
+        cachedFloor[slot].lastVisit = 0;
+        memcpy(&cachePool[cachePoolUsed], &buffer[offset + 3], floorSize);
+        cachePoolUsed += floorSize;
+        cachedFloorCount++;
+        offset += 3 + floorSize;
+    }
+
+    if (cachedFloorCount != floorCount || offset != size)
+    {
+        cachedFloorCount = 0;
+        cachePoolUsed = 0;
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+//------------------------------------------------------------------
+// Function: printFloorCacheStats
+//
+// Logs what the cache holds and how floor changes were served since
+// start-up or resetFloorCacheStats: rebuilt from a delta, decoded from a whole floor, or
+// generated for the first time or again after eviction, with the
+// average cycles to build the map, occluders and torches each way.
+// Floors are compared with a snapshot of gameMap.
+//------------------------------------------------------------------
+extern void printFloorCacheStats()
+{
+    logMessage(LOG_GENERAL, MGBA_LOG_INFO, "floor cache: depth %d, %d floors in %d of %d bytes",
+        currentDepth, cachedFloorCount, cachePoolUsed, FLOOR_CACHE_SIZE);
+    logMessage(LOG_GENERAL, MGBA_LOG_INFO, "  %d bytes per delta floor (%d stored), %d per whole floor (%d stored), %d per gameMap snapshot",
+        deltaStoredBytes / MAX(deltaStoreCount, 1), deltaStoreCount, fullStoredBytes / MAX(fullStoreCount, 1), fullStoreCount,
+        sizeof(gameMap));
+    logMessage(LOG_GENERAL, MGBA_LOG_INFO, "  %d rebuilt from deltas at %d cycles, %d decoded whole at %d cycles",
+        deltaRestoreCount, deltaRestoreCycles / MAX(deltaRestoreCount, 1), fullRestoreCount, fullRestoreCycles / MAX(fullRestoreCount, 1));
+    logMessage(LOG_GENERAL, MGBA_LOG_INFO, "  %d generated at %d cycles (%d regenerated), %d evicted",
+        generateCount, generateCycles / MAX(generateCount, 1), regenerateCount, evictionCount);
+}
+
+//------------------------------------------------------------------
+// Function: resetFloorCacheStats
+//
+// Zeroes the store, restore, generation and eviction counts and their
+// cycles. What the cache holds is left alone.
+//------------------------------------------------------------------
+extern void resetFloorCacheStats()
+{
+    deltaStoreCount = 0;
+    fullStoreCount = 0;
+    deltaStoredBytes = 0;
+    fullStoredBytes = 0;
+    deltaRestoreCount = 0;
+    fullRestoreCount = 0;
+    generateCount = 0;
+    regenerateCount = 0;
+    evictionCount = 0;
+    deltaRestoreCycles = 0;
+    fullRestoreCycles = 0;
+    generateCycles = 0;
+}
+
+//------------------------------------------------------------------
+// Function: benchmarkFloorStore
+//
+// Stores the current floor as a cache record and rebuilds it, then
+// does the same with a snapshot of gameMap, and logs the bytes and
+// cycles of each. A snapshot still needs its occluders and torches
+// rebuilt, so those are timed with it. The floor, its edit list, the
+// FOV state and the random state the rebuild consumes are left as they
+// were.
+//------------------------------------------------------------------
+#ifdef DEBUG_BENCHMARK
+extern void benchmarkFloorStore()
+{
+    uint8_t torchX[NUM_MAX_LIGHT_SOURCES], torchY[NUM_MAX_LIGHT_SOURCES];
+    uint8_t *record = arenaAlloc(ARENA_SCRATCH, FLOOR_RECORD_MAX_BYTES);
+    struct Tile *snapshot = arenaAlloc(ARENA_SCRATCH, sizeof(gameMap));
+    u16 savedFloorEdit[FLOOR_MAX_EDITS];
+    int torchCount = getTorchPositions(torchX, torchY), size = 0;
+    int savedEditCount = floorEditCount;
+    boolean wasEditListFull = isFloorEditListFull;
+    u32 randomState = getRandomState();
+    uint encodeCycles = 0, rebuildCycles = 0, copyCycles = 0, reloadCycles = 0;
+    boolean isRebuilt = FALSE;
+
+    if (record == NULL || snapshot == NULL)
+    {
+        if (record != NULL)
+            releaseArena(ARENA_SCRATCH, record);
+        return;
+    }
+
+    saveFOVState();
+    memcpy(savedFloorEdit, floorEdit, sizeof(floorEdit));
+
+    profile_start();
+    size = encodeFloorRecord(record, FLOOR_RECORD_MAX_BYTES);
+    encodeCycles = profile_stop();
+
+    profile_start();
+    memcpy(snapshot, gameMap, sizeof(gameMap));
+    copyCycles = profile_stop();
+
+    profile_start();
+    isRebuilt = (size > 0) && restoreFloor(currentDepth, record, size);
+    rebuildCycles = profile_stop();
+
+    profile_start();
+    memcpy(gameMap, snapshot, sizeof(gameMap));
+    initFOV();
+    loadLighting(torchX, torchY, torchCount);
+    reloadCycles = profile_stop();
+
+    restoreFOVState();
+    memcpy(floorEdit, savedFloorEdit, sizeof(floorEdit));
+    floorEditCount = savedEditCount;
+    isFloorEditListFull = wasEditListFull;
+    setRandomState(randomState);
+    releaseArena(ARENA_SCRATCH, record);
+
+    logMessage(LOG_GENERAL, MGBA_LOG_INFO, "floor store: %s record %d bytes, encoded in %d cycles, rebuilt in %d cycles%s",
+        (size > 0 && record[0] == FLOOR_RECORD_DELTA) ? "delta" : "whole", size, encodeCycles, rebuildCycles,
+        isRebuilt ? "" : " (failed)");
+    logMessage(LOG_GENERAL, MGBA_LOG_INFO, "  gameMap snapshot %d bytes, copied in %d cycles, reloaded in %d cycles",
+        sizeof(gameMap), copyCycles, reloadCycles);
+}
+#endif
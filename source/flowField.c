@@ -0,0 +1,380 @@
+#include <string.h>
+#include "../libtonc/include/tonc.h"
+#include "constants.h"
+#include "arena.h"
+#include "debug.h"
+#include "entity.h"
+#include "flowField.h"
+#include "globals.h"
+#include "logBuffer.h"
+#include "mapGeneration.h"
+#include "mgba.h"
+#include "tile.h"
+
+//------------------------------------------------------------------
+// Data Structures
+//------------------------------------------------------------------
+static struct FlowField *flowField = NULL;                 // In the floor arena, one per goal
+static uint16_t flowQueue[FLOW_QUEUE_SIZE] EWRAM_BSS;    // Ring buffer of tile indices
+static u32 queuedTiles[FLOW_BITSET_WORDS];                // Tiles currently in flowQueue
+static u32 invalidTiles[FLOW_BITSET_WORDS];               // Tiles cut off by a repair
+
+//------------------------------------------------------------------
+// Function Prototypes
+//------------------------------------------------------------------
+static void computeFlowField(uint16_t distance[MAP_HEIGHT_TILES][MAP_WIDTH_TILES], int const goalX, int const goalY);
+static void relaxFlowField(uint16_t distance[MAP_HEIGHT_TILES][MAP_WIDTH_TILES], int head, int count);
+static int pushFlowTile(int const tail, int const count, int const tileIndex);
+static void repairOpenedTile(struct FlowField *field, int const positionX, int const positionY);
+static void repairClosedTile(struct FlowField *field, int const positionX, int const positionY);
+
+//------------------------------------------------------------------
+// Function: pushFlowTile
+//
+// Pushes the given tile index onto the ring queue at tail unless it's
+// already queued. Returns the new queue count.
+//------------------------------------------------------------------
+static int pushFlowTile(int const tail, int const count, int const tileIndex)
+{
+    if (queuedTiles[tileIndex >> 5] & (1u << (tileIndex & 31)))
+        return count;
+
+    queuedTiles[tileIndex >> 5] |= 1u << (tileIndex & 31);
+    flowQueue[tail % FLOW_QUEUE_SIZE] = tileIndex;
+    return count + 1;
+}
+
+//------------------------------------------------------------------
+// Function: relaxFlowField
+//
+// Pops tiles off the ring queue and lowers the distance of each
+// walkable neighbour that can be reached in fewer steps through it,
+// queueing the neighbours that changed. Seeded with a single goal this
+// is a plain BFS; seeded with a repair frontier it keeps relaxing
+// until nothing changes.
+//------------------------------------------------------------------
+static void relaxFlowField(uint16_t distance[MAP_HEIGHT_TILES][MAP_WIDTH_TILES], int head, int count)
+{
+    while (count > 0)
+    {
+        int tileIndex = flowQueue[head];
+        int currentX = tileIndex % MAP_WIDTH_TILES, currentY = tileIndex / MAP_WIDTH_TILES;
+        uint16_t nextDistance = distance[currentY][currentX] + 1;
+
+        queuedTiles[tileIndex >> 5] &= ~(1u << (tileIndex & 31));
+        head = (head + 1) % FLOW_QUEUE_SIZE;
+        count--;
+
+        for (int direction = DIR_LEFT; direction <= DIR_DOWN; direction++)
+        {
+            int neighbourX = currentX + dirX[direction], neighbourY = currentY + dirY[direction];
+
+            if (isOutOfBounds(neighbourX, neighbourY) || isSolid(neighbourX, neighbourY)
+            || distance[neighbourY][neighbourX] <= nextDistance)
+                continue;
+
+            distance[neighbourY][neighbourX] = nextDistance;
+            count = pushFlowTile(head + count, count, neighbourY * MAP_WIDTH_TILES + neighbourX);
+        }
+    }
+}
+
+//------------------------------------------------------------------
+// Function: computeFlowField
+//
+// Fills the given distance map from scratch with the number of steps
+// from each walkable tile to the goal.
+//------------------------------------------------------------------
+static void computeFlowField(uint16_t distance[MAP_HEIGHT_TILES][MAP_WIDTH_TILES], int const goalX, int const goalY)
+{
+    memset(distance, 0xFF, sizeof(uint16_t) * MAP_HEIGHT_TILES * MAP_WIDTH_TILES);
+
+    if (isOutOfBounds(goalX, goalY))
+        return;
+
+    distance[goalY][goalX] = 0;
+    relaxFlowField(distance, 0, pushFlowTile(0, 0, goalY * MAP_WIDTH_TILES + goalX));
+}
+
+//------------------------------------------------------------------
+// Function: repairOpenedTile
+//
+// A tile became walkable: give it one more than its best neighbour and
+// spread any shortcut it creates.
+//------------------------------------------------------------------
+static void repairOpenedTile(struct FlowField *field, int const positionX, int const positionY)
+{
+    uint16_t bestDistance = FLOW_DISTANCE_UNREACHABLE;
+
+    for (int direction = DIR_LEFT; direction <= DIR_DOWN; direction++)
+    {
+        int neighbourX = positionX + dirX[direction], neighbourY = positionY + dirY[direction];
+
+        if (!isOutOfBounds(neighbourX, neighbourY))
+            bestDistance = MIN(bestDistance, field->distance[neighbourY][neighbourX]);
+    }
+
+    // Still cut off from the goal
+    if (bestDistance == FLOW_DISTANCE_UNREACHABLE)
+        return;
+
+    field->distance[positionY][positionX] = bestDistance + 1;
+    relaxFlowField(field->distance, 0, pushFlowTile(0, 0, positionY * MAP_WIDTH_TILES + positionX));
+}
+
+//------------------------------------------------------------------
+// Function: repairClosedTile
+//
+// A tile became solid. Every tile whose only downhill path ran through
+// it is invalidated, walking outwards in order of distance so a tile's
+// remaining support is known before its own children are checked. The
+// invalidated tiles are then reseeded from their valid neighbours and
+// relaxed until stable. Only the cut-off region is touched.
+//------------------------------------------------------------------
+static void repairClosedTile(struct FlowField *field, int const positionX, int const positionY)
+{
+    int invalidCount = 0, seedCount = 0;
+    int startIndex = positionY * MAP_WIDTH_TILES + positionX;
+
+    if (field->distance[positionY][positionX] == FLOW_DISTANCE_UNREACHABLE)
+        return;
+
+    memset(invalidTiles, 0, sizeof(invalidTiles));
+    invalidTiles[startIndex >> 5] |= 1u << (startIndex & 31);
+    flowQueue[invalidCount++] = startIndex;
+
+    // Collect the tiles that lost their support, using flowQueue as a list
+    for (int i = 0; i < invalidCount; i++)
+    {
+        int currentX = flowQueue[i] % MAP_WIDTH_TILES, currentY = flowQueue[i] / MAP_WIDTH_TILES;
+        uint16_t childDistance = field->distance[currentY][currentX] + 1;
+
+        for (int direction = DIR_LEFT; direction <= DIR_DOWN; direction++)
+        {
+            int childX = currentX + dirX[direction], childY = currentY + dirY[direction];
+            int childIndex = childY * MAP_WIDTH_TILES + childX;
+            boolean isSupported = FALSE;
+
+            if (isOutOfBounds(childX, childY) || field->distance[childY][childX] != childDistance
+            || (invalidTiles[childIndex >> 5] & (1u << (childIndex & 31))))
+                continue;
+
+            // Still reachable through another neighbour one step closer
+            for (int supportDirection = DIR_LEFT; supportDirection <= DIR_DOWN && !isSupported; supportDirection++)
+            {
+                int supportX = childX + dirX[supportDirection], supportY = childY + dirY[supportDirection];
+                int supportIndex = supportY * MAP_WIDTH_TILES + supportX;
+
+                isSupported = !isOutOfBounds(supportX, supportY)
+                    && field->distance[supportY][supportX] == childDistance - 1
+                    && !(invalidTiles[supportIndex >> 5] & (1u << (supportIndex & 31)));
+            }
+
+            if (isSupported)
+                continue;
+
+            invalidTiles[childIndex >> 5] |= 1u << (childIndex & 31);
+            flowQueue[invalidCount++] = childIndex;
+        }
+    }
+
+    for (int i = 0; i < invalidCount; i++)
+        field->distance[flowQueue[i] / MAP_WIDTH_TILES][flowQueue[i] % MAP_WIDTH_TILES] = FLOW_DISTANCE_UNREACHABLE;
+
+    // Reseed from the valid border, compacting the seeds to the queue front
+    for (int i = 0; i < invalidCount; i++)
+    {
+        int tileIndex = flowQueue[i];
+        int currentX = tileIndex % MAP_WIDTH_TILES, currentY = tileIndex / MAP_WIDTH_TILES;
+        uint16_t bestDistance = FLOW_DISTANCE_UNREACHABLE;
+
+        if (isSolid(currentX, currentY))
+            continue;
+
+        for (int direction = DIR_LEFT; direction <= DIR_DOWN; direction++)
+        {
+            int neighbourX = currentX + dirX[direction], neighbourY = currentY + dirY[direction];
+
+            if (!isOutOfBounds(neighbourX, neighbourY))
+                bestDistance = MIN(bestDistance, field->distance[neighbourY][neighbourX]);
+        }
+
+        if (bestDistance == FLOW_DISTANCE_UNREACHABLE)
+            continue;
+
+        field->distance[currentY][currentX] = bestDistance + 1;
+        seedCount = pushFlowTile(seedCount, seedCount, tileIndex);
+    }
+
+    relaxFlowField(field->distance, 0, seedCount);
+
+    logMessage(LOG_ENTITY, MGBA_LOG_DEBUG, "repairClosedTile: %d invalidated, %d reseeded", invalidCount, seedCount);
+}
+
+//------------------------------------------------------------------
+// Function: initFlowFields
+//
+// Computes every flow field from scratch. Should be called upon
+// entrance to a new map, after the entities are placed and the floor
+// arena is reset, since the fields live there until the floor changes.
+//------------------------------------------------------------------
+extern void initFlowFields()
+{
+    int stairsX = 0, stairsY = 0;
+
+    flowField = (struct FlowField*)arenaAlloc(ARENA_FLOOR, NUM_FLOW_GOALS * sizeof(struct FlowField));
+    getStairsPosition(&stairsX, &stairsY);
+
+    memset(queuedTiles, 0, sizeof(queuedTiles));
+    for (int goal = 0; goal < NUM_FLOW_GOALS; goal++)
+        flowField[goal].isValid = FALSE;
+
+    setFlowGoal(FLOW_GOAL_PLAYER, getEntityPosX(PLAYER_INDEX), getEntityPosY(PLAYER_INDEX));
+    setFlowGoal(FLOW_GOAL_STAIRS, stairsX, stairsY);
+}
+
+//------------------------------------------------------------------
+// Function: setFlowGoal
+//
+// Moves the given flow field's goal, recomputing the field if the goal
+// changed. Called once per player move for FLOW_GOAL_PLAYER.
+//------------------------------------------------------------------
+extern void setFlowGoal(enum flowGoal const goal, int const positionX, int const positionY)
+{
+    struct FlowField *field = &flowField[goal];
+
+    if (field->isValid && field->goalX == positionX && field->goalY == positionY)
+        return;
+
+    field->goalX = positionX;
+    field->goalY = positionY;
+    field->isValid = TRUE;
+    computeFlowField(field->distance, positionX, positionY);
+}
+
+//------------------------------------------------------------------
+// Function: repairFlowFields
+//
+// Updates every flow field after the tile at the given position was
+// opened or closed. Changes to a goal tile fall back to a recompute.
+//------------------------------------------------------------------
+extern void repairFlowFields(int const positionX, int const positionY)
+{
+    if (isOutOfBounds(positionX, positionY))
+        return;
+
+    for (int goal = 0; goal < NUM_FLOW_GOALS; goal++)
+    {
+        struct FlowField *field = &flowField[goal];
+
+        if (field->isValid == FALSE)
+            continue;
+
+        if (field->goalX == positionX && field->goalY == positionY)
+            computeFlowField(field->distance, positionX, positionY);
+        else if (isSolid(positionX, positionY))
+            repairClosedTile(field, positionX, positionY);
+        else
+            repairOpenedTile(field, positionX, positionY);
+    }
+}
+
+//------------------------------------------------------------------
+// Function: getFlowDistance
+//
+// Returns the number of steps from the given position to the goal,
+// or FLOW_DISTANCE_UNREACHABLE.
+//------------------------------------------------------------------
+extern uint16_t getFlowDistance(enum flowGoal const goal, int const positionX, int const positionY)
+{
+    if (isOutOfBounds(positionX, positionY) || flowField[goal].isValid == FALSE)
+        return FLOW_DISTANCE_UNREACHABLE;
+
+    return flowField[goal].distance[positionY][positionX];
+}
+
+//------------------------------------------------------------------
+// Function: getFlowDirection
+//
+// Returns the direction of the neighbour closest to the goal that
+// isn't occupied, or DIR_NULL if no step gets closer.
+//------------------------------------------------------------------
+extern enum direction getFlowDirection(enum flowGoal const goal, int const positionX, int const positionY)
+{
+    enum direction bestDirection = DIR_NULL;
+    uint16_t bestDistance = getFlowDistance(goal, positionX, positionY);
+
+    for (int direction = DIR_LEFT; direction <= DIR_DOWN; direction++)
+    {
+        int neighbourX = positionX + dirX[direction], neighbourY = positionY + dirY[direction];
+        uint16_t distance = getFlowDistance(goal, neighbourX, neighbourY);
+
+        if (distance < bestDistance && !isTileOccupied(neighbourX, neighbourY))
+        {
+            bestDistance = distance;
+            bestDirection = direction;
+        }
+    }
+
+    return bestDirection;
+}
+
+//------------------------------------------------------------------
+// Function: benchmarkFlowFields
+//
+// Toggles random interior tiles between wall and floor, timing the
+// incremental repair of every flow field against recomputing them
+// from scratch, and counts tiles where the two disagree. Each tile is
+// toggled back before the next one.
+//------------------------------------------------------------------
+#ifdef DEBUG_BENCHMARK
+extern void benchmarkFlowFields()
+{
+    static uint16_t referenceDistance[MAP_HEIGHT_TILES][MAP_WIDTH_TILES] EWRAM_BSS;
+    int const toggleCount = 32;
+    uint repairCycles = 0, recomputeCycles = 0, worstRepairCycles = 0;
+    int mismatchCount = 0, positionX = 0, positionY = 0;
+    uint8_t savedTerrain = ID_FLOOR;
+
+    for (int toggle = 0; toggle < toggleCount * 2; toggle++)
+    {
+        uint cycles = 0;
+
+        // Even passes change a tile, odd passes put it back
+        if (toggle % 2 == 0)
+        {
+            do
+            {
+                positionX = randomInRange(1, MAP_WIDTH_TILES - 2);
+                positionY = randomInRange(1, MAP_HEIGHT_TILES - 2);
+                savedTerrain = getTileTerrain(positionX, positionY);
+            } while (savedTerrain == ID_STAIRS || savedTerrain == ID_STAIRS_UP || isTileOccupied(positionX, positionY));
+
+            setTileTerrain(positionX, positionY, isSolid(positionX, positionY) ? ID_FLOOR : ID_WALL);
+        }
+        else
+            setTileTerrain(positionX, positionY, savedTerrain);
+
+        profile_start();
+        repairFlowFields(positionX, positionY);
+        cycles = profile_stop();
+        repairCycles += cycles;
+        worstRepairCycles = MAX(worstRepairCycles, cycles);
+
+        for (int goal = 0; goal < NUM_FLOW_GOALS; goal++)
+        {
+            profile_start();
+            computeFlowField(referenceDistance, flowField[goal].goalX, flowField[goal].goalY);
+            recomputeCycles += profile_stop();
+
+            for (int y = 0; y < MAP_HEIGHT_TILES; y++)
+                for (int x = 0; x < MAP_WIDTH_TILES; x++)
+                    mismatchCount += referenceDistance[y][x] != flowField[goal].distance[y][x];
+        }
+    }
+
+    mgba_printf(MGBA_LOG_INFO, "benchmarkFlowFields: %d repairs, %d mismatched tiles", toggleCount * 2, mismatchCount);
+    mgba_printf(MGBA_LOG_INFO, "  repair %d cycles avg (worst %d), full recompute %d cycles",
+        repairCycles / (toggleCount * 2), worstRepairCycles, recomputeCycles / (toggleCount * 2));
+}
+#endif
@@ -1,4 +1,3 @@
-#include <stdlib.h>
 #include <string.h>
 #include "../libtonc/include/tonc.h"
 #include "constants.h"
@@ -7,8 +6,58 @@
 //------------------------------------------------------------------
 // Global Variables
 //------------------------------------------------------------------
-int8_t const dirX[9] = {0, -1, 1, 0, 0, -1, 1, -1, 1};
-int8_t const dirY[9] = {0, 0, 0, -1, 1, -1, -1, 1, 1};
+int8_t IWRAM_TABLE dirX[9] = {0, -1, 1, 0, 0, -1, 1, -1, 1};
+int8_t IWRAM_TABLE dirY[9] = {0, 0, 0, -1, 1, -1, -1, 1, 1};
+
+// Kept here instead of in the C library so it can be saved and restored
+static u32 randomState = 1;
+
+//------------------------------------------------------------------
+// Function: seedRandom
+//
+// Starts the random number sequence for the given seed. The seed is
+// scrambled first, since the xorshift state must never be zero.
+//------------------------------------------------------------------
+extern void seedRandom(u32 const seed)
+{
+    randomState = seed * 2654435761u;
+    if (randomState == 0)
+        randomState = 1;
+}
+
+//------------------------------------------------------------------
+// Function: getRandomState
+//
+// Returns the state of the random number sequence, for saving.
+//------------------------------------------------------------------
+extern u32 getRandomState()
+{
+    return randomState;
+}
+
+//------------------------------------------------------------------
+// Function: setRandomState
+//
+// Continues the random number sequence from a saved state.
+//------------------------------------------------------------------
+extern void setRandomState(u32 const state)
+{
+    randomState = (state != 0) ? state : 1;
+}
+
+//------------------------------------------------------------------
+// Function: nextRandom
+//
+// Returns the next value of the xorshift32 sequence.
+//------------------------------------------------------------------
+extern u32 nextRandom()
+{
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 17;
+    randomState ^= randomState << 5;
+
+    return randomState;
+}
 
 //------------------------------------------------------------------
 // Function: randomInRange
@@ -18,7 +67,7 @@ int8_t const dirY[9] = {0, 0, 0, -1, 1, -1, -1, 1, 1};
 //------------------------------------------------------------------
 extern u32 randomInRange(int minimumValue, int maximumValue)
 {
-    return rand() % (maximumValue - minimumValue + 1) + minimumValue;
+    return nextRandom() % (maximumValue - minimumValue + 1) + minimumValue;
 }
 
 //------------------------------------------------------------------
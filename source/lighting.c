@@ -0,0 +1,383 @@
+#include <string.h>
+#include "../libtonc/include/tonc.h"
+#include "constants.h"
+#include "debug.h"
+#include "entity.h"
+#include "fieldOfVision.h"
+#include "globals.h"
+#include "lighting.h"
+#include "logBuffer.h"
+#include "mgba.h"
+#include "tile.h"
+
+//------------------------------------------------------------------
+// Data Structures
+//------------------------------------------------------------------
+static struct LightSource lightSource[NUM_MAX_LIGHT_SOURCES] EWRAM_BSS;
+uint16_t lightMap[MAP_HEIGHT_TILES][MAP_WIDTH_TILES] EWRAM_BSS;
+
+//------------------------------------------------------------------
+// Global Variables
+//------------------------------------------------------------------
+static int playerLightIndex = -1;
+static int nextDirtyLightIndex = 0;        // Round-robin start of updateLighting
+
+//------------------------------------------------------------------
+// Function Prototypes
+//------------------------------------------------------------------
+static void applyLightContribution(struct LightSource *light, int const sign);
+static void computeLightContribution(struct LightSource *light);
+static void relightSource(struct LightSource *light);
+static void resetLighting();
+static void relightAllSources();
+
+//------------------------------------------------------------------
+// Function: applyLightContribution
+// 
+// Adds (sign > 0) or subtracts (sign < 0) the given light's stored
+// contribution to lightMap around the origin it was computed at.
+//------------------------------------------------------------------
+static void applyLightContribution(struct LightSource *light, int const sign)
+{
+    for (int y = 0; y < LIGHT_WINDOW_WIDTH; y++)
+    {
+        int mapY = light->appliedY + y - LIGHT_RADIUS_MAX;
+
+        for (int x = 0; x < LIGHT_WINDOW_WIDTH; x++)
+        {
+            int mapX = light->appliedX + x - LIGHT_RADIUS_MAX;
+            uint8_t amount = light->contribution[y * LIGHT_WINDOW_WIDTH + x];
+
+            if (amount == 0 || isOutOfBounds(mapX, mapY))
+                continue;
+
+            lightMap[mapY][mapX] += sign * amount;
+        }
+    }
+}
+
+//------------------------------------------------------------------
+// Function: computeLightContribution
+// 
+// Fills the given light's contribution window from its current
+// position. Intensity falls off linearly with distance, and only
+// tiles with a clear line to the light are lit.
+//------------------------------------------------------------------
+static void computeLightContribution(struct LightSource *light)
+{
+    uint8_t falloff[LIGHT_RADIUS_MAX + 1];
+
+    for (int distance = 0; distance <= light->radius; distance++)
+        falloff[distance] = light->intensity * (light->radius + 1 - distance) / (light->radius + 1);
+
+    memset(light->contribution, 0, sizeof(light->contribution));
+
+    for (int y = -light->radius; y <= light->radius; y++)
+    {
+        for (int x = -light->radius; x <= light->radius; x++)
+        {
+            int mapX = light->posX + x, mapY = light->posY + y;
+
+            if (isOutOfBounds(mapX, mapY) || !isLineClear(light->posX, light->posY, mapX, mapY))
+                continue;
+
+            light->contribution[(y + LIGHT_RADIUS_MAX) * LIGHT_WINDOW_WIDTH + x + LIGHT_RADIUS_MAX]
+                = falloff[MAX(ABS(x), ABS(y))];
+        }
+    }
+
+    light->appliedX = light->posX;
+    light->appliedY = light->posY;
+}
+
+//------------------------------------------------------------------
+// Function: relightSource
+// 
+// Replaces the given light's old contribution in lightMap with one
+// computed from its current position and surroundings.
+//------------------------------------------------------------------
+static void relightSource(struct LightSource *light)
+{
+    if (light->isApplied)
+        applyLightContribution(light, -1);
+
+    light->isApplied = FALSE;
+    light->isDirty = FALSE;
+
+    if (light->isActive == FALSE)
+        return;
+
+    computeLightContribution(light);
+    applyLightContribution(light, 1);
+    light->isApplied = TRUE;
+}
+
+//------------------------------------------------------------------
+// Function: resetLighting
+// 
+// Clears the light map and every light source, then adds the light
+// carried by the player.
+//------------------------------------------------------------------
+static void resetLighting()
+{
+    memset(lightSource, 0, sizeof(lightSource));
+    memset(lightMap, 0, sizeof(lightMap));
+    nextDirtyLightIndex = 0;
+
+    playerLightIndex = addLightSource(getEntityPosX(PLAYER_INDEX), getEntityPosY(PLAYER_INDEX), PLAYER_LIGHT_RADIUS, PLAYER_LIGHT_INTENSITY);
+}
+
+//------------------------------------------------------------------
+// Function: relightAllSources
+// 
+// Lights everything up front so the first turn doesn't start dark.
+//------------------------------------------------------------------
+static void relightAllSources()
+{
+    for (int index = 0; index < NUM_MAX_LIGHT_SOURCES; index++)
+    {
+        if (lightSource[index].isDirty)
+            relightSource(&lightSource[index]);
+    }
+}
+
+//------------------------------------------------------------------
+// Function: initLighting
+// 
+// Clears the light map and places torches on random floor tiles, plus
+// the light carried by the player. Should be called upon entrance to
+// a new map, after the entities are placed.
+//------------------------------------------------------------------
+extern void initLighting()
+{
+    resetLighting();
+
+    for (int torch = 0; torch < NUM_START_TORCHES; torch++)
+    {
+        int positionX = 0, positionY = 0;
+
+        do
+        {
+            positionX = randomInRange(1, MAP_WIDTH_TILES - 2);
+            positionY = randomInRange(1, MAP_HEIGHT_TILES - 2);
+        } while (isSolid(positionX, positionY));
+
+        addLightSource(positionX, positionY, TORCH_RADIUS, TORCH_INTENSITY);
+    }
+
+    relightAllSources();
+
+    logMessage(LOG_FOV, MGBA_LOG_DEBUG, "initLighting");
+}
+
+//------------------------------------------------------------------
+// Function: getTorchPositions
+// 
+// Fills the given arrays, of NUM_MAX_LIGHT_SOURCES each, with the
+// positions of every active light other than the player's, and
+// returns how many there are.
+//------------------------------------------------------------------
+extern int getTorchPositions(uint8_t *positionX, uint8_t *positionY)
+{
+    int torchCount = 0;
+
+    for (int index = 0; index < NUM_MAX_LIGHT_SOURCES; index++)
+    {
+        if (index == playerLightIndex || lightSource[index].isActive == FALSE)
+            continue;
+
+        positionX[torchCount] = lightSource[index].posX;
+        positionY[torchCount] = lightSource[index].posY;
+        torchCount++;
+    }
+
+    return torchCount;
+}
+
+//------------------------------------------------------------------
+// Function: loadLighting
+// 
+// Like initLighting, but places torches at the given positions, as
+// returned by getTorchPositions, instead of at random.
+//------------------------------------------------------------------
+extern void loadLighting(uint8_t const *positionX, uint8_t const *positionY, int const torchCount)
+{
+    resetLighting();
+
+    for (int torch = 0; torch < torchCount; torch++)
+        addLightSource(positionX[torch], positionY[torch], TORCH_RADIUS, TORCH_INTENSITY);
+
+    relightAllSources();
+}
+
+//------------------------------------------------------------------
+// Function: addLightSource
+// 
+// Adds a light source at the given position and returns its index,
+// or -1 if every light source is in use. The light is computed on
+// the next call to updateLighting.
+//------------------------------------------------------------------
+extern int addLightSource(int const positionX, int const positionY, int const radius, int const intensity)
+{
+    for (int index = 0; index < NUM_MAX_LIGHT_SOURCES; index++)
+    {
+        struct LightSource *light = &lightSource[index];
+
+        if (light->isActive || light->isApplied)
+            continue;
+
+        light->posX = positionX;
+        light->posY = positionY;
+        light->radius = clamp(radius, 0, LIGHT_RADIUS_MAX + 1);
+        light->intensity = intensity;
+        light->isActive = TRUE;
+        light->isDirty = TRUE;
+
+        return index;
+    }
+
+    return -1;
+}
+
+//------------------------------------------------------------------
+// Function: removeLightSource
+// 
+// Turns off the given light source. Its contribution is removed from
+// the light map on the next call to updateLighting.
+//------------------------------------------------------------------
+extern void removeLightSource(int const lightIndex)
+{
+    if (lightIndex < 0 || lightIndex >= NUM_MAX_LIGHT_SOURCES)
+        return;
+
+    lightSource[lightIndex].isActive = FALSE;
+    lightSource[lightIndex].isDirty = TRUE;
+}
+
+//------------------------------------------------------------------
+// Function: moveLightSource
+// 
+// Moves the given light source, marking it for recomputation if its
+// position changed.
+//------------------------------------------------------------------
+extern void moveLightSource(int const lightIndex, int const positionX, int const positionY)
+{
+    struct LightSource *light = NULL;
+
+    if (lightIndex < 0 || lightIndex >= NUM_MAX_LIGHT_SOURCES)
+        return;
+
+    light = &lightSource[lightIndex];
+    if (light->posX == positionX && light->posY == positionY)
+        return;
+
+    light->posX = positionX;
+    light->posY = positionY;
+    light->isDirty = TRUE;
+}
+
+//------------------------------------------------------------------
+// Function: movePlayerLight
+// 
+// Moves the light source carried by the player.
+//------------------------------------------------------------------
+extern void movePlayerLight(int const positionX, int const positionY)
+{
+    moveLightSource(playerLightIndex, positionX, positionY);
+}
+
+//------------------------------------------------------------------
+// Function: markLightTerrainChanged
+// 
+// Marks for recomputation every light whose applied contribution
+// covers the given position. Called whenever a tile's terrain changes.
+//------------------------------------------------------------------
+extern void markLightTerrainChanged(int const positionX, int const positionY)
+{
+    for (int index = 0; index < NUM_MAX_LIGHT_SOURCES; index++)
+    {
+        struct LightSource *light = &lightSource[index];
+
+        if (light->isApplied == FALSE)
+            continue;
+
+        if (ABS(positionX - light->appliedX) <= light->radius
+        && ABS(positionY - light->appliedY) <= light->radius)
+            light->isDirty = TRUE;
+    }
+}
+
+//------------------------------------------------------------------
+// Function: updateLighting
+// 
+// Recomputes dirty light sources, at most LIGHT_UPDATES_PER_TURN per
+// call so the cost per turn stays fixed. The player's light goes first,
+// the rest are visited round-robin so none are starved.
+//------------------------------------------------------------------
+extern void updateLighting()
+{
+    int updatesLeft = LIGHT_UPDATES_PER_TURN;
+
+    if (playerLightIndex >= 0 && lightSource[playerLightIndex].isDirty)
+    {
+        relightSource(&lightSource[playerLightIndex]);
+        updatesLeft--;
+    }
+
+    for (int i = 0; i < NUM_MAX_LIGHT_SOURCES && updatesLeft > 0; i++)
+    {
+        int index = (nextDirtyLightIndex + i) % NUM_MAX_LIGHT_SOURCES;
+
+        if (lightSource[index].isDirty)
+        {
+            relightSource(&lightSource[index]);
+            updatesLeft--;
+            nextDirtyLightIndex = (index + 1) % NUM_MAX_LIGHT_SOURCES;
+        }
+    }
+
+    logMessage(LOG_FOV, MGBA_LOG_DEBUG, "updateLighting: %d lights recomputed", LIGHT_UPDATES_PER_TURN - updatesLeft);
+}
+
+//------------------------------------------------------------------
+// Function: benchmarkLighting
+// 
+// Marks every light source dirty and times how long the budgeted
+// updates take to bring the light map up to date.
+//------------------------------------------------------------------
+#ifdef DEBUG_BENCHMARK
+extern void benchmarkLighting()
+{
+    int activeCount = 0, turnCount = 0, dirtyCount = 0;
+    uint cycles = 0, worstTurnCycles = 0;
+
+    for (int index = 0; index < NUM_MAX_LIGHT_SOURCES; index++)
+    {
+        if (lightSource[index].isActive)
+        {
+            lightSource[index].isDirty = TRUE;
+            activeCount++;
+        }
+    }
+
+    do
+    {
+        uint turnCycles = 0;
+
+        profile_start();
+        updateLighting();
+        turnCycles = profile_stop();
+
+        cycles += turnCycles;
+        worstTurnCycles = MAX(worstTurnCycles, turnCycles);
+        turnCount++;
+
+        dirtyCount = 0;
+        for (int index = 0; index < NUM_MAX_LIGHT_SOURCES; index++)
+            dirtyCount += lightSource[index].isDirty;
+    } while (dirtyCount > 0);
+
+    mgba_printf(MGBA_LOG_INFO, "benchmarkLighting: %d lights relit over %d turns", activeCount, turnCount);
+    mgba_printf(MGBA_LOG_INFO, "  %d cycles per light, worst turn %d cycles", cycles / MAX(activeCount, 1), worstTurnCycles);
+}
+#endif
@@ -0,0 +1,162 @@
+#include "../libtonc/include/tonc.h"
+#include "constants.h"
+#include "debug.h"
+#include "logBuffer.h"
+#include "mgba.h"
+
+//------------------------------------------------------------------
+// Data Structures
+//------------------------------------------------------------------
+static struct LogEvent logBuffer[LOG_BUFFER_EVENTS] EWRAM_BSS;
+
+//------------------------------------------------------------------
+// Global Variables
+//------------------------------------------------------------------
+u32 logCategoryMask = 0xFFFFFFFF;
+
+// Free-running counts; their difference is the number of events held
+static u32 logHead = 0, logTail = 0;
+static u32 droppedAt = 0;                  // logHead when the first unreported drop happened
+static int droppedSinceDrain = 0;
+
+// Statistics on events since start-up
+static int pushedCount = 0, drainedCount = 0, droppedCount = 0, mostEventsHeld = 0;
+
+//------------------------------------------------------------------
+// Function Prototypes
+//------------------------------------------------------------------
+static void formatLogEvent();
+static boolean isLogPending();
+
+//------------------------------------------------------------------
+// Function: formatLogEvent
+//
+// Sends the oldest held event to the mGBA log. Where events were
+// dropped, a warning with their count is sent in their place first.
+//------------------------------------------------------------------
+static void formatLogEvent()
+{
+    struct LogEvent const *event = &logBuffer[logTail % LOG_BUFFER_EVENTS];
+
+    if (droppedSinceDrain > 0 && logTail == droppedAt)
+    {
+        mgba_printf(MGBA_LOG_WARN, "log: %d events dropped", droppedSinceDrain);
+        droppedSinceDrain = 0;
+        return;
+    }
+
+    mgba_printf(event->level, event->format, event->arg[0], event->arg[1], event->arg[2], event->arg[3]);
+    logTail++;
+    drainedCount++;
+}
+
+//------------------------------------------------------------------
+// Function: isLogPending
+//
+// Returns TRUE if there are held events or dropped events not yet
+// reported.
+//------------------------------------------------------------------
+static boolean isLogPending()
+{
+    return logHead != logTail || droppedSinceDrain > 0;
+}
+
+//------------------------------------------------------------------
+// Function: pushLogEvent
+//
+// Copies a log line's format and arguments into the ring buffer, or
+// counts it as dropped if the buffer is full. Once one is dropped, so
+// are the rest until the drain reaches the gap, so each gap shows up
+// as a single warning. Called through logDeferred, which pads missing
+// arguments with zeros.
+//------------------------------------------------------------------
+extern void pushLogEvent(int const level, char const *format, u32 const arg0, u32 const arg1, u32 const arg2, u32 const arg3)
+{
+    struct LogEvent *event = NULL;
+
+    if (logHead - logTail >= LOG_BUFFER_EVENTS || droppedSinceDrain > 0)
+    {
+        if (droppedSinceDrain == 0)
+            droppedAt = logHead;
+        droppedSinceDrain++;
+        droppedCount++;
+        return;
+    }
+
+    event = &logBuffer[logHead % LOG_BUFFER_EVENTS];
+    event->format = format;
+    event->level = level;
+    event->arg[0] = arg0;
+    event->arg[1] = arg1;
+    event->arg[2] = arg2;
+    event->arg[3] = arg3;
+    logHead++;
+
+    pushedCount++;
+    mostEventsHeld = MAX(mostEventsHeld, (int)(logHead - logTail));
+}
+
+//------------------------------------------------------------------
+// Function: drainLog
+//
+// Formats held events in the time left before the next VBlank. Called
+// at the end of the frame, once the frame's work is done; during
+// VBlank the whole next draw is still ahead, so it drains until
+// LOG_DRAIN_LAST_LINE of that. Returns the number of events sent.
+//------------------------------------------------------------------
+extern int drainLog()
+{
+    int sentCount = 0;
+
+    while (isLogPending())
+    {
+        int scanline = REG_VCOUNT;
+
+        if (scanline >= LOG_DRAIN_LAST_LINE && scanline < SCREEN_HEIGHT)
+            break;
+
+        formatLogEvent();
+        sentCount++;
+    }
+
+    return sentCount;
+}
+
+//------------------------------------------------------------------
+// Function: flushLog
+//
+// Formats every held event now, however long it takes. Used before
+// logging directly, so the lines come out in order.
+//------------------------------------------------------------------
+extern void flushLog()
+{
+    while (isLogPending())
+        formatLogEvent();
+}
+
+//------------------------------------------------------------------
+// Function: setLogCategoryEnabled
+//
+// Turns a log category on or off at runtime. Lines the category
+// compiled out stay out either way.
+//------------------------------------------------------------------
+extern void setLogCategoryEnabled(enum logCategory const category, boolean const isEnabled)
+{
+    if (isEnabled)
+        logCategoryMask |= 1 << category;
+    else
+        logCategoryMask &= ~(1 << category);
+}
+
+//------------------------------------------------------------------
+// Function: printLogStats
+//
+// Flushes the buffer, then logs how many events were deferred,
+// dropped and held at most since start-up.
+//------------------------------------------------------------------
+extern void printLogStats()
+{
+    flushLog();
+    logMessage(LOG_GENERAL, MGBA_LOG_INFO, "log: %d events deferred, %d sent, %d dropped, at most %d of %d held",
+        pushedCount, drainedCount, droppedCount, mostEventsHeld, LOG_BUFFER_EVENTS);
+}
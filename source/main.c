@@ -2,21 +2,32 @@
 #include <string.h>
 #include "../libtonc/include/tonc.h"
 #include "constants.h"
+#include "arena.h"
+#include "command.h"
 #include "debug.h"
 #include "entity.h"
 #include "fieldOfVision.h"
+#include "floorCache.h"
+#include "flowField.h"
 #include "globals.h"
+#include "lighting.h"
+#include "logBuffer.h"
 #include "mapGeneration.h"
 #include "mgba.h"
 #include "pauseMenu.h"
+#include "perfOverlay.h"
 #include "playerSprite.h"
+#include "replay.h"
+#include "saveGame.h"
+#include "scheduler.h"
+#include "senseField.h"
 #include "tile.h"
 
 //------------------------------------------------------------------
 // Data Structures
 //------------------------------------------------------------------
 struct Tile gameMap[MAP_HEIGHT_TILES][MAP_WIDTH_TILES];
-struct Entity entity[NUM_MAX_ENTITIES];
+struct EntityPool entityPool;
 
 //------------------------------------------------------------------
 // Global Variables
@@ -26,10 +37,11 @@ OBJ_AFFINE *obj_aff_buffer = (OBJ_AFFINE*)obj_buffer;
 unsigned int frameCount = 1;
 unsigned int randomSeed = 0;
 enum state gameState = STATE_TITLE_SCREEN;
-int turnOfEntityIndex = 0;
+boolean playerHasActed = FALSE;
 uint8_t playerSightId = TILE_IN_SIGHT;
 boolean debugCollisionIsOff = FALSE, debugMapIsVisible = FALSE;
 u32 blendingValue = 0x20;
+enum fovAlgorithm fovAlgorithm = DEFAULT_FOV_ALGORITHM;
 int8_t playerMoveOffsetX = 0, playerMoveOffsetY = 0;
 int16_t screenOffsetX = 0, screenOffsetY = 0;
 
@@ -40,6 +52,7 @@ int16_t screenOffsetX = 0, screenOffsetY = 0;
 static void drawHUD();
 static void updateGraphics();
 static void loadPlayerSprite(uint16_t const playerScreenX, uint16_t const playerScreenY);
+static void loadEntitySprites(int const playerScreenX, int const playerScreenY);
 
 //------------------------------------------------------------------
 // Function: drawHUD
@@ -77,6 +90,7 @@ void drawHUD()
             memcpy(&se_mem[GAME_HUD_SB][screenEntryBR], &tileToDraw, 2);
         }
     }
+    vramWriteCount += SCREEN_HEIGHT_TILES * 16 * 4 * 2;
 }
 
 //------------------------------------------------------------------
@@ -87,7 +101,6 @@ void drawHUD()
 //------------------------------------------------------------------
 void updateGraphics()
 {
-    struct Entity *player = getEntity(PLAYER_INDEX);
     uint16_t playerScreenX = 112, playerScreenY = 80;
 
     if (playerMoveOffsetX != 0)
@@ -106,34 +119,26 @@ void updateGraphics()
     else if (screenOffsetY < 0)
         screenOffsetY += (SCREEN_WIDTH + TILE_SIZE);
 
-    #ifdef DEBUG_ENTITY
-        if (turnOfEntityIndex != PLAYER_INDEX)
-        {
-            mgba_printf(MGBA_LOG_DEBUG, "previous entity turn: %d", turnOfEntityIndex - 1);
-            mgba_printf(MGBA_LOG_DEBUG, "current entity turn: %d", turnOfEntityIndex);
-        }
-    #endif
-
-    if (turnOfEntityIndex != PLAYER_INDEX)
+    if (playerHasActed)
     {
-        switch (player->lastAction)
+        u32 redrawStartClock = getScanlineClock();
+
+        switch (entityPool.lastAction[PLAYER_INDEX])
         {
         case WALKED_LEFT:
         case WALKED_RIGHT:
         case WALKED_UP:
         case WALKED_DOWN:
-            redrawGameMapEdge(player->lastAction);
+            redrawGameMapEdge(entityPool.lastAction[PLAYER_INDEX]);
         default:
             updateGameMapSight();
         }
+        setPerfValue(PERF_REDRAW_CYCLES, getScanlinesSince(redrawStartClock) * CYCLES_PER_SCANLINE);
         #ifdef PRINT_SIGHT_DRAW
-            printTileSightInLog();
+            printMapLayersInLog(mapLayerBit(MAP_LAYER_SIGHT));
         #endif
 
-    if (turnOfEntityIndex >= NUM_MAX_ENTITIES - 1)
-        turnOfEntityIndex = 0;
-    else
-        turnOfEntityIndex++;
+        playerHasActed = FALSE;
     }
 
     // Update background scrolling offsets
@@ -145,6 +150,7 @@ void updateGraphics()
     //playerAction = PLAYER_NO_ACTION;
 
     loadPlayerSprite(playerScreenX, playerScreenY);
+    loadEntitySprites(playerScreenX, playerScreenY);
     REG_BLDCNT= BLD_BUILD(
                     BLD_BG1,        // Top layers
                     BLD_BG2,        // Bottom layers
@@ -159,7 +165,6 @@ void updateGraphics()
 //------------------------------------------------------------------
 void loadPlayerSprite(uint16_t const playerScreenX, uint16_t const playerScreenY)
 {
-    struct Entity *player = getEntity(PLAYER_INDEX);
     unsigned int startingIndex = 0, paletteBank = 0;
     OBJ_ATTR *entity = &obj_buffer[0];
 
@@ -169,7 +174,7 @@ void loadPlayerSprite(uint16_t const playerScreenX, uint16_t const playerScreenY
         ATTR2_PALBANK(paletteBank) | startingIndex); // palette index 0, tile index 0
 
     // Update sprite based on status
-    switch (player->facing)
+    switch (entityPool.facing[PLAYER_INDEX])
     {
     case DIR_LEFT:
         if (frameCount % 20 > 9)
@@ -209,6 +214,76 @@ void loadPlayerSprite(uint16_t const playerScreenX, uint16_t const playerScreenY
 
     // Update first OAM object
     oam_copy(oam_mem, obj_buffer, 1);
+    vramWriteCount += sizeof(OBJ_ATTR);
+}
+
+//------------------------------------------------------------------
+// Function: loadEntitySprites
+// 
+// Walks the occupancy map over the tiles covered by the screen and
+// gives every other entity the player can see an OAM object after the
+// player's. Entities reuse the player sprite tiles for now. Objects
+// left over from last frame are hidden. Skipped unless the change set
+// shows an entity or tile changed, or the screen scrolled.
+//------------------------------------------------------------------
+void loadEntitySprites(int const playerScreenX, int const playerScreenY)
+{
+    static int lastSpriteCount = 0;
+    static int8_t lastMoveOffsetX = 0, lastMoveOffsetY = 0;
+    struct ChangeSet const *changes = getChangeSet();
+    int spriteCount = 0;
+    int playerX = getEntityPosX(PLAYER_INDEX), playerY = getEntityPosY(PLAYER_INDEX);
+
+    if (changes->movedEntityCount == 0 && changes->changedTileCount == 0 && changes->isTileListFull == FALSE
+    && playerMoveOffsetX == lastMoveOffsetX && playerMoveOffsetY == lastMoveOffsetY)
+        return;
+
+    lastMoveOffsetX = playerMoveOffsetX;
+    lastMoveOffsetY = playerMoveOffsetY;
+
+    // One extra tile on each side covers the scroll between tiles
+    for (int y = playerY - (SCREEN_HEIGHT_TILES) / 2 - 1; y <= playerY + (SCREEN_HEIGHT_TILES) / 2 + 1; y++)
+    {
+        for (int x = playerX - (SCREEN_WIDTH_TILES) / 2 - 1; x <= playerX + (SCREEN_WIDTH_TILES) / 2 + 1; x++)
+        {
+            int index = getEntityIndex(getEntityAtTile(x, y));
+            OBJ_ATTR *entity = NULL;
+            unsigned int startingIndex = PLAYER_FACING_DOWN_FR1;
+
+            if (index <= PLAYER_INDEX || getTileSight(x, y) != playerSightId || spriteCount >= MAX_ENTITY_SPRITES)
+                continue;
+
+            entity = &obj_buffer[1 + spriteCount++];
+            obj_set_attr(entity, ATTR0_SQUARE, ATTR1_SIZE_16, 0);
+
+            switch (entityPool.facing[index])
+            {
+            case DIR_RIGHT:
+                entity->attr1 ^= ATTR1_HFLIP;
+            case DIR_LEFT:
+                startingIndex = PLAYER_FACING_LEFT_FR1;
+                break;
+            case DIR_UP:
+                startingIndex = PLAYER_FACING_UP_FR1;
+                break;
+            default:
+                break;
+            }
+
+            entity->attr2 = ATTR2_BUILD(startingIndex, 0, 0);
+            obj_set_pos(entity,
+                (x - playerX) * TILE_SIZE + playerScreenX - playerMoveOffsetX,
+                (y - playerY) * TILE_SIZE + playerScreenY - playerMoveOffsetY);
+        }
+    }
+
+    // Hide objects used last frame but not this one
+    for (int i = spriteCount; i < lastSpriteCount; i++)
+        obj_hide(&obj_buffer[1 + i]);
+
+    oam_copy(&oam_mem[1], &obj_buffer[1], max(spriteCount, lastSpriteCount));
+    vramWriteCount += max(spriteCount, lastSpriteCount) * sizeof(OBJ_ATTR);
+    lastSpriteCount = spriteCount;
 }
 
 //------------------------------------------------------------------
@@ -224,6 +299,7 @@ int main(void)
 
     irq_init(NULL);
     irq_enable(II_VBLANK);
+    initPerfOverlay();
 
     // Load tiles and palette of sprite into video and palete RAM
     memcpy32(&tile_mem[4][0], playerSpriteTiles, playerSpriteTilesLen / 4);
@@ -231,37 +307,50 @@ int main(void)
 
     oam_init(obj_buffer, 128);
 
-    struct Entity *player = getEntity(PLAYER_INDEX);
-
     while (1)
     {
-        // Get player input
-        key_poll();
+        startPerfFrame();
+
+        // Get player input, live or from a replay
+        pollInput();
+
+        // Nothing allocated from scratch outlives a frame
+        resetArena(ARENA_SCRATCH);
 
         // gameState program control
         switch(gameState)
         {
         case STATE_TITLE_SCREEN:
-            if (__key_curr != 0)
+            // SELECT continues the saved game, if there is one
+            if (KEY_EQ(key_hit, KI_SELECT))
             {
-                randomSeed = frameCount;//2915;
-                srand(randomSeed);
-
-                #ifdef DEBUG
-                    mgba_printf(MGBA_LOG_INFO, "RNG Seed: %d", randomSeed);
-                #endif
-
-                generateGameMap();
-                initFOV();
+                resetArena(ARENA_FLOOR);
+                if (loadGame())
+                {
+                    drawHUD();
+                    doStateTransition(STATE_GAMEPLAY);
+                }
+            }
+            else if (__key_curr != 0 && !key_is_down(KEY_SELECT))
+            {
+                // L replays the last recorded game, anything else starts a new one
+                if (KEY_EQ(key_hit, KI_L) && startReplay())
+                    randomSeed = getReplaySeed();
+                else
+                {
+                    randomSeed = frameCount;//2915;
+                    startRecording(randomSeed);
+                }
+
+                logMessage(LOG_GENERAL, MGBA_LOG_INFO, "RNG Seed: %d", randomSeed);
+
+                startFloors(randomSeed);
                 drawHUD();
 
-                initEntities();
-
-                #ifdef DEBUG
-                    mgba_printf(MGBA_LOG_INFO, "player startingPosition: (%d, %d)", player->posX, player->posY);
-                #endif
+                logMessage(LOG_GENERAL, MGBA_LOG_INFO, "player startingPosition: (%d, %d)",
+                    getEntityPosX(PLAYER_INDEX), getEntityPosY(PLAYER_INDEX));
                 #ifdef PRINT_MAP_DRAW
-                    printMapInLog();
+                    printMapLayersInLog(mapLayerBit(MAP_LAYER_TERRAIN) | mapLayerBit(MAP_LAYER_ENTITIES));
                 #endif
 
                 doStateTransition(STATE_GAMEPLAY);
@@ -269,28 +358,95 @@ int main(void)
             break;
         case STATE_GAMEPLAY:
             if (playerMoveOffsetX == 0 && playerMoveOffsetY == 0)
-                doPlayerInput();
-            if (turnOfEntityIndex != PLAYER_INDEX)
             {
-                doFOV(player->posX, player->posY, getEntitySightRange(player));
+                boolean canAct = isPlayerTurn();
+
+                // A fresh press acts on this frame ahead of any queued AI
+                // work. A held key or auto-travel keeps the AI budget and
+                // acts once the job list reaches the player
+                if (key_hit(KEY_ANY))
+                {
+                    flushEntityTurns();
+                    canAct = TRUE;
+                }
+                else if (key_is_down(KEY_ANY) || isPlayerAutoTravelActive())
+                    canAct = resolveHeldTurn(canAct);
+
+                if (canAct)
+                    doPlayerInput();
+            }
+            if (playerHasActed)
+            {
+                enum direction playerMoveDirection = getChangeSet()->playerMoveDirection;
+                u32 fovStartClock = 0;
+
+                // Scroll the map behind the player and mark the new turn's sight
+                if (playerMoveDirection != DIR_NULL)
+                {
+                    playerMoveOffsetX = -dirX[playerMoveDirection] * TILE_SIZE;
+                    playerMoveOffsetY = -dirY[playerMoveDirection] * TILE_SIZE;
+                    screenOffsetX += dirX[playerMoveDirection] * TILE_SIZE;
+                    screenOffsetY += dirY[playerMoveDirection] * TILE_SIZE;
+                }
+                playerSightId++;
+                noteReplayTurn();
+
+                movePlayerLight(getEntityPosX(PLAYER_INDEX), getEntityPosY(PLAYER_INDEX));
+                setFlowGoal(FLOW_GOAL_PLAYER, getEntityPosX(PLAYER_INDEX), getEntityPosY(PLAYER_INDEX));
+                updateLighting();
+                fovStartClock = getScanlineClock();
+                doFOV(getEntityPosX(PLAYER_INDEX), getEntityPosY(PLAYER_INDEX), getEntitySightRange(PLAYER_INDEX));
+                doEntityFOVs();
+                setPerfValue(PERF_FOV_CYCLES, getScanlinesSince(fovStartClock) * CYCLES_PER_SCANLINE);
+                #ifdef DEBUG_ENTITY
+                    if (!checkOccupancyConsistency())
+                        logMessage(LOG_ENTITY, MGBA_LOG_ERROR, "occupancy map out of sync");
+                #endif
                 REG_BLDALPHA= BLDA_BUILD(BG_0_BLEND_UP/8, blendingValue/8);
             }
+            processEntityTurns(SCHEDULER_CYCLE_BUDGET);
             updateGraphics();
-            
-            // If player found stairs
-            if (getTileTerrain(player->posX, player->posY) == ID_STAIRS)
-                doStateTransition(STATE_TITLE_SCREEN);
+
+            // Stepping onto stairs takes the player to the next floor, or out
+            // of the dungeon by the first floor's up stairs
+            if (getChangeSet()->playerMoveDirection != DIR_NULL)
+            {
+                int stairsId = getTileTerrain(getEntityPosX(PLAYER_INDEX), getEntityPosY(PLAYER_INDEX));
+
+                if (stairsId == ID_STAIRS || stairsId == ID_STAIRS_UP)
+                {
+                    if (changeFloor(stairsId == ID_STAIRS ? 1 : -1))
+                    {
+                        playerMoveOffsetX = 0;
+                        playerMoveOffsetY = 0;
+                        doStateTransition(STATE_GAMEPLAY);
+                    }
+                    else
+                        doStateTransition(STATE_TITLE_SCREEN);
+                }
+            }
+            clearChangeSet();
             break;
         case STATE_MENU:
             REG_BG1HOFS = 0;
             REG_BG1VOFS = 0;
             if(doPauseMenuInput())
-                drawPauseMenu();
+                updatePauseMenu();
             break;
         }
 
-        // Low-power for rest of frame
-        VBlankIntrWait();
+        // Copy the next part of a save in progress to SRAM
+        updateSave();
+
+        // Draining the log only fills idle time, so it isn't counted
+        endPerfFrame();
+
+        // Format deferred log lines in whatever time is left before VBlank
+        drainLog();
+
+        // Low-power for rest of frame, unless replaying flat out
+        if (!isReplaying())
+            VBlankIntrWait();
         frameCount++;
     }
 }
@@ -0,0 +1,283 @@
+#include <string.h>
+#include "../libtonc/include/tonc.h"
+#include "constants.h"
+#include "debug.h"
+#include "logBuffer.h"
+#include "mapCodec.h"
+#include "mapGeneration.h"
+#include "mgba.h"
+#include "tile.h"
+
+//------------------------------------------------------------------
+// Function Prototypes
+//------------------------------------------------------------------
+static int encodePlane(uint8_t const *plane, uint8_t *buffer, int const capacity);
+static int decodePlane(uint8_t const *buffer, int const size, uint8_t *plane);
+
+//------------------------------------------------------------------
+// Function: encodePlane
+//
+// Writes a bitset of one bit per tile, row by row, to the given
+// buffer in whichever form is smaller: a 1 followed by the lengths of
+// alternating runs of clear and set bits, a byte each, or a 0
+// followed by the bitset as it is. Longer runs are split with a
+// zero-length run of the other bit between. Returns the number of
+// bytes written, or -1 if the buffer is too small.
+//------------------------------------------------------------------
+static int encodePlane(uint8_t const *plane, uint8_t *buffer, int const capacity)
+{
+    int size = 1, index = 0, tileCount = MAP_WIDTH_TILES * MAP_HEIGHT_TILES;
+    int currentBit = 0;
+
+    if (capacity < 1 + MAP_PLANE_BYTES)
+        return -1;
+
+    // Stop once the runs are no smaller than the bitset
+    buffer[0] = 1;
+    while (index < tileCount && size < 1 + MAP_PLANE_BYTES)
+    {
+        int runLength = 0;
+
+        while (index < tileCount && runLength < MAP_PLANE_MAX_RUN
+            && ((plane[index / 8] >> (index % 8)) & 1) == currentBit)
+        {
+            runLength++;
+            index++;
+        }
+
+        buffer[size++] = runLength;
+        currentBit = !currentBit;
+    }
+
+    if (index < tileCount)
+    {
+        buffer[0] = 0;
+        memcpy(&buffer[1], plane, MAP_PLANE_BYTES);
+        size = 1 + MAP_PLANE_BYTES;
+    }
+
+    return size;
+}
+
+//------------------------------------------------------------------
+// Function: decodePlane
+//
+// Rebuilds a bitset written by encodePlane into the given plane of
+// MAP_PLANE_BYTES. Returns the number of bytes read, or -1 if they
+// don't cover the map exactly.
+//------------------------------------------------------------------
+static int decodePlane(uint8_t const *buffer, int const size, uint8_t *plane)
+{
+    int offset = 1, tileCount = MAP_WIDTH_TILES * MAP_HEIGHT_TILES;
+    int currentBit = 0;
+
+    if (size < 1)
+        return -1;
+
+    if (buffer[0] == 0)
+    {
+        if (size < 1 + MAP_PLANE_BYTES)
+            return -1;
+
+        memcpy(plane, &buffer[1], MAP_PLANE_BYTES);
+        return 1 + MAP_PLANE_BYTES;
+    }
+
+    memset(plane, 0, MAP_PLANE_BYTES);
+    for (int index = 0; index < tileCount; currentBit = !currentBit)
+    {
+        int runLength = 0;
+
+        if (offset >= size)
+            return -1;
+
+        runLength = buffer[offset++];
+        if (index + runLength > tileCount)
+            return -1;
+
+        for (int end = index + runLength; index < end; index++)
+            plane[index / 8] |= currentBit << (index % 8);
+    }
+
+    return offset;
+}
+
+//------------------------------------------------------------------
+// Function: encodeExplored
+//
+// Writes a plane of which tiles have been explored, as encodePlane.
+// Returns the number of bytes written, or -1 if the buffer is too
+// small.
+//------------------------------------------------------------------
+extern int encodeExplored(uint8_t *buffer, int const capacity)
+{
+    struct Tile const *tile = &gameMap[0][0];
+    uint8_t exploredPlane[MAP_PLANE_BYTES];
+
+    memset(exploredPlane, 0, sizeof(exploredPlane));
+    for (int index = 0; index < MAP_WIDTH_TILES * MAP_HEIGHT_TILES; index++)
+    {
+        if (tile[index].sightId != TILE_NEVER_SEEN)
+            exploredPlane[index / 8] |= 1 << (index % 8);
+    }
+
+    return encodePlane(exploredPlane, buffer, capacity);
+}
+
+//------------------------------------------------------------------
+// Function: decodeExplored
+//
+// Sets every tile's sight from bytes written by encodeExplored,
+// explored tiles to TILE_NOT_IN_SIGHT and the rest to
+// TILE_NEVER_SEEN. Returns the number of bytes read, or -1 if they
+// don't cover the map, leaving sight as it was.
+//------------------------------------------------------------------
+extern int decodeExplored(uint8_t const *buffer, int const size)
+{
+    struct Tile *tile = &gameMap[0][0];
+    uint8_t exploredPlane[MAP_PLANE_BYTES];
+    int planeSize = decodePlane(buffer, size, exploredPlane);
+
+    if (planeSize < 0)
+        return -1;
+
+    for (int index = 0; index < MAP_WIDTH_TILES * MAP_HEIGHT_TILES; index++)
+        tile[index].sightId = (exploredPlane[index / 8] & (1 << (index % 8))) ? TILE_NOT_IN_SIGHT : TILE_NEVER_SEEN;
+
+    return planeSize;
+}
+
+//------------------------------------------------------------------
+// Function: encodeFloor
+//
+// Writes the current map to the given buffer: the floor variant seed,
+// a plane of which tiles are walls, the tiles that are neither wall
+// nor their floor variant (stairs, dug out floor) as exceptions, and
+// a plane of which tiles have been explored. Floor variants are left
+// out since getFloorVariant recomputes them, which leaves the planes
+// mostly long runs. Returns the number of bytes written, or -1 if the
+// buffer is too small or there are more than MAP_FLOOR_MAX_EXCEPTIONS
+// exceptions.
+//------------------------------------------------------------------
+extern int encodeFloor(uint8_t *buffer, int const capacity)
+{
+    struct Tile const *tile = &gameMap[0][0];
+    uint8_t wallPlane[MAP_PLANE_BYTES];
+    int size = 0, planeSize = 0, exceptionCount = 0, countOffset = 0;
+    u32 variantSeed = getFloorVariantSeed();
+
+    if (capacity < 4)
+        return -1;
+
+    for (int i = 0; i < 4; i++)
+        buffer[size++] = (variantSeed >> (i * 8)) & 0xFF;
+
+    memset(wallPlane, 0, sizeof(wallPlane));
+    for (int index = 0; index < MAP_WIDTH_TILES * MAP_HEIGHT_TILES; index++)
+    {
+        if (tile[index].terrainId == ID_WALL)
+            wallPlane[index / 8] |= 1 << (index % 8);
+    }
+
+    planeSize = encodePlane(wallPlane, &buffer[size], capacity - size);
+    if (planeSize < 0)
+        return -1;
+    size += planeSize;
+
+    // Exception count, then (index low, index high, terrainId) each
+    countOffset = size;
+    size += 2;
+    for (int index = 0; index < MAP_WIDTH_TILES * MAP_HEIGHT_TILES; index++)
+    {
+        uint8_t terrainId = tile[index].terrainId;
+
+        if (terrainId == ID_WALL || terrainId == getFloorVariant(tile[index].posX, tile[index].posY))
+            continue;
+
+        if (exceptionCount == MAP_FLOOR_MAX_EXCEPTIONS || size + 3 > capacity)
+            return -1;
+
+        buffer[size++] = index & 0xFF;
+        buffer[size++] = index >> 8;
+        buffer[size++] = terrainId;
+        exceptionCount++;
+    }
+    buffer[countOffset] = exceptionCount & 0xFF;
+    buffer[countOffset + 1] = exceptionCount >> 8;
+
+    planeSize = encodeExplored(&buffer[size], capacity - size);
+    if (planeSize < 0)
+        return -1;
+
+    return size + planeSize;
+}
+
+//------------------------------------------------------------------
+// Function: decodeFloor
+//
+// Rebuilds gameMap from bytes written by encodeFloor: terrain, tile
+// positions, the stairs positions, and sight, with explored tiles as
+// TILE_NOT_IN_SIGHT, so playerSightId should be reset to
+// TILE_IN_SIGHT. Terrain is written directly, so whatever is derived
+// from it (occluders, lighting, flow fields) must be rebuilt
+// afterwards, as after generateGameMap. Returns the number of bytes
+// read, or -1 if they don't make a whole map.
+//------------------------------------------------------------------
+extern int decodeFloor(uint8_t const *buffer, int const size)
+{
+    struct Tile *tile = &gameMap[0][0];
+    uint8_t wallPlane[MAP_PLANE_BYTES];
+    int offset = 0, planeSize = 0, exceptionCount = 0;
+    u32 variantSeed = 0;
+
+    if (size < 4)
+        return -1;
+
+    for (int i = 0; i < 4; i++)
+        variantSeed |= buffer[offset++] << (i * 8);
+    setFloorVariantSeed(variantSeed);
+
+    planeSize = decodePlane(&buffer[offset], size - offset, wallPlane);
+    if (planeSize < 0)
+        return -1;
+    offset += planeSize;
+
+    for (int index = 0; index < MAP_WIDTH_TILES * MAP_HEIGHT_TILES; index++)
+    {
+        tile[index].posX = index % MAP_WIDTH_TILES;
+        tile[index].posY = index / MAP_WIDTH_TILES;
+        tile[index].terrainId = (wallPlane[index / 8] & (1 << (index % 8)))
+                              ? ID_WALL : getFloorVariant(tile[index].posX, tile[index].posY);
+    }
+
+    if (offset + 2 > size)
+        return -1;
+    exceptionCount = buffer[offset] | (buffer[offset + 1] << 8);
+    offset += 2;
+    if (offset + exceptionCount * 3 > size)
+        return -1;
+
+    for (int i = 0; i < exceptionCount; i++, offset += 3)
+    {
+        int index = buffer[offset] | (buffer[offset + 1] << 8);
+        uint8_t terrainId = buffer[offset + 2];
+
+        if (index >= MAP_WIDTH_TILES * MAP_HEIGHT_TILES || terrainId > ID_STAIRS_UP)
+            return -1;
+
+        tile[index].terrainId = terrainId;
+        if (terrainId == ID_STAIRS)
+            setStairsPosition(tile[index].posX, tile[index].posY);
+        else if (terrainId == ID_STAIRS_UP)
+            setUpStairsPosition(tile[index].posX, tile[index].posY);
+    }
+
+    planeSize = decodeExplored(&buffer[offset], size - offset);
+    if (planeSize < 0)
+        return -1;
+    offset += planeSize;
+
+    logMessage(LOG_MAP_GEN, MGBA_LOG_DEBUG, "decodeFloor: %d bytes, %d exceptions", offset, exceptionCount);
+
+    return offset;
+}
@@ -2,12 +2,21 @@
 #include <string.h>
 #include "../libtonc/include/tonc.h"
 #include "constants.h"
+#include "arena.h"
 #include "debug.h"
 #include "globals.h"
+#include "logBuffer.h"
 #include "mapGeneration.h"
 #include "mgba.h"
 #include "tile.h"
 
+//------------------------------------------------------------------
+// Global Variables
+//------------------------------------------------------------------
+static int stairsPosX = 0, stairsPosY = 0;
+static int upStairsPosX = 0, upStairsPosY = 0;
+static u32 floorVariantSeed = 0;           // Picks the look of each floor tile
+
 //------------------------------------------------------------------
 // Function Prototypes
 //------------------------------------------------------------------
@@ -15,9 +24,9 @@ static void initGameMap();
 static boolean placeRoom(int const startingX, int const startingY, int const width, int const height);
 static void carveMaze();
 static void ensureMapBoundarySolid();
-static void placeStairs();
+static void placeStairs(uint8_t const terrainId, int *stairsX, int *stairsY);
 static struct Tile* getUnmarkedTile(struct Tile* const tile);
-static void addEndNode(struct Node* const listHead, struct Tile *tile);
+static boolean addEndNode(struct Node* const listHead, struct Tile *tile);
 static void markEndNode(struct Node* const listHead);
 static void markSkippedOverTile(struct Node* listHead);
 static struct Node* deleteEndNode(struct Node *listHead);
@@ -42,9 +51,7 @@ static void initGameMap()
         }
     }
 
-    #ifdef DEBUG_MAP_GEN
-        mgba_printf(MGBA_LOG_DEBUG, "initGameMap");
-    #endif
+    logMessage(LOG_MAP_GEN, MGBA_LOG_DEBUG, "initGameMap");
 }
 
 //------------------------------------------------------------------
@@ -93,17 +100,22 @@ static boolean placeRoom(int const startingX, int const startingY, int const wid
 //------------------------------------------------------------------
 // Function: carveMaze
 // 
-// Carves a maze out of a map filled with wall tiles.
+// Carves a maze out of a map filled with wall tiles. The list of
+// nodes is a stack in the scratch arena. If the arena runs out, the
+// maze is left as carved so far, which is still connected.
 //------------------------------------------------------------------
 static void carveMaze()
 {
     struct Tile *currentTile = NULL;
-    struct Node *listHead = (struct Node*)malloc(sizeof(struct Node));
+    struct Node *listHead = (struct Node*)arenaAlloc(ARENA_SCRATCH, sizeof(struct Node));
 
     #ifdef DEBUG_MAP_GEN
         int nodeCount = 0, highestNodeCount = 0;
     #endif
 
+    if (listHead == NULL)
+        return;
+
     // Set the first node's tile
     listHead->tile = getTile(randomInRange(1, MAP_WIDTH_TILES - 2), randomInRange(1, MAP_HEIGHT_TILES - 2));
 
@@ -123,9 +135,7 @@ static void carveMaze()
     listHead->linkedNode = NULL;
     listHead->tileDirection = DIR_NULL;
 
-    #ifdef DEBUG_MAP_GEN
-        mgba_printf(MGBA_LOG_DEBUG, "carveMaze START");
-    #endif
+    logMessage(LOG_MAP_GEN, MGBA_LOG_DEBUG, "carveMaze START");
 
     // While there are still nodes(tiles) to check
     while (listHead != NULL)
@@ -162,7 +172,12 @@ static void carveMaze()
         {
             // Create a new end node and set currentTile to be its tile
             markSkippedOverTile(listHead);
-            addEndNode(listHead, currentTile);
+            if (!addEndNode(listHead, currentTile))
+            {
+                logMessage(LOG_MAP_GEN, MGBA_LOG_WARN, "carveMaze: out of scratch memory, maze left unfinished");
+                listHead = deleteAllNodes(listHead);
+                break;
+            }
             markEndNode(listHead);
         }
 
@@ -210,27 +225,119 @@ static void ensureMapBoundarySolid()
 //------------------------------------------------------------------
 // Function: placeStairs
 // 
-// Place the tile that allows transition to the next map.
+// Place a tile that allows transition to another map, of the given
+// terrainId, on a floor tile that doesn't already hold stairs.
 //------------------------------------------------------------------
-static void placeStairs()
+static void placeStairs(uint8_t const terrainId, int *stairsX, int *stairsY)
 {
-        int positionX = 0;
-        int positionY = 0;
+    int positionX = 0, positionY = 0;
 
     do
     {
         positionX = randomInRange(1, MAP_WIDTH_TILES - 1);
         positionY = randomInRange(1, MAP_HEIGHT_TILES - 1);
+    } while (isSolid(positionX, positionY) || getTileTerrain(positionX, positionY) == ID_STAIRS);
 
-        if (!isSolid(positionX, positionY))
-        {
-            setTileTerrain(positionX, positionY, ID_STAIRS);
+    setTileTerrain(positionX, positionY, terrainId);
+    *stairsX = positionX;
+    *stairsY = positionY;
 
-            #ifdef DEBUG_MAP_GEN
-                mgba_printf(MGBA_LOG_DEBUG, "placeStairs: (%d, %d)", positionX, positionY);
-            #endif
-        }
-    } while (isSolid(positionX, positionY));
+    logMessage(LOG_MAP_GEN, MGBA_LOG_DEBUG, "placeStairs: %d at (%d, %d)", terrainId, positionX, positionY);
+}
+
+//------------------------------------------------------------------
+// Function: getStairsPosition
+// 
+// Returns the position of the stairs placed by the last generated map.
+//------------------------------------------------------------------
+extern void getStairsPosition(int *positionX, int *positionY)
+{
+    *positionX = stairsPosX;
+    *positionY = stairsPosY;
+}
+
+//------------------------------------------------------------------
+// Function: setStairsPosition
+// 
+// Records the position of the stairs of a map that was loaded instead
+// of generated.
+//------------------------------------------------------------------
+extern void setStairsPosition(int const positionX, int const positionY)
+{
+    stairsPosX = positionX;
+    stairsPosY = positionY;
+}
+
+//------------------------------------------------------------------
+// Function: getUpStairsPosition
+// 
+// Returns the position of the stairs leading back up, where the player
+// arrives from the map above.
+//------------------------------------------------------------------
+extern void getUpStairsPosition(int *positionX, int *positionY)
+{
+    *positionX = upStairsPosX;
+    *positionY = upStairsPosY;
+}
+
+//------------------------------------------------------------------
+// Function: setUpStairsPosition
+// 
+// Records the position of the up stairs of a map that was loaded
+// instead of generated.
+//------------------------------------------------------------------
+extern void setUpStairsPosition(int const positionX, int const positionY)
+{
+    upStairsPosX = positionX;
+    upStairsPosY = positionY;
+}
+
+//------------------------------------------------------------------
+// Function: getFloorVariant
+// 
+// Returns which look of floor the given position gets on the current
+// map. It is a hash of the position and the map's variant seed rather
+// than a draw from the random sequence, so encoded maps can leave the
+// variants out and recompute them.
+//------------------------------------------------------------------
+extern uint8_t getFloorVariant(int const positionX, int const positionY)
+{
+    u32 hash = (positionX * 73856093u) ^ (positionY * 19349663u) ^ floorVariantSeed;
+
+    hash ^= hash >> 15;
+    hash *= 0x2C1B3C6Du;
+    hash ^= hash >> 12;
+
+    switch ((hash >> 8) % 6)
+    {
+    case 1:
+        return ID_FLOOR_CHIP;
+    case 2:
+        return ID_FLOOR_MOSSY;
+    default:
+        return ID_FLOOR;
+    }
+}
+
+//------------------------------------------------------------------
+// Function: getFloorVariantSeed
+// 
+// Returns the seed getFloorVariant uses for the current map.
+//------------------------------------------------------------------
+extern u32 getFloorVariantSeed()
+{
+    return floorVariantSeed;
+}
+
+//------------------------------------------------------------------
+// Function: setFloorVariantSeed
+// 
+// Restores the variant seed of a map that was loaded instead of
+// generated.
+//------------------------------------------------------------------
+extern void setFloorVariantSeed(u32 const seed)
+{
+    floorVariantSeed = seed;
 }
 
 //------------------------------------------------------------------
@@ -291,9 +398,10 @@ static struct Tile* getUnmarkedTile(struct Tile* const tile)
 //------------------------------------------------------------------
 // Function: addEndNode
 // 
-// Adds a new node at the end of the given linked list.
+// Adds a new node at the end of the given linked list. Returns FALSE,
+// leaving the list as it was, if the scratch arena is full.
 //------------------------------------------------------------------
-static void addEndNode(struct Node* listHead, struct Tile* tile)
+static boolean addEndNode(struct Node* listHead, struct Tile* tile)
 {
     struct Node *currentEnd = NULL, *newEnd = NULL;
 
@@ -308,7 +416,10 @@ static void addEndNode(struct Node* listHead, struct Tile* tile)
     }
 
     // Store new end node's data
-    newEnd = (struct Node*)malloc(sizeof(struct Node));
+    newEnd = (struct Node*)arenaAlloc(ARENA_SCRATCH, sizeof(struct Node));
+    if (newEnd == NULL)
+        return FALSE;
+
     newEnd->tile = tile;
     newEnd->linkedNode = NULL;
     
@@ -323,6 +434,8 @@ static void addEndNode(struct Node* listHead, struct Tile* tile)
 
     // Link new end node to the end of the list
     currentEnd->linkedNode = newEnd;
+
+    return TRUE;
 }
 
 //------------------------------------------------------------------
@@ -397,7 +510,7 @@ static struct Node* deleteEndNode(struct Node *listHead)
     // we are deleting the linked list
     else if (listHead->linkedNode == NULL)
     {
-        free(listHead);
+        releaseArena(ARENA_SCRATCH, listHead);
         listHead = NULL;
 
         #ifdef PRINT_MAZE_MARKING
@@ -418,8 +531,9 @@ static struct Node* deleteEndNode(struct Node *listHead)
         // Set the penultimate node's link to NULL
         penUltNode->linkedNode = NULL;
 
-        // Now we can safely free the end node
-        free(endNode);
+        // Now we can safely free the end node, which is always the newest
+        // allocation as the list is only ever grown and shrunk at its end
+        releaseArena(ARENA_SCRATCH, endNode);
         endNode = NULL;
     }
 
@@ -450,7 +564,7 @@ static struct Node* deleteAllNodes(struct Node *listHead)
     while (temp != NULL)
     {
         temp = temp->linkedNode;
-        free(listHead);
+        releaseArena(ARENA_SCRATCH, listHead);
         listHead = temp;
     }
 
@@ -496,12 +610,11 @@ extern void generateGameMap()
 {
     int placeRoomFailures = 0;
 
-    #ifdef DEBUG_MAP_GEN
-        mgba_printf(MGBA_LOG_DEBUG, "generateGameMap");
-    #endif
+    logMessage(LOG_MAP_GEN, MGBA_LOG_DEBUG, "generateGameMap");
 
     // Set starting values for gameMap[][]
     initGameMap();
+    floorVariantSeed = nextRandom();
 
     // Place Rooms
     while (placeRoomFailures < 20)
@@ -538,16 +651,11 @@ extern void generateGameMap()
         for (int x = 1; x < MAP_WIDTH_TILES - 1; x++)
         {
             if (getTileTerrain(x, y) == ID_FLOOR)
-            {
-                switch(randomInRange(0, 5))
-                {
-                case 1: setTileTerrain(x, y, ID_FLOOR_CHIP);    break;
-                case 2: setTileTerrain(x, y, ID_FLOOR_MOSSY);   break;
-                }
-            }
+                setTileTerrain(x, y, getFloorVariant(x, y));
         }
     }
 
     ensureMapBoundarySolid();
-    placeStairs();
+    placeStairs(ID_STAIRS, &stairsPosX, &stairsPosY);
+    placeStairs(ID_STAIRS_UP, &upStairsPosX, &upStairsPosY);
 }
@@ -0,0 +1,322 @@
+#include <string.h>
+#include "../libtonc/include/tonc.h"
+#include "constants.h"
+#include "debug.h"
+#include "flowField.h"
+#include "globals.h"
+#include "logBuffer.h"
+#include "mapGeneration.h"
+#include "mgba.h"
+#include "pathfinding.h"
+#include "tile.h"
+
+//------------------------------------------------------------------
+// Data Structures
+//------------------------------------------------------------------
+static struct PathNode pathNode[MAP_WIDTH_TILES * MAP_HEIGHT_TILES] EWRAM_BSS;
+static uint16_t bucketHead[PATH_BUCKET_COUNT];    // Open nodes grouped by f-cost
+static struct PathSearch pathSearch;
+
+//------------------------------------------------------------------
+// Function Prototypes
+//------------------------------------------------------------------
+static int estimateCost(int const tileIndex);
+static void pushOpenNode(int const tileIndex);
+static void unlinkOpenNode(int const tileIndex);
+static struct PathNode* getFreshNode(int const tileIndex);
+
+//------------------------------------------------------------------
+// Function: estimateCost
+//
+// Returns the Manhattan distance from the given tile to the start of
+// the search, which never overestimates on a four-way grid.
+//------------------------------------------------------------------
+static int estimateCost(int const tileIndex)
+{
+    return ABS(tileIndex % MAP_WIDTH_TILES - pathSearch.startX)
+         + ABS(tileIndex / MAP_WIDTH_TILES - pathSearch.startY);
+}
+
+//------------------------------------------------------------------
+// Function: pushOpenNode
+//
+// Links the given node to the front of the bucket for its f-cost.
+//------------------------------------------------------------------
+static void pushOpenNode(int const tileIndex)
+{
+    struct PathNode *node = &pathNode[tileIndex];
+    int bucket = (node->costSoFar + estimateCost(tileIndex)) % PATH_BUCKET_COUNT;
+
+    node->prevInBucket = PATH_NODE_NULL;
+    node->nextInBucket = bucketHead[bucket];
+    if (bucketHead[bucket] != PATH_NODE_NULL)
+        pathNode[bucketHead[bucket]].prevInBucket = tileIndex;
+    bucketHead[bucket] = tileIndex;
+
+    pathSearch.openCount++;
+}
+
+//------------------------------------------------------------------
+// Function: unlinkOpenNode
+//
+// Removes the given node from its f-cost bucket.
+//------------------------------------------------------------------
+static void unlinkOpenNode(int const tileIndex)
+{
+    struct PathNode *node = &pathNode[tileIndex];
+    int bucket = (node->costSoFar + estimateCost(tileIndex)) % PATH_BUCKET_COUNT;
+
+    if (node->prevInBucket != PATH_NODE_NULL)
+        pathNode[node->prevInBucket].nextInBucket = node->nextInBucket;
+    else
+        bucketHead[bucket] = node->nextInBucket;
+
+    if (node->nextInBucket != PATH_NODE_NULL)
+        pathNode[node->nextInBucket].prevInBucket = node->prevInBucket;
+
+    pathSearch.openCount--;
+}
+
+//------------------------------------------------------------------
+// Function: getFreshNode
+//
+// Returns the node for the given tile, resetting it first if it was
+// last touched by an older search.
+//------------------------------------------------------------------
+static struct PathNode* getFreshNode(int const tileIndex)
+{
+    struct PathNode *node = &pathNode[tileIndex];
+
+    if (node->generation != pathSearch.generation)
+    {
+        node->generation = pathSearch.generation;
+        node->costSoFar = PATH_COST_UNKNOWN;
+        node->parent = PATH_NODE_NULL;
+        node->isClosed = FALSE;
+    }
+
+    return node;
+}
+
+//------------------------------------------------------------------
+// Function: startPathSearch
+//
+// Begins a new search for a path from start to goal. The search runs
+// backwards from the goal so that each node's parent points one step
+// closer to the goal, letting a walker follow getPathDirection. Nodes
+// from older searches are invalidated by bumping the generation rather
+// than clearing the table. Call continuePathSearch to do the work.
+//------------------------------------------------------------------
+extern void startPathSearch(int const startX, int const startY, int const goalX, int const goalY)
+{
+    int goalIndex = goalY * MAP_WIDTH_TILES + goalX;
+
+    memset(bucketHead, 0xFF, sizeof(bucketHead));
+    pathSearch.openCount = 0;
+    pathSearch.expansions = 0;
+
+    if (isOutOfBounds(startX, startY) || isOutOfBounds(goalX, goalY) || isSolid(goalX, goalY))
+    {
+        pathSearch.status = PATH_NOT_FOUND;
+        return;
+    }
+
+    // Only clear the table when the generation wraps around
+    if (++pathSearch.generation == 0)
+    {
+        memset(pathNode, 0, sizeof(pathNode));
+        pathSearch.generation = 1;
+    }
+
+    pathSearch.startX = startX;
+    pathSearch.startY = startY;
+    pathSearch.goalX = goalX;
+    pathSearch.goalY = goalY;
+    pathSearch.status = PATH_SEARCHING;
+
+    getFreshNode(goalIndex)->costSoFar = 0;
+    pathSearch.lowestCost = estimateCost(goalIndex);
+    pushOpenNode(goalIndex);
+}
+
+//------------------------------------------------------------------
+// Function: continuePathSearch
+//
+// Expands at most the given number of nodes, lowest f-cost first, and
+// returns the search status. A search left PATH_SEARCHING picks up
+// where it stopped on the next call.
+//------------------------------------------------------------------
+extern enum pathStatus continuePathSearch(int const maxExpansions)
+{
+    int startIndex = pathSearch.startY * MAP_WIDTH_TILES + pathSearch.startX;
+
+    for (int expanded = 0; expanded < maxExpansions && pathSearch.status == PATH_SEARCHING; expanded++)
+    {
+        int tileIndex = 0, currentX = 0, currentY = 0;
+        struct PathNode *node = NULL;
+
+        if (pathSearch.openCount == 0)
+        {
+            pathSearch.status = PATH_NOT_FOUND;
+            break;
+        }
+
+        while (bucketHead[pathSearch.lowestCost % PATH_BUCKET_COUNT] == PATH_NODE_NULL)
+            pathSearch.lowestCost++;
+
+        tileIndex = bucketHead[pathSearch.lowestCost % PATH_BUCKET_COUNT];
+        node = &pathNode[tileIndex];
+        unlinkOpenNode(tileIndex);
+        node->isClosed = TRUE;
+        pathSearch.expansions++;
+
+        if (tileIndex == startIndex)
+        {
+            pathSearch.status = PATH_FOUND;
+            break;
+        }
+
+        currentX = tileIndex % MAP_WIDTH_TILES;
+        currentY = tileIndex / MAP_WIDTH_TILES;
+
+        for (int direction = DIR_LEFT; direction <= DIR_DOWN; direction++)
+        {
+            int neighbourX = currentX + dirX[direction], neighbourY = currentY + dirY[direction];
+            int neighbourIndex = neighbourY * MAP_WIDTH_TILES + neighbourX;
+            struct PathNode *neighbour = NULL;
+
+            if (isOutOfBounds(neighbourX, neighbourY) || isSolid(neighbourX, neighbourY))
+                continue;
+
+            neighbour = getFreshNode(neighbourIndex);
+            if (neighbour->isClosed || neighbour->costSoFar <= node->costSoFar + 1)
+                continue;
+
+            if (neighbour->costSoFar != PATH_COST_UNKNOWN)
+                unlinkOpenNode(neighbourIndex);
+
+            neighbour->costSoFar = node->costSoFar + 1;
+            neighbour->parent = tileIndex;
+            pushOpenNode(neighbourIndex);
+        }
+    }
+
+    if (pathSearch.status != PATH_SEARCHING)
+        logMessage(LOG_ENTITY, MGBA_LOG_DEBUG, "continuePathSearch: status %d after %d expansions",
+            pathSearch.status, pathSearch.expansions);
+
+    return pathSearch.status;
+}
+
+//------------------------------------------------------------------
+// Function: getPathStatus
+//
+// Returns the status of the current search.
+//------------------------------------------------------------------
+extern enum pathStatus getPathStatus()
+{
+    return pathSearch.status;
+}
+
+//------------------------------------------------------------------
+// Function: getPathExpansions
+//
+// Returns the number of nodes expanded by the current search so far.
+//------------------------------------------------------------------
+extern int getPathExpansions()
+{
+    return pathSearch.expansions;
+}
+
+//------------------------------------------------------------------
+// Function: getPathLength
+//
+// Returns the number of steps in the found path, or -1 if the search
+// hasn't found one.
+//------------------------------------------------------------------
+extern int getPathLength()
+{
+    if (pathSearch.status != PATH_FOUND)
+        return -1;
+
+    return pathNode[pathSearch.startY * MAP_WIDTH_TILES + pathSearch.startX].costSoFar;
+}
+
+//------------------------------------------------------------------
+// Function: getPathDirection
+//
+// Returns the direction of the next step towards the goal from the
+// given position, or DIR_NULL if the position isn't on a path closed
+// by the current search.
+//------------------------------------------------------------------
+extern enum direction getPathDirection(int const positionX, int const positionY)
+{
+    struct PathNode *node = NULL;
+
+    if (isOutOfBounds(positionX, positionY))
+        return DIR_NULL;
+
+    node = &pathNode[positionY * MAP_WIDTH_TILES + positionX];
+    if (node->generation != pathSearch.generation || node->isClosed == FALSE || node->parent == PATH_NODE_NULL)
+        return DIR_NULL;
+
+    for (int direction = DIR_LEFT; direction <= DIR_DOWN; direction++)
+    {
+        if ((positionY + dirY[direction]) * MAP_WIDTH_TILES + positionX + dirX[direction] == node->parent)
+            return direction;
+    }
+
+    return DIR_NULL;
+}
+
+//------------------------------------------------------------------
+// Function: benchmarkPathfinding
+//
+// Searches from random open tiles to the stairs, logging the cycles
+// and node expansions per search and the number of frames a search
+// takes at PATH_EXPANSIONS_PER_FRAME. Path lengths are checked
+// against the stairs flow field.
+//------------------------------------------------------------------
+#ifdef DEBUG_BENCHMARK
+extern void benchmarkPathfinding()
+{
+    int const searchCount = 32;
+    int stairsX = 0, stairsY = 0, totalExpansions = 0, worstFrames = 0, wrongLengths = 0;
+    uint cycles = 0;
+
+    getStairsPosition(&stairsX, &stairsY);
+
+    for (int search = 0; search < searchCount; search++)
+    {
+        int positionX = 0, positionY = 0, frames = 0;
+        uint16_t flowDistance = 0;
+
+        do
+        {
+            positionX = randomInRange(1, MAP_WIDTH_TILES - 2);
+            positionY = randomInRange(1, MAP_HEIGHT_TILES - 2);
+        } while (isSolid(positionX, positionY));
+
+        profile_start();
+        startPathSearch(positionX, positionY, stairsX, stairsY);
+        continuePathSearch(MAP_WIDTH_TILES * MAP_HEIGHT_TILES);
+        cycles += profile_stop();
+        totalExpansions += getPathExpansions();
+
+        flowDistance = getFlowDistance(FLOW_GOAL_STAIRS, positionX, positionY);
+        if ((flowDistance == FLOW_DISTANCE_UNREACHABLE) ? getPathStatus() != PATH_NOT_FOUND : getPathLength() != flowDistance)
+            wrongLengths++;
+
+        // Same search again, capped per frame
+        startPathSearch(positionX, positionY, stairsX, stairsY);
+        while (continuePathSearch(PATH_EXPANSIONS_PER_FRAME) == PATH_SEARCHING)
+            frames++;
+        worstFrames = MAX(worstFrames, frames + 1);
+    }
+
+    mgba_printf(MGBA_LOG_INFO, "benchmarkPathfinding: %d searches, %d wrong lengths", searchCount, wrongLengths);
+    mgba_printf(MGBA_LOG_INFO, "  %d cycles and %d expansions per search, %d cycles per expansion",
+        cycles / searchCount, totalExpansions / searchCount, cycles / MAX(totalExpansions, 1));
+    mgba_printf(MGBA_LOG_INFO, "  worst search spans %d frames", worstFrames);
+}
+#endif
@@ -1,67 +1,38 @@
 #include <string.h>
 #include "../libtonc/include/tonc.h"
 #include "constants.h"
+#include "arena.h"
 #include "debug.h"
 #include "entity.h"
 #include "globals.h"
 #include "fieldOfVision.h"
+#include "logBuffer.h"
 #include "mgba.h"
 #include "pauseMenu.h"
+#include "perfOverlay.h"
+#include "replay.h"
+#include "saveGame.h"
+#include "textPage.h"
 #include "tile.h"
 
 //------------------------------------------------------------------
-// Function Prototypes
+// Data Structures
 //------------------------------------------------------------------
-static void tte_write_var_int(int const varToPrint);
-
-//------------------------------------------------------------------
-// Function: tte_write_var_int
-// 
-// Tonc's Text Engine: write variable integers
-// Prints as 8x8 graphical tiles each digit of the given number.
-// Used in the debug menu to print variable integers.
-//------------------------------------------------------------------
-static void tte_write_var_int(int const varToPrint)
+static struct TextField const pauseMenuFields[NUM_PAUSE_MENU_FIELDS] =
 {
-    for (int digitPlace = 1000000000; digitPlace >= 1; digitPlace = digitPlace / 10)
-    {
-        int numberToPrint = varToPrint / digitPlace % 10;
+    // Label                      Row  Label X  Slot X  Slot width
+    {"Pause Menu\t\tRNG Seed:",   0,   0,       160,    80},  // PAUSE_MENU_SEED
+    {"Player position",           1,   0,       160,    80},  // PAUSE_MENU_POSITION
+    {"Player sightId:",           2,   0,       160,    80},  // PAUSE_MENU_SIGHT_ID
+    {"UP/DOWN\tSight Range:",     3,   0,       160,    80},  // PAUSE_MENU_SIGHT_RANGE
+    {"LEFT/RIGHT\tBG Blending:",  4,   0,       160,    80},  // PAUSE_MENU_BLENDING
+    {"A-BUTTON\tCollision:",      5,   0,       160,    80},  // PAUSE_MENU_COLLISION
+    {"B-BUTTON\tMapVisible:",     6,   0,       160,    80},  // PAUSE_MENU_MAP_VISIBLE
+    {"SELECT\tFOV:",              7,   0,       160,    80},  // PAUSE_MENU_FOV
+    {"L-BUTTON\tSave:",           8,   0,       160,    80}   // PAUSE_MENU_SAVE
+};
 
-        switch(numberToPrint)
-        {
-        case 9:
-            tte_write("9");
-            break;
-        case 8:
-            tte_write("8");
-            break;
-        case 7:
-            tte_write("7");
-            break;
-        case 6:
-            tte_write("6");
-            break;
-        case 5:
-            tte_write("5");
-            break;
-        case 4:
-            tte_write("4");
-            break;
-        case 3:
-            tte_write("3");
-            break;
-        case 2:
-            tte_write("2");
-            break;
-        case 1:
-            tte_write("1");
-            break;
-        case 0:
-            if (digitPlace < varToPrint)
-                tte_write("0");
-        }
-    }
-}
+static struct TextPage pauseMenuPage = {pauseMenuFields, NUM_PAUSE_MENU_FIELDS};
 
 //------------------------------------------------------------------
 // Function: doPauseMenuInput
@@ -71,7 +42,7 @@ static void tte_write_var_int(int const varToPrint)
 //------------------------------------------------------------------
 extern boolean doPauseMenuInput()
 {
-    struct Entity *player = getEntity(PLAYER_INDEX);
+    int sightRange = entityPool.sightRange[PLAYER_INDEX];
 
     if (KEY_EQ(key_hit, KI_A))
     {
@@ -95,14 +66,31 @@ extern boolean doPauseMenuInput()
     }
     if (KEY_EQ(key_hit, KI_UP))
     {
-        setEntitySightRange(player, clamp(player->sightRange + 1, SIGHT_RANGE_SELF, SIGHT_RANGE_MAX + 1));
+        setEntitySightRange(PLAYER_INDEX, clamp(sightRange + 1, SIGHT_RANGE_SELF, SIGHT_RANGE_MAX + 1));
         return TRUE;
     }
     if (KEY_EQ(key_hit, KI_DOWN))
     {
-        setEntitySightRange(player, clamp(player->sightRange - 1, SIGHT_RANGE_SELF, SIGHT_RANGE_MAX + 1));
+        setEntitySightRange(PLAYER_INDEX, clamp(sightRange - 1, SIGHT_RANGE_SELF, SIGHT_RANGE_MAX + 1));
         return TRUE;
     }
+    if (KEY_EQ(key_hit, KI_SELECT))
+    {
+        fovAlgorithm = (fovAlgorithm + 1) % NUM_FOV_ALGORITHMS;
+        return TRUE;
+    }
+    if (KEY_EQ(key_hit, KI_L))
+    {
+        startSave();
+        return TRUE;
+    }
+    #ifdef DEBUG_BENCHMARK
+    if (KEY_EQ(key_hit, KI_R))
+    {
+        runBenchmarks();
+        return FALSE;
+    }
+    #endif
     if (KEY_EQ(key_hit, KI_START))
     {
         doStateTransition(STATE_GAMEPLAY);
@@ -115,32 +103,49 @@ extern boolean doPauseMenuInput()
 //------------------------------------------------------------------
 // Function: drawPauseMenu
 // 
-// Prints the menu's text as 8x8 graphical tiles into the menu's
-// screen entries
+// Lays out the menu's labels as 8x8 graphical tiles into the menu's
+// screen entries, then fills in every value. Called when the menu
+// opens.
 //------------------------------------------------------------------
 extern void drawPauseMenu()
 {
-    struct Entity *player = getEntity(PLAYER_INDEX);
+    drawTextPage(&pauseMenuPage);
+    updatePauseMenu();
+}
 
-    tte_erase_screen();
-    tte_set_pos(0, 0);
-    tte_write("Pause Menu\t\t\tRNG Seed: ");
-    tte_write_var_int(randomSeed);
-    tte_write("\nPlayer position (");
-    tte_write_var_int(player->posX);
-    tte_write(", ");
-    tte_write_var_int(player->posY);
-    tte_write(")");
-    tte_write("\nPlayer sightId: ");
-    tte_write_var_int(playerSightId);
-    tte_write("\nUP/DOWN\tSight Range: ");
-    tte_write_var_int(player->sightRange);
-    tte_write("\nLEFT/RIGHT\tBG Blending: ");
-    tte_write_var_int(blendingValue);
-    tte_write("\nA-BUTTON\tCollision: ");
-    (debugCollisionIsOff == TRUE) ? tte_write("OFF") : tte_write("ON");
-    tte_write("\nB-BUTTON\tMapVisible: ");
-    (debugMapIsVisible == TRUE) ? tte_write("ON") : tte_write("OFF");
+//------------------------------------------------------------------
+// Function: updatePauseMenu
+// 
+// Redraws the menu's values that have changed since they were last
+// drawn. Called after every menu input that changes one.
+//------------------------------------------------------------------
+extern void updatePauseMenu()
+{
+    char text[TEXT_FIELD_MAX_CHARS];
+    char *end = text;
+
+    setTextFieldInt(&pauseMenuPage, PAUSE_MENU_SEED, randomSeed);
+
+    *end++ = '(';
+    end = formatInt(end, getEntityPosX(PLAYER_INDEX));
+    *end++ = ',';
+    *end++ = ' ';
+    end = formatInt(end, getEntityPosY(PLAYER_INDEX));
+    *end++ = ')';
+    *end = '\0';
+    setTextField(&pauseMenuPage, PAUSE_MENU_POSITION, text);
+
+    setTextFieldInt(&pauseMenuPage, PAUSE_MENU_SIGHT_ID, playerSightId);
+    setTextFieldInt(&pauseMenuPage, PAUSE_MENU_SIGHT_RANGE, entityPool.sightRange[PLAYER_INDEX]);
+    setTextFieldInt(&pauseMenuPage, PAUSE_MENU_BLENDING, blendingValue);
+    setTextField(&pauseMenuPage, PAUSE_MENU_COLLISION, (debugCollisionIsOff == TRUE) ? "OFF" : "ON");
+    setTextField(&pauseMenuPage, PAUSE_MENU_MAP_VISIBLE, (debugMapIsVisible == TRUE) ? "ON" : "OFF");
+    setTextField(&pauseMenuPage, PAUSE_MENU_FOV, getFOVAlgorithmName(fovAlgorithm));
+
+    text[0] = '\0';
+    if (getLastSaveSize() > 0)
+        strcpy(formatInt(text, getLastSaveSize()), " bytes");
+    setTextField(&pauseMenuPage, PAUSE_MENU_SAVE, text);
 }
 
 //------------------------------------------------------------------
@@ -154,18 +159,22 @@ extern void doStateTransition(enum state const targetState)
     switch(targetState)
     {
     case STATE_TITLE_SCREEN:
+        stopRecording();
+        finishReplay();
+        resetArena(ARENA_FLOOR);
         gameState = STATE_TITLE_SCREEN;
         break;
     case STATE_GAMEPLAY:
-        struct Entity *player = getEntity(PLAYER_INDEX);
+        int playerX = getEntityPosX(PLAYER_INDEX), playerY = getEntityPosY(PLAYER_INDEX);
 
         REG_BG0CNT= BG_CBB(0) | BG_SBB(GAME_HUD_SB) | BG_4BPP | BG_REG_32x32;
         REG_BG1CNT= BG_CBB(0) | BG_SBB(FOV_SB) | BG_4BPP | BG_REG_32x32;
         REG_BG2CNT= BG_CBB(0) | BG_SBB(GAME_MAP_SB) | BG_4BPP | BG_REG_32x32;
         REG_DISPCNT= DCNT_MODE0 | DCNT_BG0 | DCNT_BG1 | DCNT_BG2 | DCNT_OBJ | DCNT_OBJ_1D;
 
-        doFOV(player->posX, player->posY, player->sightRange);
-        drawGameMap(player->posX - SCREEN_WIDTH_TILES / 2, player->posY - SCREEN_HEIGHT_TILES / 2);
+        doFOV(playerX, playerY, entityPool.sightRange[PLAYER_INDEX]);
+        drawGameMap(playerX - SCREEN_WIDTH_TILES / 2, playerY - SCREEN_HEIGHT_TILES / 2);
+        redrawPerfOverlay();
         gameState = STATE_GAMEPLAY;
         break;
     case STATE_MENU:
@@ -173,14 +182,12 @@ extern void doStateTransition(enum state const targetState)
         REG_DISPCNT= DCNT_MODE0 | DCNT_BG1 | DCNT_OBJ_1D;
 
         tte_init_chr4c(SCREEN_BG_1, BG_CBB(1) | BG_SBB(PAUSE_MENU_SB), 0xF000, 0x0201, CLR_ORANGE<<16|CLR_BLACK, &vwf_default, NULL);
-        drawPauseMenu(blendingValue);
+        drawPauseMenu();
         gameState = STATE_MENU;
         break;
     default:
         break;
     }
 
-    #ifdef DEBUG
-        mgba_printf(MGBA_LOG_DEBUG, "doStateTransition: targetState: %d", targetState);
-    #endif
+    logMessage(LOG_GENERAL, MGBA_LOG_DEBUG, "doStateTransition: targetState: %d", targetState);
 }
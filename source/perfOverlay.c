@@ -0,0 +1,255 @@
+#include <string.h>
+#include "../libtonc/include/tonc.h"
+#include "constants.h"
+#include "entity.h"
+#include "globals.h"
+#include "perfOverlay.h"
+
+//------------------------------------------------------------------
+// Data Structures
+//------------------------------------------------------------------
+static struct PerfField const perfFields[NUM_PERF_FIELDS] =
+{
+    // Label    Column  Row  Width
+    {"FRAME",    0,     0,   7},               // PERF_FRAME_CYCLES
+    {"CPU%",    16,     0,   3},               // PERF_CPU_PERCENT
+    {"FOV",      0,     1,   7},               // PERF_FOV_CYCLES
+    {"DRAW",    16,     1,   7},               // PERF_REDRAW_CYCLES
+    {"VRAM",     0,     2,   7},               // PERF_VRAM_BYTES
+    {"ENT",     16,     2,   3}                // PERF_ENTITY_COUNT
+};
+
+//------------------------------------------------------------------
+// Global Variables
+//------------------------------------------------------------------
+u32 vramWriteCount = 0;
+
+static volatile u32 vblankCount = 0;
+static boolean isOverlayVisible = FALSE;
+static u32 perfValue[NUM_PERF_FIELDS];
+static u32 shownValue[NUM_PERF_FIELDS];    // What the overlay shows
+
+// The sample in progress, in scanlines
+static u32 frameStartClock = 0;
+static int sampleFrames = 0;
+static u32 sampleBusyLines = 0, worstFrameLines = 0, worstVramBytes = 0;
+
+//------------------------------------------------------------------
+// Function Prototypes
+//------------------------------------------------------------------
+static void countVBlank();
+static void drawPerfField(enum perfField const field);
+static void drawPerfOverlay();
+static void clearPerfOverlay();
+
+//------------------------------------------------------------------
+// Function: countVBlank
+//
+// VBlank interrupt handler that keeps the frame count behind
+// getScanlineClock.
+//------------------------------------------------------------------
+static void countVBlank()
+{
+    vblankCount++;
+}
+
+//------------------------------------------------------------------
+// Function: drawPerfField
+//
+// Writes a field's value into its slot, right-aligned in a single
+// pass from the last digit. Values too wide for the slot show as all
+// nines.
+//------------------------------------------------------------------
+static void drawPerfField(enum perfField const field)
+{
+    struct PerfField const *slot = &perfFields[field];
+    char text[12];
+    u32 value = perfValue[field];
+    int i = slot->width;
+
+    text[i] = '\0';
+    do
+    {
+        text[--i] = '0' + value % 10;
+        value /= 10;
+    } while (value > 0 && i > 0);
+
+    if (value > 0)
+        memset(text, '9', slot->width);
+    else
+        memset(text, ' ', i);
+
+    tte_set_pos((slot->column + strlen(slot->label) + 1) * 8, (PERF_OVERLAY_ROW + slot->row) * 8);
+    tte_write(text);
+
+    shownValue[field] = perfValue[field];
+    vramWriteCount += slot->width * 2;
+}
+
+//------------------------------------------------------------------
+// Function: drawPerfOverlay
+//
+// Sets up the text engine on the HUD layer and draws the labels and
+// every value. The font goes in the HUD's charblock after the tileset
+// and uses its own palette bank, so the hearts are left alone.
+//------------------------------------------------------------------
+static void drawPerfOverlay()
+{
+    tte_init_se(SCREEN_BG_0, BG_CBB(0) | BG_SBB(GAME_HUD_SB) | BG_4BPP | BG_REG_32x32,
+        SE_PALBANK(PERF_OVERLAY_PALBANK) | PERF_OVERLAY_FONT_TILE, CLR_YELLOW, 0, &fwf_default, NULL);
+    clearPerfOverlay();
+
+    for (int field = 0; field < NUM_PERF_FIELDS; field++)
+    {
+        tte_set_pos(perfFields[field].column * 8, (PERF_OVERLAY_ROW + perfFields[field].row) * 8);
+        tte_write(perfFields[field].label);
+        drawPerfField(field);
+    }
+}
+
+//------------------------------------------------------------------
+// Function: clearPerfOverlay
+//
+// Fills the overlay's rows of the HUD layer with the transparent tile.
+//------------------------------------------------------------------
+static void clearPerfOverlay()
+{
+    memset16(&se_mem[GAME_HUD_SB][PERF_OVERLAY_ROW * SCREEN_BLOCK_SIZE], 0, PERF_OVERLAY_ROWS * SCREEN_BLOCK_SIZE);
+    vramWriteCount += PERF_OVERLAY_ROWS * SCREEN_BLOCK_SIZE * 2;
+}
+
+//------------------------------------------------------------------
+// Function: initPerfOverlay
+//
+// Starts counting VBlanks for getScanlineClock. Called once at
+// start-up, after irq_init.
+//------------------------------------------------------------------
+extern void initPerfOverlay()
+{
+    irq_add(II_VBLANK, countVBlank);
+}
+
+//------------------------------------------------------------------
+// Function: getScanlineClock
+//
+// Returns the scanlines drawn since start-up, counted from the first
+// VBlank. A scanline is CYCLES_PER_SCANLINE cycles, which is fine
+// enough for frame and turn costs and leaves the timers to the
+// scheduler, the replay and profile_start.
+//------------------------------------------------------------------
+extern u32 getScanlineClock()
+{
+    u32 vblanks = 0, scanline = 0;
+
+    // Read again if VBlank started in between
+    do
+    {
+        vblanks = vblankCount;
+        scanline = REG_VCOUNT;
+    } while (vblanks != vblankCount);
+
+    return vblanks * SCANLINES_PER_FRAME + (scanline + SCANLINES_PER_FRAME - SCREEN_HEIGHT) % SCANLINES_PER_FRAME;
+}
+
+//------------------------------------------------------------------
+// Function: getScanlinesSince
+//
+// Returns the scanlines drawn since the given getScanlineClock
+// reading. A reading taken just as VBlank starts, before its
+// interrupt is counted, can run a frame behind; that reads as 0.
+//------------------------------------------------------------------
+extern u32 getScanlinesSince(u32 const startClock)
+{
+    s32 scanlines = getScanlineClock() - startClock;
+
+    return (scanlines > 0) ? scanlines : 0;
+}
+
+//------------------------------------------------------------------
+// Function: startPerfFrame
+//
+// Marks the start of the frame's work. Called at the top of the main
+// loop.
+//------------------------------------------------------------------
+extern void startPerfFrame()
+{
+    frameStartClock = getScanlineClock();
+}
+
+//------------------------------------------------------------------
+// Function: endPerfFrame
+//
+// Adds the frame's work to the sample. Called once the frame's work is
+// done, before waiting for VBlank. Every PERF_OVERLAY_INTERVAL frames
+// the sample becomes the overlay's values and, if the overlay is
+// shown, only the fields whose values changed are redrawn.
+//------------------------------------------------------------------
+extern void endPerfFrame()
+{
+    u32 frameLines = getScanlinesSince(frameStartClock);
+
+    sampleBusyLines += frameLines;
+    worstFrameLines = MAX(worstFrameLines, frameLines);
+    worstVramBytes = MAX(worstVramBytes, vramWriteCount);
+    vramWriteCount = 0;
+
+    if (++sampleFrames < PERF_OVERLAY_INTERVAL)
+        return;
+
+    perfValue[PERF_FRAME_CYCLES] = worstFrameLines * CYCLES_PER_SCANLINE;
+    perfValue[PERF_CPU_PERCENT] = sampleBusyLines * 100 / (sampleFrames * SCANLINES_PER_FRAME);
+    perfValue[PERF_VRAM_BYTES] = worstVramBytes;
+    perfValue[PERF_ENTITY_COUNT] = entityPool.activeCount;
+
+    sampleFrames = 0;
+    sampleBusyLines = 0;
+    worstFrameLines = 0;
+    worstVramBytes = 0;
+
+    if (!isOverlayVisible || gameState != STATE_GAMEPLAY)
+        return;
+
+    for (int field = 0; field < NUM_PERF_FIELDS; field++)
+    {
+        if (perfValue[field] != shownValue[field])
+            drawPerfField(field);
+    }
+}
+
+//------------------------------------------------------------------
+// Function: setPerfValue
+//
+// Sets a value measured elsewhere, such as a turn's FOV cost. It is
+// shown at the next update.
+//------------------------------------------------------------------
+extern void setPerfValue(enum perfField const field, u32 const value)
+{
+    perfValue[field] = value;
+}
+
+//------------------------------------------------------------------
+// Function: togglePerfOverlay
+//
+// Shows or hides the overlay. Bound to R during gameplay.
+//------------------------------------------------------------------
+extern void togglePerfOverlay()
+{
+    isOverlayVisible = !isOverlayVisible;
+
+    if (isOverlayVisible)
+        drawPerfOverlay();
+    else
+        clearPerfOverlay();
+}
+
+//------------------------------------------------------------------
+// Function: redrawPerfOverlay
+//
+// Draws the overlay again, if shown, after something else has used
+// the text engine. Called on every change to STATE_GAMEPLAY.
+//------------------------------------------------------------------
+extern void redrawPerfOverlay()
+{
+    if (isOverlayVisible)
+        drawPerfOverlay();
+}
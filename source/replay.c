@@ -0,0 +1,354 @@
+#include "../libtonc/include/tonc.h"
+#include "constants.h"
+#include "command.h"
+#include "debug.h"
+#include "entity.h"
+#include "fieldOfVision.h"
+#include "floorCache.h"
+#include "globals.h"
+#include "logBuffer.h"
+#include "mgba.h"
+#include "replay.h"
+#include "scheduler.h"
+
+//------------------------------------------------------------------
+// Data Structures
+//------------------------------------------------------------------
+// The last recorded game, kept until the next one starts recording
+static struct Recording recording EWRAM_BSS;
+
+//------------------------------------------------------------------
+// Global Variables
+//------------------------------------------------------------------
+static boolean isRecording = FALSE, isReplayRunning = FALSE;
+static int replayRun = 0;                  // Run being played back
+static u32 replayRunFrame = 0;             // Frames of that run already played
+static u16 pendingKeys = 0;                // This frame's keys, recorded at the next poll
+static boolean hasPendingKeys = FALSE;
+static boolean replayHeldInputWaited = FALSE;
+
+// Replay timing, in 64 cycle timer ticks
+static u32 replayFrames = 0, replayTurns = 0;
+static u32 totalTicks = 0, turnTicks = 0, worstTurnTicks = 0, worstFrameTicks = 0;
+
+//------------------------------------------------------------------
+// Function Prototypes
+//------------------------------------------------------------------
+static void recordKeys(u16 const keys);
+static u16 playKeys();
+static void restartFrameTimer();
+static u32 readFrameTimer();
+
+//------------------------------------------------------------------
+// Function: restartFrameTimer
+//
+// Restarts timer 1 as the replay's frame clock. Timer 0 is the AI
+// budget clock and timers 2 and 3 belong to profile_start.
+//------------------------------------------------------------------
+static void restartFrameTimer()
+{
+    REG_TM1CNT = 0;
+    REG_TM1D = 0;
+    REG_TM1CNT = TM_FREQ_64 | TM_ENABLE;
+}
+
+//------------------------------------------------------------------
+// Function: readFrameTimer
+//
+// Returns the ticks since restartFrameTimer. Wraps after about 15
+// frames' worth of cycles, which a replayed frame never takes.
+//------------------------------------------------------------------
+static u32 readFrameTimer()
+{
+    return REG_TM1D;
+}
+
+//------------------------------------------------------------------
+// Function: recordKeys
+//
+// Adds one frame of key state to the recording, extending the last
+// run if the keys haven't changed. Recording stops when the run list
+// is full.
+//------------------------------------------------------------------
+static void recordKeys(u16 const keys)
+{
+    recording.frameCount++;
+
+    if (recording.runCount > 0)
+    {
+        struct KeyRun *lastRun = &recording.runs[recording.runCount - 1];
+
+        if (lastRun->keys == keys && lastRun->frameCount < REPLAY_RUN_MAX_FRAMES)
+        {
+            lastRun->frameCount++;
+            return;
+        }
+    }
+
+    if (recording.runCount >= REPLAY_MAX_RUNS)
+    {
+        logMessage(LOG_GENERAL, MGBA_LOG_WARN, "recording full after %d frames, stopped", recording.frameCount);
+
+        recording.isTruncated = TRUE;
+        isRecording = FALSE;
+        return;
+    }
+
+    recording.runs[recording.runCount].keys = keys;
+    recording.runs[recording.runCount].frameCount = 1;
+    recording.runCount++;
+}
+
+//------------------------------------------------------------------
+// Function: playKeys
+//
+// Returns the recorded key state of the next frame and steps through
+// the runs.
+//------------------------------------------------------------------
+static u16 playKeys()
+{
+    struct KeyRun const *run = &recording.runs[replayRun];
+
+    if (++replayRunFrame >= run->frameCount)
+    {
+        replayRun++;
+        replayRunFrame = 0;
+    }
+
+    return run->keys;
+}
+
+//------------------------------------------------------------------
+// Function: pollInput
+//
+// Replaces key_poll for the main loop. Live keys are read and, while
+// recording, added to the recording; during a replay the recorded
+// keys are fed to tonc's key state instead, so key_hit and friends
+// see exactly what they saw when the game was played. Also times
+// every replayed frame.
+//------------------------------------------------------------------
+extern void pollInput()
+{
+    if (isReplayRunning)
+    {
+        u32 ticks = readFrameTimer();
+
+        restartFrameTimer();
+        totalTicks += ticks;
+        turnTicks += ticks;
+        worstFrameTicks = MAX(worstFrameTicks, ticks);
+
+        if (replayRun < recording.runCount)
+        {
+            u16 keys = playKeys();
+
+            __key_prev = __key_curr;
+            __key_curr = keys & KEY_MASK;
+            replayHeldInputWaited = (keys & REPLAY_KEY_WAITED) != 0;
+            replayFrames++;
+            return;
+        }
+
+        // Out of input, hand control back to the player
+        finishReplay();
+    }
+
+    key_poll();
+
+    // A frame is recorded a poll late so resolveHeldTurn can still mark it
+    if (isRecording)
+    {
+        if (hasPendingKeys)
+            recordKeys(pendingKeys);
+
+        pendingKeys = __key_curr;
+        hasPendingKeys = TRUE;
+    }
+}
+
+//------------------------------------------------------------------
+// Function: startRecording
+//
+// Starts a new recording of the game about to begin with the given
+// seed, replacing the last one. Called on the title screen after the
+// key that starts the game has been polled.
+//------------------------------------------------------------------
+extern void startRecording(u32 const seed)
+{
+    recording.seed = seed;
+    recording.startKeys = __key_curr;
+    recording.fovAlgorithm = fovAlgorithm;
+    recording.playerSightId = playerSightId;
+    recording.debugCollisionIsOff = debugCollisionIsOff;
+    recording.debugMapIsVisible = debugMapIsVisible;
+    recording.blendingValue = blendingValue;
+    recording.runCount = 0;
+    recording.frameCount = 0;
+    recording.isTruncated = FALSE;
+
+    hasPendingKeys = FALSE;
+    isRecording = TRUE;
+}
+
+//------------------------------------------------------------------
+// Function: stopRecording
+//
+// Ends the recording. Called when the game returns to the title
+// screen.
+//------------------------------------------------------------------
+extern void stopRecording()
+{
+    if (!isRecording)
+        return;
+
+    if (hasPendingKeys)
+        recordKeys(pendingKeys);
+
+    hasPendingKeys = FALSE;
+    isRecording = FALSE;
+
+    logMessage(LOG_GENERAL, MGBA_LOG_INFO, "recorded seed %d: %d frames in %d runs (%d bytes)",
+        recording.seed, recording.frameCount, recording.runCount, recording.runCount * sizeof(struct KeyRun));
+}
+
+//------------------------------------------------------------------
+// Function: startReplay
+//
+// Puts back the settings the last recording started with and begins
+// feeding its keys from the next poll. Returns FALSE if there is no
+// recording. The per-module statistics are cleared for the report
+// finishReplay logs. The caller seeds the RNG with getReplaySeed and
+// builds the game as usual.
+//------------------------------------------------------------------
+extern boolean startReplay()
+{
+    if (recording.runCount == 0)
+        return FALSE;
+
+    fovAlgorithm = recording.fovAlgorithm;
+    playerSightId = recording.playerSightId;
+    debugCollisionIsOff = recording.debugCollisionIsOff;
+    debugMapIsVisible = recording.debugMapIsVisible;
+    blendingValue = recording.blendingValue;
+
+    // The first replayed frame must see the same previous keys as it did
+    __key_curr = recording.startKeys;
+
+    replayRun = 0;
+    replayRunFrame = 0;
+    replayFrames = 0;
+    replayTurns = 0;
+    totalTicks = 0;
+    turnTicks = 0;
+    worstTurnTicks = 0;
+    worstFrameTicks = 0;
+    isReplayRunning = TRUE;
+
+    // The report at the end covers the recorded session alone
+    resetFOVCacheStats();
+    resetSchedulerStats();
+    resetCommandStats();
+    resetActivityStats();
+    resetFloorCacheStats();
+
+    logMessage(LOG_GENERAL, MGBA_LOG_INFO, "replaying seed %d: %d frames%s", recording.seed, recording.frameCount,
+        recording.isTruncated ? " (truncated)" : "");
+
+    restartFrameTimer();
+    return TRUE;
+}
+
+//------------------------------------------------------------------
+// Function: finishReplay
+//
+// Ends a running replay and logs its timing, then the per-module
+// statistics. Called when the recorded input runs out or the game
+// returns to the title screen.
+//------------------------------------------------------------------
+extern void finishReplay()
+{
+    u32 milliseconds = 0;
+
+    if (!isReplayRunning)
+        return;
+
+    isReplayRunning = FALSE;
+    milliseconds = (u32)((u64)totalTicks * 1000 / (CPU_CYCLES_PER_SECOND >> REPLAY_TIMER_SHIFT));
+
+    logMessage(LOG_GENERAL, MGBA_LOG_INFO, "replay: seed %d, %d of %d frames, %d player turns in %d ms",
+        recording.seed, replayFrames, recording.frameCount, replayTurns, milliseconds);
+    logMessage(LOG_GENERAL, MGBA_LOG_INFO, "  %d cycles per frame, worst frame %d cycles",
+        (totalTicks / MAX(replayFrames, 1)) << REPLAY_TIMER_SHIFT, worstFrameTicks << REPLAY_TIMER_SHIFT);
+    logMessage(LOG_GENERAL, MGBA_LOG_INFO, "  %d cycles per turn, worst turn %d cycles",
+        (totalTicks / MAX(replayTurns, 1)) << REPLAY_TIMER_SHIFT, worstTurnTicks << REPLAY_TIMER_SHIFT);
+
+    printFOVCacheStats();
+    printSchedulerStats();
+    printCommandStats();
+    printActivityStats();
+    printFloorCacheStats();
+}
+
+//------------------------------------------------------------------
+// Function: isReplaying
+//
+// Returns whether input is coming from a recording. The main loop
+// skips waiting for VBlank while it is, so a replay runs flat out.
+//------------------------------------------------------------------
+extern boolean isReplaying()
+{
+    return isReplayRunning;
+}
+
+//------------------------------------------------------------------
+// Function: getReplaySeed
+//
+// Returns the RNG seed of the last recording.
+//------------------------------------------------------------------
+extern u32 getReplaySeed()
+{
+    return recording.seed;
+}
+
+//------------------------------------------------------------------
+// Function: noteReplayTurn
+//
+// Closes the timing of one player turn: the frames from the player's
+// last action up to this one. Called whenever the player acts.
+//------------------------------------------------------------------
+extern void noteReplayTurn()
+{
+    if (!isReplayRunning)
+        return;
+
+    replayTurns++;
+    worstTurnTicks = MAX(worstTurnTicks, turnTicks);
+    turnTicks = 0;
+}
+
+//------------------------------------------------------------------
+// Function: resolveHeldTurn
+//
+// Decides whether a held key or auto-travel takes the player's turn
+// this frame, given whether the job list has reached the player yet.
+// Live play acts only when it has, and the recording marks the frames
+// that had to wait. How far the AI budget gets in a frame comes down
+// to timing, so a replay follows those marks instead: it waits where
+// the game waited and flushes the queued AI work everywhere else.
+//------------------------------------------------------------------
+extern boolean resolveHeldTurn(boolean const isTurnReady)
+{
+    if (isReplayRunning)
+    {
+        if (replayHeldInputWaited)
+            return FALSE;
+
+        flushEntityTurns();
+        return TRUE;
+    }
+
+    if (isRecording && hasPendingKeys && !isTurnReady)
+        pendingKeys |= REPLAY_KEY_WAITED;
+
+    return isTurnReady;
+}
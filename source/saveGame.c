@@ -0,0 +1,450 @@
+#include <string.h>
+#include "../libtonc/include/tonc.h"
+#include "constants.h"
+#include "debug.h"
+#include "entity.h"
+#include "fieldOfVision.h"
+#include "floorCache.h"
+#include "flowField.h"
+#include "globals.h"
+#include "lighting.h"
+#include "logBuffer.h"
+#include "mapCodec.h"
+#include "mgba.h"
+#include "saveGame.h"
+#include "scheduler.h"
+#include "senseField.h"
+
+//------------------------------------------------------------------
+// Data Structures
+//------------------------------------------------------------------
+static uint8_t saveBuffer[SAVE_BUFFER_SIZE] EWRAM_BSS ALIGN4;
+static struct SaveHeader pendingHeader;
+
+//------------------------------------------------------------------
+// Global Variables
+//------------------------------------------------------------------
+// Flash carts and emulators look for this string in the ROM to know
+// the game wants battery-backed SRAM
+__attribute__((used)) static char const sramIdString[] ALIGN4 = "SRAM_V113";
+
+// SRAM sits on an 8-bit bus, so it must only ever be accessed a byte
+// at a time; volatile stops the copy loops being turned into memcpy
+static volatile uint8_t *const sram = (volatile uint8_t*)MEM_SRAM;
+
+static boolean isWriteInProgress = FALSE;
+static int writeOffset = 0;                // Encoded bytes copied to SRAM so far
+static int lastSaveSize = 0;
+
+// Statistics on the last save
+static u32 encodeCycles = 0, writeCycles = 0;
+static int writeFrames = 0;
+
+//------------------------------------------------------------------
+// Function Prototypes
+//------------------------------------------------------------------
+static void putU16(int *offset, u32 const value);
+static void putU32(int *offset, u32 const value);
+static u32 getU16(int *offset);
+static u32 getU32(int *offset);
+static u32 computeChecksum(uint8_t const *data, int const size);
+static int encodeGame();
+static boolean decodeGame(int const size);
+static void writeSRAM(int const offset, uint8_t const *data, int const size);
+static void readSRAM(int const offset, uint8_t *data, int const size);
+
+//------------------------------------------------------------------
+// Function: putU16
+//
+// Appends a little-endian 16-bit value to the save buffer.
+//------------------------------------------------------------------
+static void putU16(int *offset, u32 const value)
+{
+    saveBuffer[(*offset)++] = value & 0xFF;
+    saveBuffer[(*offset)++] = (value >> 8) & 0xFF;
+}
+
+//------------------------------------------------------------------
+// Function: putU32
+//
+// Appends a little-endian 32-bit value to the save buffer.
+//------------------------------------------------------------------
+static void putU32(int *offset, u32 const value)
+{
+    putU16(offset, value & 0xFFFF);
+    putU16(offset, value >> 16);
+}
+
+//------------------------------------------------------------------
+// Function: getU16
+//
+// Reads a little-endian 16-bit value from the save buffer.
+//------------------------------------------------------------------
+static u32 getU16(int *offset)
+{
+    u32 value = saveBuffer[*offset] | (saveBuffer[*offset + 1] << 8);
+
+    *offset += 2;
+    return value;
+}
+
+//------------------------------------------------------------------
+// Function: getU32
+//
+// Reads a little-endian 32-bit value from the save buffer.
+//------------------------------------------------------------------
+static u32 getU32(int *offset)
+{
+    u32 low = getU16(offset);
+
+    return low | (getU16(offset) << 16);
+}
+
+//------------------------------------------------------------------
+// Function: computeChecksum
+//
+// Returns the Adler-32 of the given bytes. The sums are only reduced
+// every 5552 bytes, the most that can't overflow, as the GBA has no
+// divide instruction.
+//------------------------------------------------------------------
+static u32 computeChecksum(uint8_t const *data, int const size)
+{
+    u32 sumA = 1, sumB = 0;
+
+    for (int start = 0; start < size; start += 5552)
+    {
+        int end = MIN(start + 5552, size);
+
+        for (int i = start; i < end; i++)
+        {
+            sumA += data[i];
+            sumB += sumA;
+        }
+
+        sumA %= 65521;
+        sumB %= 65521;
+    }
+
+    return (sumB << 16) | sumA;
+}
+
+//------------------------------------------------------------------
+// Function: encodeGame
+//
+// Packs the run into the save buffer: the seed and random state, the
+// depth, the current floor from encodeFloor, the torches, one record
+// per entity, the player's first, and then the floors in the floor
+// cache. Turn times are stored relative to the scheduler's clock.
+// Returns the number of bytes used, or -1 if they don't fit.
+//------------------------------------------------------------------
+static int encodeGame()
+{
+    uint8_t torchX[NUM_MAX_LIGHT_SOURCES], torchY[NUM_MAX_LIGHT_SOURCES];
+    int offset = 0, floorSize = 0, sizeOffset = 0, torchCount = 0, cacheSize = 0;
+    u32 schedulerTime = getSchedulerTime();
+
+    putU32(&offset, randomSeed);
+    putU32(&offset, getRandomState());
+    saveBuffer[offset++] = getCurrentDepth();
+
+    sizeOffset = offset;
+    offset += 2;
+    floorSize = encodeFloor(&saveBuffer[offset], SAVE_BUFFER_SIZE - offset);
+    if (floorSize < 0)
+        return -1;
+    putU16(&sizeOffset, floorSize);
+    offset += floorSize;
+
+    torchCount = getTorchPositions(torchX, torchY);
+    if (offset + 1 + torchCount * 2 + 2 + entityPool.activeCount * SAVE_ENTITY_BYTES > SAVE_BUFFER_SIZE)
+        return -1;
+
+    // All x positions, then all y, so they can be handed back as they are
+    saveBuffer[offset++] = torchCount;
+    memcpy(&saveBuffer[offset], torchX, torchCount);
+    memcpy(&saveBuffer[offset + torchCount], torchY, torchCount);
+    offset += torchCount * 2;
+
+    // Slot order puts the player, in slot 0, first
+    putU16(&offset, entityPool.activeCount);
+    for (int index = 0; index < NUM_MAX_ENTITIES; index++)
+    {
+        u32 nextActTime = entityPool.nextActTime[index];
+
+        if (entityPool.generation[index] == 0)
+            continue;
+
+        saveBuffer[offset++] = entityPool.posX[index];
+        saveBuffer[offset++] = entityPool.posY[index];
+        saveBuffer[offset++] = entityPool.facing[index];
+        saveBuffer[offset++] = entityPool.sightRange[index];
+        saveBuffer[offset++] = entityPool.lastAction[index];
+        saveBuffer[offset++] = entityPool.isAwake[index];
+        saveBuffer[offset++] = entityPool.speed[index];
+
+        // Turns a dormant entity has already missed are not kept
+        putU16(&offset, (nextActTime > schedulerTime) ? MIN(nextActTime - schedulerTime, 0xFFFF) : 0);
+    }
+
+    cacheSize = saveFloorCache(&saveBuffer[offset], SAVE_BUFFER_SIZE - offset);
+    if (cacheSize < 0)
+        return -1;
+
+    return offset + cacheSize;
+}
+
+//------------------------------------------------------------------
+// Function: decodeGame
+//
+// Rebuilds the run from the given number of bytes in the save buffer,
+// written by encodeGame, then the state derived from the floor as a
+// new game would. Returns FALSE if the bytes don't make a whole game,
+// which can leave the map half loaded; the title screen regenerates
+// it for a new game anyway.
+//------------------------------------------------------------------
+static boolean decodeGame(int const size)
+{
+    uint8_t const *torchX = NULL, *torchY = NULL;
+    int offset = 0, depth = 0, floorSize = 0, torchCount = 0, entityCount = 0;
+    u32 seed = 0, state = 0;
+
+    if (size < 11)
+        return FALSE;
+
+    seed = getU32(&offset);
+    state = getU32(&offset);
+    depth = saveBuffer[offset++];
+    floorSize = getU16(&offset);
+
+    if (offset + floorSize > size || decodeFloor(&saveBuffer[offset], floorSize) != floorSize)
+        return FALSE;
+    offset += floorSize;
+
+    if (offset + 1 > size)
+        return FALSE;
+    torchCount = saveBuffer[offset++];
+    if (torchCount >= NUM_MAX_LIGHT_SOURCES || offset + torchCount * 2 + 2 > size)
+        return FALSE;
+    torchX = &saveBuffer[offset];
+    torchY = &saveBuffer[offset + torchCount];
+    offset += torchCount * 2;
+
+    entityCount = getU16(&offset);
+    if (entityCount < 1 || entityCount > NUM_MAX_ENTITIES || offset + entityCount * SAVE_ENTITY_BYTES > size)
+        return FALSE;
+
+    // Occluders come from the terrain, and entities need them for sight
+    initFOV();
+    clearEntities();
+
+    for (int i = 0; i < entityCount; i++)
+    {
+        int index = getEntityIndex(spawnEntity(saveBuffer[offset], saveBuffer[offset + 1]));
+        u32 delay = 0;
+
+        if (index < 0)
+            return FALSE;
+
+        entityPool.facing[index] = saveBuffer[offset + 2];
+        entityPool.sightRange[index] = saveBuffer[offset + 3];
+        entityPool.lastAction[index] = saveBuffer[offset + 4];
+        entityPool.isAwake[index] = saveBuffer[offset + 5];
+        entityPool.speed[index] = saveBuffer[offset + 6];
+        offset += 7;
+        delay = getU16(&offset);
+
+        if (isEntityDormant(index))
+            entityPool.nextActTime[index] = getSchedulerTime() + delay;
+        else
+            scheduleEntity(index, delay);
+    }
+
+    if (!loadFloorCache(&saveBuffer[offset], size - offset))
+        return FALSE;
+
+    loadLighting(torchX, torchY, torchCount);
+    initFlowFields();
+    initSenseFields();
+
+    randomSeed = seed;
+    setRandomState(state);
+    resumeFloors(seed, depth);
+    playerSightId = TILE_IN_SIGHT;
+
+    return TRUE;
+}
+
+//------------------------------------------------------------------
+// Function: writeSRAM
+//
+// Copies the given bytes to SRAM at the given offset, one at a time.
+//------------------------------------------------------------------
+static void writeSRAM(int const offset, uint8_t const *data, int const size)
+{
+    for (int i = 0; i < size; i++)
+        sram[offset + i] = data[i];
+}
+
+//------------------------------------------------------------------
+// Function: readSRAM
+//
+// Copies the given number of bytes from SRAM at the given offset, one
+// at a time.
+//------------------------------------------------------------------
+static void readSRAM(int const offset, uint8_t *data, int const size)
+{
+    for (int i = 0; i < size; i++)
+        data[i] = sram[offset + i];
+}
+
+//------------------------------------------------------------------
+// Function: startSave
+//
+// Encodes the current floor into the save buffer and begins copying
+// it to SRAM, SAVE_CHUNK_BYTES per call to updateSave, so saving never
+// holds up a frame. The old save is invalidated first and the new
+// header goes in last. The snapshot is taken now; play can carry on
+// while it is written. Returns FALSE if a save is still being written
+// or the game doesn't fit.
+//------------------------------------------------------------------
+extern boolean startSave()
+{
+    int size = 0;
+
+    if (isWriteInProgress)
+        return FALSE;
+
+    profile_start();
+    size = encodeGame();
+    if (size >= 0)
+        pendingHeader.checksum = computeChecksum(saveBuffer, size);
+    encodeCycles = profile_stop();
+
+    if (size < 0)
+    {
+        logMessage(LOG_GENERAL, MGBA_LOG_ERROR, "startSave: game doesn't fit in %d bytes", SAVE_BUFFER_SIZE);
+
+        return FALSE;
+    }
+
+    memcpy(pendingHeader.magic, SAVE_MAGIC, sizeof(pendingHeader.magic));
+    pendingHeader.version = SAVE_FORMAT_VERSION;
+    pendingHeader.payloadSize = size;
+
+    sram[0] = 0;
+    isWriteInProgress = TRUE;
+    writeOffset = 0;
+    writeFrames = 0;
+    writeCycles = 0;
+    lastSaveSize = sizeof(pendingHeader) + size;
+
+    return TRUE;
+}
+
+//------------------------------------------------------------------
+// Function: updateSave
+//
+// Copies the next chunk of a save in progress to SRAM, and the header
+// once everything else is there. Called once per frame.
+//------------------------------------------------------------------
+extern void updateSave()
+{
+    int chunkSize = 0;
+
+    if (!isWriteInProgress)
+        return;
+
+    profile_start();
+
+    chunkSize = MIN(SAVE_CHUNK_BYTES, pendingHeader.payloadSize - writeOffset);
+    writeSRAM(sizeof(pendingHeader) + writeOffset, &saveBuffer[writeOffset], chunkSize);
+    writeOffset += chunkSize;
+
+    // Highest byte first, so the magic's first byte completes the save
+    if (writeOffset >= pendingHeader.payloadSize)
+    {
+        for (int i = sizeof(pendingHeader) - 1; i >= 0; i--)
+            sram[i] = ((uint8_t const*)&pendingHeader)[i];
+
+        isWriteInProgress = FALSE;
+    }
+
+    writeCycles += profile_stop();
+    writeFrames++;
+
+    if (!isWriteInProgress)
+        logMessage(LOG_GENERAL, MGBA_LOG_INFO, "save: %d bytes, encoded in %d cycles, written over %d frames in %d cycles",
+            lastSaveSize, encodeCycles, writeFrames, writeCycles);
+}
+
+//------------------------------------------------------------------
+// Function: isSaving
+//
+// Returns whether a save is still being copied to SRAM.
+//------------------------------------------------------------------
+extern boolean isSaving()
+{
+    return isWriteInProgress;
+}
+
+//------------------------------------------------------------------
+// Function: loadGame
+//
+// Restores the floor saved in SRAM, finishing any save still being
+// written first. Returns FALSE if the save doesn't decode, or, leaving
+// the game as it was, if there is no complete save or its checksum
+// doesn't match.
+//------------------------------------------------------------------
+extern boolean loadGame()
+{
+    struct SaveHeader header;
+    u32 readCycles = 0, decodeCycles = 0;
+    boolean isLoaded = FALSE;
+
+    while (isWriteInProgress)
+        updateSave();
+
+    profile_start();
+    readSRAM(0, (uint8_t*)&header, sizeof(header));
+
+    if (memcmp(header.magic, SAVE_MAGIC, sizeof(header.magic)) != 0
+    || header.version != SAVE_FORMAT_VERSION || header.payloadSize > SAVE_BUFFER_SIZE)
+    {
+        profile_stop();
+
+        logMessage(LOG_GENERAL, MGBA_LOG_WARN, "loadGame: no complete save found");
+
+        return FALSE;
+    }
+
+    readSRAM(sizeof(header), saveBuffer, header.payloadSize);
+    if (computeChecksum(saveBuffer, header.payloadSize) != header.checksum)
+    {
+        profile_stop();
+
+        logMessage(LOG_GENERAL, MGBA_LOG_WARN, "loadGame: checksum mismatch");
+
+        return FALSE;
+    }
+    readCycles = profile_stop();
+
+    profile_start();
+    isLoaded = decodeGame(header.payloadSize);
+    decodeCycles = profile_stop();
+
+    logMessage(LOG_GENERAL, isLoaded ? MGBA_LOG_INFO : MGBA_LOG_ERROR, "load: %d bytes, read and checked in %d cycles, decoded in %d cycles%s",
+        sizeof(header) + header.payloadSize, readCycles, decodeCycles, isLoaded ? "" : ", decode failed");
+
+    return isLoaded;
+}
+
+//------------------------------------------------------------------
+// Function: getLastSaveSize
+//
+// Returns the bytes of SRAM the last save started takes, or 0 if
+// nothing was saved since start-up.
+//------------------------------------------------------------------
+extern int getLastSaveSize()
+{
+    return lastSaveSize;
+}
@@ -0,0 +1,433 @@
+#include <string.h>
+#include "../libtonc/include/tonc.h"
+#include "constants.h"
+#include "command.h"
+#include "debug.h"
+#include "entity.h"
+#include "globals.h"
+#include "logBuffer.h"
+#include "mgba.h"
+#include "scheduler.h"
+#include "senseField.h"
+#include "tile.h"
+
+//------------------------------------------------------------------
+// Global Variables
+//------------------------------------------------------------------
+static u32 schedulerTime = 0;              // Tick of the turn being processed
+
+// Statistics on monster turns processed per frame
+static int turnsProcessed = 0, framesWithTurns = 0, busiestFrameTurns = 0;
+static int resumedFrames = 0, overrunFrames = 0, flushCount = 0;
+static u32 turnCycles = 0, worstOverrunCycles = 0;
+
+//------------------------------------------------------------------
+// Function Prototypes
+//------------------------------------------------------------------
+static boolean actsBefore(int const entityA, int const entityB);
+static void swapHeapSlots(int const slotA, int const slotB);
+static void siftUp(int slot);
+static void siftDown(int slot);
+static u32 getActionDelay(int const entityIndex);
+static void startBudgetTimer();
+static u32 getBudgetTimerCycles();
+
+//------------------------------------------------------------------
+// Function: actsBefore
+//
+// Returns whether entity A's turn comes before entity B's. Ties go to
+// the lower slot, so the player wins any tie.
+//------------------------------------------------------------------
+static boolean actsBefore(int const entityA, int const entityB)
+{
+    if (entityPool.nextActTime[entityA] != entityPool.nextActTime[entityB])
+        return entityPool.nextActTime[entityA] < entityPool.nextActTime[entityB];
+
+    return entityA < entityB;
+}
+
+//------------------------------------------------------------------
+// Function: swapHeapSlots
+//
+// Swaps two entries of the turn heap, keeping heapSlot in step.
+//------------------------------------------------------------------
+static void swapHeapSlots(int const slotA, int const slotB)
+{
+    uint8_t entityA = entityPool.turnHeap[slotA], entityB = entityPool.turnHeap[slotB];
+
+    entityPool.turnHeap[slotA] = entityB;
+    entityPool.turnHeap[slotB] = entityA;
+    entityPool.heapSlot[entityB] = slotA;
+    entityPool.heapSlot[entityA] = slotB;
+}
+
+//------------------------------------------------------------------
+// Function: siftUp
+//
+// Moves the heap entry at the given slot up until its parent acts
+// before it.
+//------------------------------------------------------------------
+static void siftUp(int slot)
+{
+    while (slot > 0)
+    {
+        int parent = (slot - 1) / 2;
+
+        if (!actsBefore(entityPool.turnHeap[slot], entityPool.turnHeap[parent]))
+            break;
+
+        swapHeapSlots(slot, parent);
+        slot = parent;
+    }
+}
+
+//------------------------------------------------------------------
+// Function: siftDown
+//
+// Moves the heap entry at the given slot down until it acts before
+// both of its children.
+//------------------------------------------------------------------
+static void siftDown(int slot)
+{
+    while (1)
+    {
+        int child = slot * 2 + 1;
+
+        if (child >= entityPool.turnHeapCount)
+            break;
+
+        if (child + 1 < entityPool.turnHeapCount
+        && actsBefore(entityPool.turnHeap[child + 1], entityPool.turnHeap[child]))
+            child++;
+
+        if (!actsBefore(entityPool.turnHeap[child], entityPool.turnHeap[slot]))
+            break;
+
+        swapHeapSlots(slot, child);
+        slot = child;
+    }
+}
+
+//------------------------------------------------------------------
+// Function: getActionDelay
+//
+// Returns the ticks the given entity waits between actions. Twice the
+// normal speed means half the delay.
+//------------------------------------------------------------------
+static u32 getActionDelay(int const entityIndex)
+{
+    return TURN_TIME * ENTITY_SPEED_NORMAL / MAX(entityPool.speed[entityIndex], 1);
+}
+
+//------------------------------------------------------------------
+// Function: startBudgetTimer
+//
+// Restarts timer 0 as the AI budget clock. Timers 2 and 3 are left
+// to profile_start, so benchmarks can time code that runs AI.
+//------------------------------------------------------------------
+static void startBudgetTimer()
+{
+    REG_TM0CNT = 0;
+    REG_TM0D = 0;
+    REG_TM0CNT = TM_FREQ_64 | TM_ENABLE;
+}
+
+//------------------------------------------------------------------
+// Function: getBudgetTimerCycles
+//
+// Returns the cycles since startBudgetTimer, to the timer's 64 cycle
+// resolution.
+//------------------------------------------------------------------
+static u32 getBudgetTimerCycles()
+{
+    return REG_TM0D << BUDGET_TIMER_SHIFT;
+}
+
+//------------------------------------------------------------------
+// Function: resetScheduler
+//
+// Empties the turn heap and rewinds the clock. Called when the entity
+// pool is reset.
+//------------------------------------------------------------------
+extern void resetScheduler()
+{
+    entityPool.turnHeapCount = 0;
+    schedulerTime = 0;
+    playerHasActed = FALSE;
+}
+
+//------------------------------------------------------------------
+// Function: getSchedulerTime
+//
+// Returns the tick of the turn being processed.
+//------------------------------------------------------------------
+extern u32 getSchedulerTime()
+{
+    return schedulerTime;
+}
+
+//------------------------------------------------------------------
+// Function: scheduleEntity
+//
+// Gives the given entity a turn the given number of ticks from now,
+// adding it to the turn heap if it isn't there yet.
+//------------------------------------------------------------------
+extern void scheduleEntity(int const entityIndex, u32 const delay)
+{
+    int slot = 0;
+
+    entityPool.nextActTime[entityIndex] = schedulerTime + delay;
+
+    if (entityPool.heapSlot[entityIndex] < entityPool.turnHeapCount
+    && entityPool.turnHeap[entityPool.heapSlot[entityIndex]] == entityIndex)
+        slot = entityPool.heapSlot[entityIndex];
+    else
+    {
+        slot = entityPool.turnHeapCount++;
+        entityPool.turnHeap[slot] = entityIndex;
+        entityPool.heapSlot[entityIndex] = slot;
+    }
+
+    siftUp(slot);
+    siftDown(entityPool.heapSlot[entityIndex]);
+}
+
+//------------------------------------------------------------------
+// Function: unscheduleEntity
+//
+// Removes the given entity from the turn heap. Called on despawn.
+//------------------------------------------------------------------
+extern void unscheduleEntity(int const entityIndex)
+{
+    int slot = entityPool.heapSlot[entityIndex];
+    int lastSlot = entityPool.turnHeapCount - 1;
+
+    if (slot > lastSlot || entityPool.turnHeap[slot] != entityIndex)
+        return;
+
+    swapHeapSlots(slot, lastSlot);
+    entityPool.turnHeapCount--;
+
+    // Re-sort whichever entity was moved into the freed slot
+    if (slot < entityPool.turnHeapCount)
+    {
+        int movedIndex = entityPool.turnHeap[slot];
+
+        siftUp(slot);
+        siftDown(entityPool.heapSlot[movedIndex]);
+    }
+}
+
+//------------------------------------------------------------------
+// Function: resumeEntity
+//
+// Puts an entity that was left off the turn heap back on it, keeping
+// its turns in step with the clock it missed. Returns the number of
+// turns it missed, for the caller to make up for cheaply.
+//------------------------------------------------------------------
+extern int resumeEntity(int const entityIndex)
+{
+    u32 delay = getActionDelay(entityIndex);
+    u32 nextTime = entityPool.nextActTime[entityIndex];
+    int missedTurns = 0;
+
+    if (schedulerTime > nextTime)
+    {
+        missedTurns = (schedulerTime - nextTime) / delay + 1;
+        nextTime += missedTurns * delay;
+    }
+
+    scheduleEntity(entityIndex, nextTime - schedulerTime);
+    return missedTurns;
+}
+
+//------------------------------------------------------------------
+// Function: endEntityTurn
+//
+// Called by every action that spends a turn. Applies the commands the
+// turn queued, schedules the entity's next turn according to its
+// speed, and flags the player's actions so the main loop knows to
+// update sight and graphics. Noise and scent age once per player
+// turn, before the player's own action adds to them. An entity whose
+// turn took it out of the active sectors only has its next turn time
+// noted, for resumeEntity.
+//------------------------------------------------------------------
+extern void endEntityTurn(int const entityIndex)
+{
+    if (entityIndex == PLAYER_INDEX)
+        decaySenseFields();
+
+    applyCommands();
+
+    if (entityPool.isDormant[entityIndex])
+        entityPool.nextActTime[entityIndex] = schedulerTime + getActionDelay(entityIndex);
+    else
+        scheduleEntity(entityIndex, getActionDelay(entityIndex));
+
+    if (entityIndex == PLAYER_INDEX)
+        playerHasActed = TRUE;
+}
+
+//------------------------------------------------------------------
+// Function: isPlayerTurn
+//
+// Returns whether the scheduler is waiting on the player's input.
+//------------------------------------------------------------------
+extern boolean isPlayerTurn()
+{
+    return entityPool.turnHeapCount > 0 && entityPool.turnHeap[0] == PLAYER_INDEX;
+}
+
+//------------------------------------------------------------------
+// Function: processEntityTurns
+//
+// Works through the turns of entities due before the player as a
+// cooperative job list: turns run in time order until the player is
+// due or the given cycle budget is spent, and whatever is left resumes
+// on the next call. The budget is checked between turns, so a frame
+// overruns by at most one turn; overruns are counted. Returns the
+// number of turns run.
+//------------------------------------------------------------------
+extern int processEntityTurns(u32 const cycleBudget)
+{
+    int turns = 0;
+    u32 cycles = 0;
+
+    startBudgetTimer();
+
+    while (entityPool.turnHeapCount > 0 && getBudgetTimerCycles() < cycleBudget)
+    {
+        int entityIndex = entityPool.turnHeap[0];
+        u32 turnTime = entityPool.nextActTime[entityIndex];
+
+        schedulerTime = turnTime;
+
+        if (entityIndex == PLAYER_INDEX)
+            break;
+
+        doMonsterTurn(entityIndex);
+
+        // An entity that didn't spend its turn waits instead
+        if (entityPool.turnHeap[0] == entityIndex && entityPool.nextActTime[entityIndex] == turnTime)
+            entityWait(entityIndex);
+
+        turns++;
+    }
+
+    cycles = getBudgetTimerCycles();
+
+    if (turns > 0)
+    {
+        turnsProcessed += turns;
+        turnCycles += cycles;
+        framesWithTurns++;
+        busiestFrameTurns = MAX(busiestFrameTurns, turns);
+        resumedFrames += !isPlayerTurn();
+
+        if (cycles > cycleBudget)
+        {
+            overrunFrames++;
+            worstOverrunCycles = MAX(worstOverrunCycles, cycles - cycleBudget);
+        }
+
+        logMessage(LOG_ENTITY, MGBA_LOG_DEBUG, "processEntityTurns: %d turns in %d cycles, time %d", turns, cycles, schedulerTime);
+    }
+
+    return turns;
+}
+
+//------------------------------------------------------------------
+// Function: flushEntityTurns
+//
+// Runs every pending turn up to the player's regardless of budget.
+// Called when the player gives input while AI work is still queued so
+// the input is acted on at once instead of waiting for the job list.
+//------------------------------------------------------------------
+extern void flushEntityTurns()
+{
+    if (isPlayerTurn())
+        return;
+
+    flushCount++;
+    processEntityTurns(0xFFFFFFFF);
+}
+
+//------------------------------------------------------------------
+// Function: printSchedulerStats
+//
+// Logs how many monster turns were run per frame since start-up or
+// the last resetSchedulerStats, and how often the AI budget was
+// overrun or flushed.
+//------------------------------------------------------------------
+extern void printSchedulerStats()
+{
+    logMessage(LOG_GENERAL, MGBA_LOG_INFO, "scheduler: %d turns over %d frames, busiest frame %d, %d cycles per turn",
+        turnsProcessed, framesWithTurns, busiestFrameTurns, turnCycles / MAX(turnsProcessed, 1));
+    logMessage(LOG_GENERAL, MGBA_LOG_INFO, "  %d frames resumed next frame, %d flushed by input", resumedFrames, flushCount);
+    logMessage(LOG_GENERAL, MGBA_LOG_INFO, "  %d frames overran the %d cycle budget, worst by %d cycles",
+        overrunFrames, SCHEDULER_CYCLE_BUDGET, worstOverrunCycles);
+}
+
+//------------------------------------------------------------------
+// Function: resetSchedulerStats
+//
+// Starts the counts behind printSchedulerStats over. Called when a
+// replay starts, so its report leaves out the game played before it.
+//------------------------------------------------------------------
+extern void resetSchedulerStats()
+{
+    turnsProcessed = 0;
+    framesWithTurns = 0;
+    busiestFrameTurns = 0;
+    resumedFrames = 0;
+    overrunFrames = 0;
+    flushCount = 0;
+    turnCycles = 0;
+    worstOverrunCycles = 0;
+}
+
+//------------------------------------------------------------------
+// Function: benchmarkScheduler
+//
+// Fills the pool with entities of mixed speeds and times rescheduling
+// whoever is due next, which is the heap work done once per turn. The
+// pool and clock are put back afterwards.
+//------------------------------------------------------------------
+#ifdef DEBUG_BENCHMARK
+extern void benchmarkScheduler()
+{
+    static struct EntityPool savedPool EWRAM_BSS;
+    int const turnCount = 1024;
+    u32 savedTime = schedulerTime;
+    boolean savedPlayerHasActed = playerHasActed;
+    uint cycles = 0;
+
+    memcpy(&savedPool, &entityPool, sizeof(entityPool));
+
+    // Only the heap and timing fields are touched, positions don't matter
+    while (entityPool.freeCount > 0)
+    {
+        int index = entityPool.freeList[--entityPool.freeCount];
+
+        entityPool.speed[index] = randomInRange(ENTITY_SPEED_SLOW, ENTITY_SPEED_FAST);
+        scheduleEntity(index, getActionDelay(index));
+    }
+
+    profile_start();
+    for (int turn = 0; turn < turnCount; turn++)
+    {
+        int entityIndex = entityPool.turnHeap[0];
+
+        schedulerTime = entityPool.nextActTime[entityIndex];
+        endEntityTurn(entityIndex);
+    }
+    cycles = profile_stop();
+
+    mgba_printf(MGBA_LOG_INFO, "benchmarkScheduler: %d entities, %d cycles per turn",
+        entityPool.turnHeapCount, cycles / turnCount);
+
+    memcpy(&entityPool, &savedPool, sizeof(entityPool));
+    schedulerTime = savedTime;
+    playerHasActed = savedPlayerHasActed;
+}
+#endif
@@ -0,0 +1,260 @@
+#include <string.h>
+#include "../libtonc/include/tonc.h"
+#include "constants.h"
+#include "debug.h"
+#include "entity.h"
+#include "globals.h"
+#include "mgba.h"
+#include "senseField.h"
+#include "tile.h"
+
+//------------------------------------------------------------------
+// Data Structures
+//------------------------------------------------------------------
+static struct SenseField senseField[NUM_SENSES] EWRAM_BSS;
+static uint16_t noiseQueue[NOISE_WINDOW_WIDTH * NOISE_WINDOW_WIDTH];   // Tile indices
+static uint8_t noiseQueueDistance[NOISE_WINDOW_WIDTH * NOISE_WINDOW_WIDTH];
+static u32 noiseVisited[NOISE_WINDOW_WORDS];                          // Over the window around the emitter
+
+//------------------------------------------------------------------
+// Global Variables
+//------------------------------------------------------------------
+static int droppedTiles = 0;               // Raises lost to a full active list
+
+//------------------------------------------------------------------
+// Function Prototypes
+//------------------------------------------------------------------
+static void raiseStrength(struct SenseField *field, int const tileIndex, uint8_t const strength);
+
+//------------------------------------------------------------------
+// Function: raiseStrength
+//
+// Raises the given tile to the given strength if it's weaker, listing
+// it as active when it rises from zero. A tile that can't be listed
+// stays at zero.
+//------------------------------------------------------------------
+static void raiseStrength(struct SenseField *field, int const tileIndex, uint8_t const strength)
+{
+    uint8_t *tileStrength = &field->strength[tileIndex / MAP_WIDTH_TILES][tileIndex % MAP_WIDTH_TILES];
+
+    if (*tileStrength >= strength)
+        return;
+
+    if (*tileStrength == 0)
+    {
+        if (field->activeCount >= SENSE_MAX_ACTIVE_TILES)
+        {
+            droppedTiles++;
+            return;
+        }
+
+        field->activeTile[field->activeCount++] = tileIndex;
+    }
+
+    *tileStrength = strength;
+}
+
+//------------------------------------------------------------------
+// Function: initSenseFields
+//
+// Clears every field. Called when a new map is generated.
+//------------------------------------------------------------------
+extern void initSenseFields()
+{
+    memset(senseField, 0, sizeof(senseField));
+    senseField[SENSE_NOISE].decay = NOISE_DECAY;
+    senseField[SENSE_SCENT].decay = SCENT_DECAY;
+}
+
+//------------------------------------------------------------------
+// Function: emitNoise
+//
+// Spreads a noise of the given loudness from the given tile with a
+// breadth-first search through walkable tiles. Each tile reached is
+// raised to the loudness less the steps taken, so the noise fades
+// with distance and goes around walls, not through them. Only the
+// window the noise can reach is touched.
+//------------------------------------------------------------------
+extern void emitNoise(int const positionX, int const positionY, int const loudness)
+{
+    struct SenseField *field = &senseField[SENSE_NOISE];
+    int radius = MIN(loudness, NOISE_RADIUS_MAX);
+    int head = 0, tail = 0;
+
+    if (radius <= 0 || isOutOfBounds(positionX, positionY))
+        return;
+
+    memset(noiseVisited, 0, sizeof(noiseVisited));
+
+    noiseVisited[(NOISE_RADIUS_MAX * NOISE_WINDOW_WIDTH + NOISE_RADIUS_MAX) / 32]
+        |= 1u << ((NOISE_RADIUS_MAX * NOISE_WINDOW_WIDTH + NOISE_RADIUS_MAX) % 32);
+    noiseQueue[tail] = positionY * MAP_WIDTH_TILES + positionX;
+    noiseQueueDistance[tail++] = 0;
+
+    while (head < tail)
+    {
+        int tileIndex = noiseQueue[head];
+        int distance = noiseQueueDistance[head++];
+        int currentX = tileIndex % MAP_WIDTH_TILES, currentY = tileIndex / MAP_WIDTH_TILES;
+
+        raiseStrength(field, tileIndex, radius - distance);
+
+        // Tiles at the edge are the last the noise reaches
+        if (distance + 1 >= radius)
+            continue;
+
+        for (int direction = DIR_LEFT; direction <= DIR_DOWN; direction++)
+        {
+            int neighbourX = currentX + dirX[direction], neighbourY = currentY + dirY[direction];
+            int bitIndex = (neighbourY - positionY + NOISE_RADIUS_MAX) * NOISE_WINDOW_WIDTH
+                         + (neighbourX - positionX + NOISE_RADIUS_MAX);
+
+            if (isOutOfBounds(neighbourX, neighbourY) || isSolid(neighbourX, neighbourY)
+            || noiseVisited[bitIndex / 32] & (1u << (bitIndex % 32)))
+                continue;
+
+            noiseVisited[bitIndex / 32] |= 1u << (bitIndex % 32);
+            noiseQueue[tail] = neighbourY * MAP_WIDTH_TILES + neighbourX;
+            noiseQueueDistance[tail++] = distance + 1;
+        }
+    }
+}
+
+//------------------------------------------------------------------
+// Function: leaveScent
+//
+// Marks the given tile with fresh scent. A trail of these, each one
+// turn staler than the next, leads to whoever left it.
+//------------------------------------------------------------------
+extern void leaveScent(int const positionX, int const positionY)
+{
+    if (isOutOfBounds(positionX, positionY))
+        return;
+
+    raiseStrength(&senseField[SENSE_SCENT], positionY * MAP_WIDTH_TILES + positionX, SCENT_STRENGTH);
+}
+
+//------------------------------------------------------------------
+// Function: decaySenseFields
+//
+// Weakens every active tile of every field by the field's decay and
+// drops tiles that reach zero from the active list. Called once per
+// player turn; the cost follows the number of active tiles, not the
+// size of the map.
+//------------------------------------------------------------------
+extern void decaySenseFields()
+{
+    for (int sense = 0; sense < NUM_SENSES; sense++)
+    {
+        struct SenseField *field = &senseField[sense];
+        int i = 0;
+
+        while (i < field->activeCount)
+        {
+            int tileIndex = field->activeTile[i];
+            uint8_t *tileStrength = &field->strength[tileIndex / MAP_WIDTH_TILES][tileIndex % MAP_WIDTH_TILES];
+
+            if (*tileStrength > field->decay)
+            {
+                *tileStrength -= field->decay;
+                i++;
+                continue;
+            }
+
+            // Faded out: fill the gap with the last entry and check that next
+            *tileStrength = 0;
+            field->activeTile[i] = field->activeTile[--field->activeCount];
+        }
+    }
+}
+
+//------------------------------------------------------------------
+// Function: getSenseStrength
+//
+// Returns the strength of the given sense at the given tile.
+//------------------------------------------------------------------
+extern uint8_t getSenseStrength(enum senseType const sense, int const positionX, int const positionY)
+{
+    if (isOutOfBounds(positionX, positionY))
+        return 0;
+
+    return senseField[sense].strength[positionY][positionX];
+}
+
+//------------------------------------------------------------------
+// Function: getSenseDirection
+//
+// Returns the direction of the unoccupied neighbour where the given
+// sense is strongest, if stronger than at the given tile, or DIR_NULL.
+// Following it leads to the source of a noise or along a scent trail.
+//------------------------------------------------------------------
+extern enum direction getSenseDirection(enum senseType const sense, int const positionX, int const positionY)
+{
+    enum direction bestDirection = DIR_NULL;
+    uint8_t bestStrength = getSenseStrength(sense, positionX, positionY);
+
+    for (int direction = DIR_LEFT; direction <= DIR_DOWN; direction++)
+    {
+        int neighbourX = positionX + dirX[direction], neighbourY = positionY + dirY[direction];
+        uint8_t strength = getSenseStrength(sense, neighbourX, neighbourY);
+
+        if (strength > bestStrength && !isTileOccupied(neighbourX, neighbourY))
+        {
+            bestStrength = strength;
+            bestDirection = direction;
+        }
+    }
+
+    return bestDirection;
+}
+
+//------------------------------------------------------------------
+// Function: benchmarkSenseFields
+//
+// Times the loudest noise from random open tiles and the decay of the
+// result until it fades, and logs the cycles per emission, per decay
+// pass and per active tile. The fields are put back afterwards.
+//------------------------------------------------------------------
+#ifdef DEBUG_BENCHMARK
+extern void benchmarkSenseFields()
+{
+    static struct SenseField savedFields[NUM_SENSES] EWRAM_BSS;
+    int const emissionCount = 32;
+    int decayPasses = 0, mostActive = 0, totalActive = 0;
+    uint emitCycles = 0, decayCycles = 0;
+
+    memcpy(savedFields, senseField, sizeof(senseField));
+    initSenseFields();
+
+    for (int emission = 0; emission < emissionCount; emission++)
+    {
+        int positionX = 0, positionY = 0;
+
+        do
+        {
+            positionX = randomInRange(1, MAP_WIDTH_TILES - 2);
+            positionY = randomInRange(1, MAP_HEIGHT_TILES - 2);
+        } while (isSolid(positionX, positionY));
+
+        profile_start();
+        emitNoise(positionX, positionY, NOISE_LOUDNESS_EARTH_BEND);
+        leaveScent(positionX, positionY);
+        emitCycles += profile_stop();
+
+        mostActive = MAX(mostActive, senseField[SENSE_NOISE].activeCount);
+        totalActive += senseField[SENSE_NOISE].activeCount + senseField[SENSE_SCENT].activeCount;
+
+        profile_start();
+        decaySenseFields();
+        decayCycles += profile_stop();
+        decayPasses++;
+    }
+
+    mgba_printf(MGBA_LOG_INFO, "benchmarkSenseFields: %d cycles per loudest noise, most %d noisy tiles",
+        emitCycles / emissionCount, mostActive);
+    mgba_printf(MGBA_LOG_INFO, "  %d cycles per decay pass, %d cycles per active tile, %d tiles dropped",
+        decayCycles / decayPasses, decayCycles / MAX(totalActive, 1), droppedTiles);
+
+    memcpy(senseField, savedFields, sizeof(senseField));
+}
+#endif
@@ -0,0 +1,109 @@
+#include <string.h>
+#include "../libtonc/include/tonc.h"
+#include "constants.h"
+#include "textPage.h"
+
+//------------------------------------------------------------------
+// Function Prototypes
+//------------------------------------------------------------------
+static int getFieldY(struct TextField const *field);
+
+//------------------------------------------------------------------
+// Function: getFieldY
+//
+// Returns the top of a field's line, in pixels, in the current font.
+//------------------------------------------------------------------
+static int getFieldY(struct TextField const *field)
+{
+    return field->row * tte_get_context()->font->charH;
+}
+
+//------------------------------------------------------------------
+// Function: formatInt
+//
+// Writes the decimal digits of value, with a leading '-' if negative,
+// and a terminator into buffer, which needs TEXT_INT_MAX_CHARS bytes.
+// The digits are produced in one pass from the last, then copied in
+// front. Returns the terminator's position so text can be appended.
+//------------------------------------------------------------------
+extern char* formatInt(char *buffer, int const value)
+{
+    char digits[TEXT_INT_MAX_CHARS];
+    char *digit = &digits[TEXT_INT_MAX_CHARS];
+    u32 magnitude = (value < 0) ? -(u32)value : (u32)value;
+    int length = 0;
+
+    do
+    {
+        *--digit = '0' + magnitude % 10;
+        magnitude /= 10;
+    } while (magnitude > 0);
+
+    if (value < 0)
+        *--digit = '-';
+
+    length = &digits[TEXT_INT_MAX_CHARS] - digit;
+    memcpy(buffer, digit, length);
+    buffer[length] = '\0';
+
+    return &buffer[length];
+}
+
+//------------------------------------------------------------------
+// Function: drawTextPage
+//
+// Clears the text engine's screen and draws every label of the page.
+// The slots are left empty until their values are set. Called once
+// when the page is shown, after the text engine is set up for it.
+//------------------------------------------------------------------
+extern void drawTextPage(struct TextPage *page)
+{
+    tte_erase_screen();
+
+    for (int i = 0; i < page->fieldCount; i++)
+    {
+        struct TextField const *field = &page->fields[i];
+
+        tte_set_pos(field->labelX, getFieldY(field));
+        tte_write(field->label);
+        page->shownText[i][0] = '\0';
+    }
+}
+
+//------------------------------------------------------------------
+// Function: setTextField
+//
+// Shows text in a field's slot, unless the slot already shows it.
+// Only that slot is erased and drawn. Text longer than
+// TEXT_FIELD_MAX_CHARS - 1 is cut short.
+//------------------------------------------------------------------
+extern void setTextField(struct TextPage *page, int const field, char const *text)
+{
+    struct TextField const *slot = &page->fields[field];
+    char *shownText = page->shownText[field];
+    int y = getFieldY(slot);
+
+    if (strncmp(shownText, text, TEXT_FIELD_MAX_CHARS - 1) == 0)
+        return;
+
+    strncpy(shownText, text, TEXT_FIELD_MAX_CHARS - 1);
+    shownText[TEXT_FIELD_MAX_CHARS - 1] = '\0';
+
+    tte_erase_rect(slot->slotX, y, slot->slotX + slot->slotWidth, y + tte_get_context()->font->charH);
+    tte_set_pos(slot->slotX, y);
+    tte_write(shownText);
+}
+
+//------------------------------------------------------------------
+// Function: setTextFieldInt
+//
+// Shows an integer in a field's slot, unless the slot already shows
+// it.
+//------------------------------------------------------------------
+extern void setTextFieldInt(struct TextPage *page, int const field, int const value)
+{
+    char text[TEXT_INT_MAX_CHARS];
+
+    formatInt(text, value);
+    setTextField(page, field, text);
+}
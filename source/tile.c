@@ -3,19 +3,37 @@
 #include "constants.h"
 #include "debug.h"
 #include "entity.h"
+#include "fieldOfVision.h"
 #include "globals.h"
+#include "lighting.h"
+#include "logBuffer.h"
 #include "mapGeneration.h"
 #include "mgba.h"
+#include "perfOverlay.h"
 #include "tile.h"
 #include "tileset_stone.h"
 #include "tilemap_stone.h"
 
+//------------------------------------------------------------------
+// Global Variables
+//------------------------------------------------------------------
+// Incremented whenever a tile in the sector changes terrain
+static u32 sectorTerrainVersion[NUM_MAP_SECTORS];
+
+// Direction of a single line step, indexed by [moveY + 1][moveX + 1]
+static enum direction IWRAM_TABLE lineStepDirection[3][3] =
+{
+    {DIR_UP_LEFT,   DIR_UP,   DIR_UP_RIGHT},
+    {DIR_LEFT,      DIR_NULL, DIR_RIGHT},
+    {DIR_DOWN_LEFT, DIR_DOWN, DIR_DOWN_RIGHT}
+};
+
 //------------------------------------------------------------------
 // Function Prototypes
 //------------------------------------------------------------------
-static void drawTile(struct Tile* const tile, int const screenEntryTL);
-static int* getTilesetIndex(struct Tile* const tile, uint8_t const screenEntryCorner);
-static uint8_t getDynamicTerrainId(struct Tile* const tile);
+IWRAM_ARM_CODE static void drawTile(struct Tile* const tile, int const screenEntryTL);
+IWRAM_ARM_CODE static int* getTilesetIndex(struct Tile* const tile, uint8_t const screenEntryCorner);
+IWRAM_ARM_CODE static uint8_t getDynamicTerrainId(struct Tile* const tile);
 static int getGameMapSEOrigin(enum entityAction playerWalkedDir);
 static uint8_t getNumberNeighborsOfType(int const positionX, int const positionY, int const terrainId);
 static struct Tile* getRandomTileOfType(uint8_t const terrainId);
@@ -26,7 +44,7 @@ static struct Tile* getRandomTileOfType(uint8_t const terrainId);
 // Draws all four corners of a 16x16 tile using the given top-left screen
 // entry.
 //------------------------------------------------------------------
-static void drawTile(struct Tile* const tile, int const screenEntryTL)
+IWRAM_ARM_CODE static void drawTile(struct Tile* const tile, int const screenEntryTL)
 {
     int* tilesetIndex = NULL;
 
@@ -45,6 +63,7 @@ static void drawTile(struct Tile* const tile, int const screenEntryTL)
     // Bottom-right screen entry
     tilesetIndex = getTilesetIndex(tile, SCREEN_ENTRY_BR);
     memcpy(&se_mem[GAME_MAP_SB][screenEntryTL + SCREEN_BLOCK_SIZE + 1], &tilesetIndex, 2);
+    vramWriteCount += 4 * 2;
 }
 
 //------------------------------------------------------------------
@@ -54,7 +73,7 @@ static void drawTile(struct Tile* const tile, int const screenEntryTL)
 // index of the correct 8x8 bitmap and returns a pointer to the
 // bitmap so it may be drawn.
 //------------------------------------------------------------------
-static int* getTilesetIndex(struct Tile* const tile, uint8_t const screenEntryCorner)
+IWRAM_ARM_CODE static int* getTilesetIndex(struct Tile* const tile, uint8_t const screenEntryCorner)
 {
     uint8_t tileSubId = 0;
     int *tilesetIndex = NULL;
@@ -168,6 +187,20 @@ static int* getTilesetIndex(struct Tile* const tile, uint8_t const screenEntryCo
         default:                                     break;
         }
         break;
+    case ID_STAIRS_UP:                               // ID_STAIRS_UP
+        switch (screenEntryCorner)
+        {
+        case SCREEN_ENTRY_TL:
+            tilesetIndex = (int*)STAIRS_UP_TL;       break;
+        case SCREEN_ENTRY_TR:
+            tilesetIndex = (int*)STAIRS_UP_TR;       break;
+        case SCREEN_ENTRY_BL:
+            tilesetIndex = (int*)STAIRS_UP_BL;       break;
+        case SCREEN_ENTRY_BR:
+            tilesetIndex = (int*)STAIRS_UP_BR;       break;
+        default:                                     break;
+        }
+        break;
     default:
         tilesetIndex = (int*)TRANSPARENT;             // TRANSPARENT
         break;
@@ -183,7 +216,7 @@ static int* getTilesetIndex(struct Tile* const tile, uint8_t const screenEntryCo
 // for the surrounding tiles and uses that plus its own terrainId to
 // determine which variant of tile to return for being drawn.
 //------------------------------------------------------------------
-static uint8_t getDynamicTerrainId(struct Tile* const tile)
+IWRAM_ARM_CODE static uint8_t getDynamicTerrainId(struct Tile* const tile)
 {
     uint8_t terrainId = tile->terrainId;
 
@@ -256,14 +289,10 @@ static int getGameMapSEOrigin(enum entityAction playerWalkedDir)
             screenEntryTL = SCREEN_BLOCK_SIZE * SCREEN_BLOCK_SIZE;
         break;
     default:
-        #ifdef DEBUG_GRAPHICS
-            mgba_printf(MGBA_LOG_DEBUG, "  getGameMapSEOrigin: DEFAULT");
-        #endif
+        logMessage(LOG_GRAPHICS, MGBA_LOG_DEBUG, "  getGameMapSEOrigin: DEFAULT");
     }
 
-    #ifdef DEBUG_GRAPHICS
-        mgba_printf(MGBA_LOG_DEBUG, "  getGameMapSEOrigin: %d", screenEntryTL);
-    #endif
+    logMessage(LOG_GRAPHICS, MGBA_LOG_DEBUG, "  getGameMapSEOrigin: %d", screenEntryTL);
 
     return screenEntryTL;
 }
@@ -302,9 +331,7 @@ static struct Tile* getRandomTileOfType(uint8_t const terrainId)
     {
         if (iterationCount > 100)
         {
-            #ifdef DEBUG_MAP_GEN
-                mgba_printf(MGBA_LOG_DEBUG, "    getRandomTileOfType(%d) returned NULL", terrainId);
-            #endif
+            logMessage(LOG_MAP_GEN, MGBA_LOG_DEBUG, "    getRandomTileOfType(%d) returned NULL", terrainId);
             return NULL;
         }
 
@@ -340,19 +367,6 @@ extern struct Tile* getTile(int const positionX, int const positionY)
         return NULL;
 }
 
-//------------------------------------------------------------------
-// Function: getTileTerrain
-// 
-// Returns the tile terrain at the given position.
-//------------------------------------------------------------------
-extern uint8_t getTileTerrain(int const positionX, int const positionY)
-{
-    if (!isOutOfBounds(positionX, positionY))
-        return gameMap[positionY][positionX].terrainId;
-    else
-        return ID_TRANSPARENT;
-}
-
 //------------------------------------------------------------------
 // Function: setTileTerrain
 // 
@@ -361,31 +375,12 @@ extern uint8_t getTileTerrain(int const positionX, int const positionY)
 extern void setTileTerrain(int const positionX, int const positionY, uint8_t const terrainId)
 {
     if (!isOutOfBounds(positionX, positionY))
+    {
         gameMap[positionY][positionX].terrainId = terrainId;
-}
-
-//------------------------------------------------------------------
-// Function: getTileSight
-// 
-// Returns the sightId of the tile at the given position.
-//------------------------------------------------------------------
-extern uint8_t getTileSight(int const positionX, const int positionY)
-{
-    if (!isOutOfBounds(positionX, positionY))
-        return gameMap[positionY][positionX].sightId;
-    else
-        return TILE_NEVER_SEEN;
-}
-
-//------------------------------------------------------------------
-// Function: setTileSight
-// 
-// Sets the sightId of the tile at the given position.
-//------------------------------------------------------------------
-extern void setTileSight(int const positionX, int const positionY, uint8_t const sightId)
-{
-    if (!isOutOfBounds(positionX, positionY))
-        gameMap[positionY][positionX].sightId = sightId;
+        sectorTerrainVersion[getMapSector(positionX, positionY)]++;
+        updateOccluder(positionX, positionY);
+        markLightTerrainChanged(positionX, positionY);
+    }
 }
 
 //------------------------------------------------------------------
@@ -437,40 +432,59 @@ extern enum direction getTileDirection(int const startX, int const startY, int c
 }
 
 //------------------------------------------------------------------
-// Function: getTileDirInLine
+// Function: initLineIterator
 // 
-// Given a starting and ending position, calculate the line between
-// the two using Bresenham's algorithm and return the direction of
-// the next tile along the line.
+// Prepares the given iterator to walk the Bresenham line from the
+// starting position to the ending position. The error term is carried
+// between steps, so every step costs a couple of adds and compares.
+//------------------------------------------------------------------
+extern void initLineIterator(struct LineIterator *line, int const startX, int const startY, int const endX, int const endY)
+{
+    line->currentX = startX;
+    line->currentY = startY;
+    line->endX = endX;
+    line->endY = endY;
+    line->changeInX =  ABS(endX - startX);
+    line->changeInY = -ABS(endY - startY);
+    line->stepOfX = startX < endX ? dirX[DIR_RIGHT] : dirX[DIR_LEFT];
+    line->stepOfY = startY < endY ? dirY[DIR_DOWN] : dirY[DIR_UP];
+    line->err = line->changeInX + line->changeInY;      // error value e_xy
+}
+
+//------------------------------------------------------------------
+// Function: nextLineStep
+// 
+// Moves the given iterator to the next tile along its line and returns
+// the direction it moved in, or DIR_NULL once the end is reached.
 //
 // Call in a loop to traverse and perform an action along the whole line.
 //------------------------------------------------------------------
-enum direction getTileDirInLine(int startX, int startY, int const endX, int const endY)
+IWRAM_ARM_CODE extern enum direction nextLineStep(struct LineIterator *line)
 {
-    int changeInX =  ABS(endX - startX);
-    int changeInY = -ABS(endY - startY);
-    int stepOfX = startX < endX ? dirX[DIR_RIGHT] : dirX[DIR_LEFT];
-    int stepOfY = startY < endY ? dirY[DIR_DOWN] : dirY[DIR_UP];
-    int err = changeInX + changeInY, e2; // error value e_xy
-    int nextX = startX, nextY = startY;
+    int e2 = 2 * line->err;
+    int moveX = 0, moveY = 0;
 
-    e2 = 2 * err;
+    if (line->currentX == line->endX && line->currentY == line->endY)
+        return DIR_NULL;
 
     // Move along x-axis
-    if (e2 >= changeInY)
+    if (e2 >= line->changeInY)
     {
-        err += changeInY;
-        nextX += stepOfX;
+        line->err += line->changeInY;
+        moveX = line->stepOfX;
     } // e_xy+e_x > 0
 
     // Move along y-axis
-    if (e2 <= changeInX)
+    if (e2 <= line->changeInX)
     {
-        err += changeInX;
-        nextY += stepOfY;
+        line->err += line->changeInX;
+        moveY = line->stepOfY;
     } // e_xy+e_y < 0
 
-    return getTileDirection(startX, startY, nextX, nextY);
+    line->currentX += moveX;
+    line->currentY += moveY;
+
+    return lineStepDirection[moveY + 1][moveX + 1];
 }
 
 //------------------------------------------------------------------
@@ -525,8 +539,7 @@ extern void drawGameMap(int originTileX, int originTileY)
 // TODO: Tile drawn is offset when (screenEntryTL % 64 = 0). Why and fix it
 extern void redrawGameMapEdge(enum entityAction playerWalkedDir)
 {
-    struct Entity *player = getEntity(PLAYER_INDEX);
-    int playerX = player->posX, playerY = player->posY;
+    int playerX = getEntityPosX(PLAYER_INDEX), playerY = getEntityPosY(PLAYER_INDEX);
     int screenEntryTL = getGameMapSEOrigin(playerWalkedDir);
     int startingRow = screenEntryTL / SCREEN_BLOCK_SIZE;
     int tileToDrawX = 0, tileToDrawY = 0;
@@ -611,15 +624,13 @@ extern void redrawGameMapEdge(enum entityAction playerWalkedDir)
 //------------------------------------------------------------------
 extern void updateGameMapSight()
 {
-    struct Entity *player = getEntity(PLAYER_INDEX);
-    int playerX = player->posX, playerY = player->posY, sightRange = player->sightRange;
+    int playerX = getEntityPosX(PLAYER_INDEX), playerY = getEntityPosY(PLAYER_INDEX);
+    int sightRange = entityPool.sightRange[PLAYER_INDEX];
     int distFromScreenOriginX = (SCREEN_WIDTH_TILES / 2) - sightRange;
     int distFromScreenOriginY = (SCREEN_HEIGHT_TILES / 2) - sightRange;
     int sightOriginScreenEntry = 0, currentScreenEntry = 0, currentRow = 0;
 
-    #ifdef DEBUG_FOV
-        mgba_printf(MGBA_LOG_DEBUG, "updateGameMapSight");
-    #endif
+    logMessage(LOG_FOV, MGBA_LOG_DEBUG, "updateGameMapSight");
 
     // Update sightOriginScreenEntry to point to the origin of the player's sightRange
     sightOriginScreenEntry = (screenOffsetX / TILE_SIZE) * 2 + (screenOffsetY / TILE_SIZE * SCREEN_BLOCK_SIZE) * 2;
@@ -660,30 +671,212 @@ extern void updateGameMapSight()
 }
 
 //------------------------------------------------------------------
-// Function: isOutOfBounds
+// Function: getMapSector
 // 
-// Returns whether the tile at the given position is out of bounds
-// for the player or not.
+// Returns the index of the MAP_SECTOR_SIZE square sector that holds
+// the given position.
 //------------------------------------------------------------------
-extern boolean isOutOfBounds(uint8_t const positionX, uint8_t const positionY)
+extern uint8_t getMapSector(int const positionX, int const positionY)
 {
-    if (positionX < 0 || positionX > MAP_WIDTH_TILES - 1
-    || positionY < 0 || positionY > MAP_HEIGHT_TILES - 1)
-        return TRUE;
-    else
-        return FALSE;
+    return (positionY / MAP_SECTOR_SIZE) * MAP_SECTORS_WIDE + positionX / MAP_SECTOR_SIZE;
 }
 
 //------------------------------------------------------------------
-// Function: isSolid
+// Function: getTerrainVersion
 // 
-// Returns whether the tile at the given position is solid or not.
-// NOTE: Solid tiles should block player movement.
+// Sums the terrain versions of every sector touched by the square of
+// the given range around the given position. The sum only changes if
+// terrain within one of those sectors has changed.
 //------------------------------------------------------------------
-extern boolean isSolid(uint8_t const positionX, uint8_t const positionY)
+extern u32 getTerrainVersion(int const positionX, int const positionY, int const range)
 {
-    if(getTileTerrain(positionX, positionY) != ID_WALL)
-        return FALSE;
-    else
-        return TRUE;
+    int firstSectorX = clamp(positionX - range, 0, MAP_WIDTH_TILES) / MAP_SECTOR_SIZE;
+    int lastSectorX = clamp(positionX + range, 0, MAP_WIDTH_TILES) / MAP_SECTOR_SIZE;
+    int firstSectorY = clamp(positionY - range, 0, MAP_HEIGHT_TILES) / MAP_SECTOR_SIZE;
+    int lastSectorY = clamp(positionY + range, 0, MAP_HEIGHT_TILES) / MAP_SECTOR_SIZE;
+    u32 version = 0;
+
+    for (int sectorY = firstSectorY; sectorY <= lastSectorY; sectorY++)
+    {
+        for (int sectorX = firstSectorX; sectorX <= lastSectorX; sectorX++)
+            version += sectorTerrainVersion[sectorY * MAP_SECTORS_WIDE + sectorX];
+    }
+
+    return version;
+}
+
+//------------------------------------------------------------------
+// Function: testLineIterator
+// 
+// Checks the LineIterator in two ways. Every line from the origin to
+// an endpoint within testRange must take max(|dx|, |dy|) single-tile
+// steps and stay within half a tile of the true line. The lines in
+// knownLines, worked out by hand, must also match tile for tile. Logs
+// PASS or FAIL.
+//------------------------------------------------------------------
+#ifdef DEBUG_BENCHMARK
+extern boolean testLineIterator()
+{
+    // Each is {endX, endY, then x, y of every tile after the origin}.
+    // The tiles are the true line rounded to the nearest row or column,
+    // and no line has a tie to break. There is one line per octant,
+    // then a longer one, a diagonal and a straight one.
+    static int8_t const knownLines[][2 + 2 * 7] =
+    {
+        { 5,  2,   1,  0,   2,  1,   3,  1,   4,  2,   5,  2},
+        { 2,  5,   0,  1,   1,  2,   1,  3,   2,  4,   2,  5},
+        {-2,  5,   0,  1,  -1,  2,  -1,  3,  -2,  4,  -2,  5},
+        {-5,  2,  -1,  0,  -2,  1,  -3,  1,  -4,  2,  -5,  2},
+        {-5, -2,  -1,  0,  -2, -1,  -3, -1,  -4, -2,  -5, -2},
+        {-2, -5,   0, -1,  -1, -2,  -1, -3,  -2, -4,  -2, -5},
+        { 2, -5,   0, -1,   1, -2,   1, -3,   2, -4,   2, -5},
+        { 5, -2,   1,  0,   2, -1,   3, -1,   4, -2,   5, -2},
+        { 7,  3,   1,  0,   2,  1,   3,  1,   4,  2,   5,  2,   6,  3,   7,  3},
+        { 3,  3,   1,  1,   2,  2,   3,  3},
+        { 0, -3,   0, -1,   0, -2,   0, -3}
+    };
+    int const testRange = 12;
+    int lineCount = 0, failCount = 0;
+
+    for (int endY = -testRange; endY <= testRange; endY++)
+    {
+        for (int endX = -testRange; endX <= testRange; endX++)
+        {
+            struct LineIterator line;
+            int stepCount = 0;
+            boolean isMatch = TRUE;
+
+            initLineIterator(&line, 0, 0, endX, endY);
+
+            while (nextLineStep(&line) != DIR_NULL)
+            {
+                stepCount++;
+
+                // No further than half a tile off the line
+                if (2 * ABS(line.currentX * endY - line.currentY * endX) > MAX(ABS(endX), ABS(endY)))
+                    isMatch = FALSE;
+
+                if (stepCount > MAX(ABS(endX), ABS(endY)))
+                    break;
+            }
+
+            if (stepCount != MAX(ABS(endX), ABS(endY)) || line.currentX != endX || line.currentY != endY)
+                isMatch = FALSE;
+
+            if (isMatch == FALSE)
+            {
+                failCount++;
+                mgba_printf(MGBA_LOG_ERROR, "  testLineIterator FAILED: (0, 0) to (%d, %d)", endX, endY);
+            }
+            lineCount++;
+        }
+    }
+
+    for (int i = 0; i < (int)(sizeof(knownLines) / sizeof(knownLines[0])); i++)
+    {
+        struct LineIterator line;
+        int endX = knownLines[i][0], endY = knownLines[i][1];
+        int tileCount = MAX(ABS(endX), ABS(endY));
+        boolean isMatch = TRUE;
+
+        initLineIterator(&line, 0, 0, endX, endY);
+
+        for (int tile = 0; tile < tileCount; tile++)
+        {
+            if (nextLineStep(&line) == DIR_NULL
+            || line.currentX != knownLines[i][2 + 2 * tile] || line.currentY != knownLines[i][3 + 2 * tile])
+                isMatch = FALSE;
+        }
+
+        if (nextLineStep(&line) != DIR_NULL)
+            isMatch = FALSE;
+
+        if (isMatch == FALSE)
+        {
+            failCount++;
+            mgba_printf(MGBA_LOG_ERROR, "  testLineIterator FAILED: known line to (%d, %d)", endX, endY);
+        }
+        lineCount++;
+    }
+
+    mgba_printf(MGBA_LOG_INFO, "testLineIterator: %s, %d of %d lines match",
+        (failCount == 0) ? "PASS" : "FAIL", lineCount - failCount, lineCount);
+
+    return failCount == 0;
+}
+
+//------------------------------------------------------------------
+// Function: benchmarkLineIterator
+// 
+// Times walking many lines with a LineIterator and logs the cycles
+// per step and the steps per second.
+//------------------------------------------------------------------
+extern void benchmarkLineIterator()
+{
+    int const range = SIGHT_RANGE_MAX * 4;
+    u32 stepCount = 0;
+    uint cycles = 0;
+
+    profile_start();
+    for (int endY = -range; endY <= range; endY++)
+    {
+        for (int endX = -range; endX <= range; endX++)
+        {
+            struct LineIterator line;
+
+            initLineIterator(&line, 0, 0, endX, endY);
+            while (nextLineStep(&line) != DIR_NULL)
+                stepCount++;
+        }
+    }
+    cycles = profile_stop();
+
+    mgba_printf(MGBA_LOG_INFO, "benchmarkLineIterator: %d steps in %d cycles", stepCount, cycles);
+    mgba_printf(MGBA_LOG_INFO, "  %d cycles per step, %d steps per second",
+        cycles / stepCount, (u32)((u64)stepCount * CPU_CYCLES_PER_SECOND / cycles));
+}
+#endif
+
+//------------------------------------------------------------------
+// Function: benchmarkTileKernels
+// 
+// Times the IWRAM_ARM_CODE kernels of this file: getTilesetIndex for
+// every corner of every map tile, and drawTile through a redraw of the
+// player's sight, which writes what is already on screen. Logs which
+// memory they ran from, so builds with and without IWRAM_KERNELS can
+// be compared.
+//------------------------------------------------------------------
+#ifdef DEBUG_BENCHMARK
+extern void benchmarkTileKernels()
+{
+    int const iterations = 16;
+    int sightRange = entityPool.sightRange[PLAYER_INDEX];
+    u32 checksum = 0;
+    uint indexCycles = 0, drawCycles = 0;
+
+    profile_start();
+    for (int y = 0; y < MAP_HEIGHT_TILES; y++)
+    {
+        for (int x = 0; x < MAP_WIDTH_TILES; x++)
+        {
+            for (int corner = SCREEN_ENTRY_TL; corner <= SCREEN_ENTRY_BR; corner++)
+                checksum += (u32)getTilesetIndex(&gameMap[y][x], corner);
+        }
+    }
+    indexCycles = profile_stop();
+
+    profile_start();
+    for (int i = 0; i < iterations; i++)
+        updateGameMapSight();
+    drawCycles = profile_stop();
+
+    #ifdef IWRAM_KERNELS
+        mgba_printf(MGBA_LOG_INFO, "benchmarkTileKernels: IWRAM ARM");
+    #else
+        mgba_printf(MGBA_LOG_INFO, "benchmarkTileKernels: ROM Thumb");
+    #endif
+    mgba_printf(MGBA_LOG_INFO, "  getTilesetIndex: %d cycles per corner (checksum %x)",
+        indexCycles / (MAP_WIDTH_TILES * MAP_HEIGHT_TILES * 4), checksum);
+    mgba_printf(MGBA_LOG_INFO, "  drawTile: %d cycles per sight redraw, range %d", drawCycles / iterations, sightRange);
 }
+#endif